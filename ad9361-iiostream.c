@@ -15,14 +15,31 @@
  **/
 
 
+#include <errno.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <iio.h>
 #include <math.h>
 #include <tgmath.h>  // added this cause I had problems with sin()
+#include <sys/stat.h>
 #include <unistd.h>  // need this to be able to use "usleep()" if it becomes necessary for timing
+#include <time.h>
+
+#include "calib.h"
+#include "capture.h"
+#include "dpd.h"
+#include "dsp.h"
+#include "iqconv.h"
+#include "log.h"
+#include "net.h"
+#include "ofdm.h"
+#include "spectrum.h"
+#include "tee.h"
+#include "zmtp.h"
 
 /* helper macros */
 #define MHZ(x) ((long long)(x*1000000.0 + .5))
@@ -54,16 +71,21 @@ static char tmpstr[64];
 static struct iio_context *ctx   = NULL;
 static struct iio_channel *rx0_i = NULL;
 static struct iio_channel *rx0_q = NULL;
+static struct iio_channel *rx1_i = NULL;
+static struct iio_channel *rx1_q = NULL;
 static struct iio_channel *tx0_i = NULL;
 static struct iio_channel *tx0_q = NULL;
 static struct iio_buffer  *rxbuf = NULL;
 static struct iio_buffer  *txbuf = NULL;
 
-static bool stop;
+// set by the signal handler and by sinks on the tee threads, read by the RX loop
+static atomic_bool stop;
+static int exit_status;   // non zero when a streaming error ended the run
 
 /* cleanup and exit */
 static void shutdown()
 {
+	log_stop();
 	printf("* Destroying buffers\n");
 	if (rxbuf) { iio_buffer_destroy(rxbuf); }
 	if (txbuf) { iio_buffer_destroy(txbuf); }
@@ -71,17 +93,20 @@ static void shutdown()
 	printf("* Disabling streaming channels\n");
 	if (rx0_i) { iio_channel_disable(rx0_i); }
 	if (rx0_q) { iio_channel_disable(rx0_q); }
+	if (rx1_i) { iio_channel_disable(rx1_i); }
+	if (rx1_q) { iio_channel_disable(rx1_q); }
 	if (tx0_i) { iio_channel_disable(tx0_i); }
 	if (tx0_q) { iio_channel_disable(tx0_q); }
 
 	printf("* Destroying context\n");
 	if (ctx) { iio_context_destroy(ctx); }
-	exit(0);
+	exit(exit_status);
 }
 
 static void handle_sig(int sig)
 {
-	printf("Waiting for process to finish... Got signal %d\n", sig);
+	// the logger is lock free, printf is not safe in a signal handler
+	log_ev(LOG_WARN, LOG_NONE, LOG_NONE, "Waiting for process to finish... Got signal %d", sig);
 	stop = true;
 }
 
@@ -208,19 +233,2253 @@ bool cfg_ad9361_streaming_ch(struct stream_cfg *cfg, enum iodev type, int chid)
 	return true;
 }
 
+/* buffer sizes, the TX buffer repeats so its length is the burst period */
+#define RX_BUF_SAMPLES 256
+#define TX_BUF_SAMPLES (256*4)
+
+/* RX1 samples of the current block in dual_rx modes */
+static int16_t rx1_iq[2 * RX_BUF_SAMPLES];
+
+/* a test mode: what goes into the TX buffer and what happens to the RX samples */
+struct test_mode {
+	const char *name;
+	const char *help;
+	bool (*start)(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg);
+	// fill the TX buffer before it is pushed
+	void (*tx_fill)(struct iio_buffer *buf, const struct stream_cfg *txcfg);
+	// consume n interleaved I/Q samples from the RX buffer
+	void (*rx_block)(const int16_t *iq, size_t n);
+	void (*finish)(void);
+	// refill and push the TX buffer for every TX buffer worth of RX samples
+	bool tx_stream;
+	// gets the RX samples without the stored calibration applied
+	bool raw;
+	// where the next RX block is copied to, rx_iq when NULL
+	int16_t *(*rx_buffer)(void);
+	// RX1 is streamed too, its samples of the block are in rx1_iq
+	bool dual_rx;
+};
+
+static double ampl = 48; // peak value for a 12 bit value is 4096
+
+/* pack float I/Q (full scale +-1.0) into the TX buffer, returns samples written */
+static size_t tx_write(struct iio_buffer *buf, const float *iq, size_t n)
+{
+	char *first;
+	ptrdiff_t step;
+	size_t room;
+
+	// no buffer when replaying a capture
+	if (!buf)
+		return 0;
+	first = iio_buffer_first(buf, tx0_i);
+	step = iio_buffer_step(buf);
+	room = ((char *)iio_buffer_end(buf) - first + step - 1) / step;
+	if (n > room)
+		n = room;
+	tx_pack(iq, n, first, step);
+	return n;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* where and how the received samples are stored */
+static const char *out_path = NULL;
+static enum capture_fmt out_fmt = CAP_CSV;
+static bool out_overview = false;
+static double out_hz = 0;   // -O: resample the capture to this rate
+
+/*
+ * tone mode: the original loopback test.  A 50KHz sine goes out on Q and
+ * everything received goes to the capture file (output.csv by default).
+ */
+static FILE *finp = NULL;
+static struct capture *cap = NULL;
+static float tx_iq[2 * TX_BUF_SAMPLES];
+
+/* capture resampling, the samples stay 12 bit integers */
+static struct {
+	struct resampler *rs;
+	float complex *in, *out;
+	int16_t *iq;
+} rxo;
+
+/* -R and -O are at most RESAMP_MAX_RATIO times the stream rate either way */
+static bool resample_ok(const char *opt, double hz, double fs_hz)
+{
+	if (hz * RESAMP_MAX_RATIO >= fs_hz && hz <= fs_hz * RESAMP_MAX_RATIO)
+		return true;
+	fprintf(stderr, "%s %g Hz is more than %dx away from %g Hz\n", opt, hz, RESAMP_MAX_RATIO, fs_hz);
+	return false;
+}
+
+static bool open_capture(const struct stream_cfg *rxcfg)
+{
+	if (!out_path)
+		out_path = out_fmt == CAP_CSV ? "output.csv" : "output.iq";
+	if (out_hz > 0 && out_hz != rxcfg->fs_hz) {
+		size_t max;
+		if (!resample_ok("-O", out_hz, rxcfg->fs_hz))
+			return false;
+		rxo.rs = resampler_create(out_hz / rxcfg->fs_hz);
+		if (!rxo.rs)
+			return false;
+		max = resampler_max_out(rxo.rs, RX_BUF_SAMPLES);
+		rxo.in = malloc(RX_BUF_SAMPLES * sizeof(*rxo.in));
+		rxo.out = malloc(max * sizeof(*rxo.out));
+		rxo.iq = malloc(max * 2 * sizeof(*rxo.iq));
+		if (!rxo.in || !rxo.out || !rxo.iq)
+			return false;
+		printf("* capture resampled from %.6f to %.6f MS/s\n", rxcfg->fs_hz * 1e-6, out_hz * 1e-6);
+	}
+	cap = capture_open(out_path, out_fmt, out_overview);
+	return cap != NULL;
+}
+
+static bool tone_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	// DAD let's create a couple of files so we can see what is transmitted/received
+	finp = fopen("input.csv", "w+");
+	return open_capture(rxcfg) && finp;
+}
+
+static void tone_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	char *p_dat, *p_end;
+	ptrdiff_t p_inc;
+	size_t s;
+
+	float freq = 2.0 * M_PI * 50.0e3;  // 2*pi*50KHz
+	double i = 1. / txcfg->fs_hz;
+
+// fill the transmit buffer with a sine wave.
+	for (s = 0; s < TX_BUF_SAMPLES; s++) {
+		// fill tx buffer with sine wave, tx_pack() takes care of moving the
+		// 12 bits to the MSB of the 16 bit array
+		// https://wiki.analog.com/resources/eval/user-guides/ad-fmcomms2-ebz/software/basic_iq_datafiles#binary_format
+		tx_iq[2*s]   = 0;
+		tx_iq[2*s+1] = ampl * cos(freq * i) / IQ_FULL_SCALE;
+		i += 1. / txcfg->fs_hz;
+	}
+	tx_write(buf, tx_iq, TX_BUF_SAMPLES);
+
+	// WRITE: Get pointers to TX buf and dump what went into TX buf port 0
+	if (!finp || !buf)
+		return;
+	p_inc = iio_buffer_step(buf);
+	p_end = iio_buffer_end(buf);
+	for (p_dat = (char *)iio_buffer_first(buf, tx0_i); p_dat < p_end; p_dat += p_inc) {
+		// fill output file with the data so we can see what was sent.
+		fprintf(finp, "%d, %d\n", ((int16_t*)p_dat)[0], ((int16_t*)p_dat)[1]);
+	}
+}
+
+/* resample an RX block to out_hz, rounded and saturated back to 12 bit */
+static size_t rx_resample(const int16_t *iq, size_t n, const int16_t **res)
+{
+	size_t k, m;
+
+	for (k = 0; k < n; k++)
+		rxo.in[k] = iq[2 * k] + I * iq[2 * k + 1];
+	m = resampler_process(rxo.rs, rxo.in, n, rxo.out);
+	for (k = 0; k < m; k++) {
+		float re = fminf(fmaxf(rintf(crealf(rxo.out[k])), -IQ_FULL_SCALE), IQ_FULL_SCALE - 1);
+		float im = fminf(fmaxf(rintf(cimagf(rxo.out[k])), -IQ_FULL_SCALE), IQ_FULL_SCALE - 1);
+		rxo.iq[2 * k] = (int16_t)re;
+		rxo.iq[2 * k + 1] = (int16_t)im;
+	}
+	*res = rxo.iq;
+	return m;
+}
+
+static void tone_rx_block(const int16_t *iq, size_t n)
+{
+	int ret;
+
+	if (rxo.rs)
+		n = rx_resample(iq, n, &iq);
+	ret = capture_write(cap, iq, n);
+	if (ret < 0) {
+		log_ev(LOG_ERR, LOG_NONE, cap->nsamp, "Error %d writing %s", ret, out_path);
+		stop = true;
+	}
+}
+
+static void tone_finish(void)
+{
+	int ret;
+
+	if (finp) { fclose(finp); finp = NULL; }
+	if (cap && cap->fmt == CAP_BFP && cap->bfp.nblocks)
+		printf("* bfp capture: %llu blocks, SQNR min %.2f dB, mean %.2f dB\n",
+		       (unsigned long long)cap->bfp.nblocks, cap->bfp.sqnr_min,
+		       cap->bfp.sqnr_sum / cap->bfp.nblocks);
+	// a full disk often only shows when the last buffers go out
+	if ((ret = capture_close(cap)) < 0) {
+		fprintf(stderr, "Error %d writing %s\n", ret, out_path);
+		exit_status = 1;
+	}
+	cap = NULL;
+	resampler_destroy(rxo.rs);
+	free(rxo.in);
+	free(rxo.out);
+	free(rxo.iq);
+}
+
+/*
+ * chirp mode: channel sounder.  Each TX period starts with a linear chirp
+ * followed by silence.  The RX stream goes through a matched filter
+ * (overlap-save fast convolution) which compresses every chirp into the
+ * impulse response of the loopback channel.  Per burst we report where
+ * the peak landed and the group delay, and dump the response to impulse.csv.
+ */
+#define CHIRP_LEN   256   // chirp length in samples
+#define CHIRP_NFFT  2048  // matched filter transform size
+#define IR_LEN      64    // impulse response taps kept per burst
+#define IR_PRE      16    // taps kept before the peak
+
+static struct {
+	double fs;
+	float complex chirp[CHIRP_LEN];
+	struct ols_filter *mf;
+	float complex in[RX_BUF_SAMPLES];
+	float complex out[RX_BUF_SAMPLES + CHIRP_NFFT];
+	float complex burst[TX_BUF_SAMPLES];
+	size_t fill;
+	unsigned nburst;
+	double busy;     // seconds spent filtering and analysing
+	size_t nsamp;
+	FILE *fir;
+} snd;
+
+static bool chirp_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	float complex h[CHIRP_LEN];
+	double span = 0.8 * txcfg->bw_hz;
+	size_t k;
+
+	snd.fs = rxcfg->fs_hz;
+	chirp_generate(snd.chirp, CHIRP_LEN, -span / 2, span / 2, txcfg->fs_hz);
+
+	// matched filter is the time reversed conjugate of the chirp
+	for (k = 0; k < CHIRP_LEN; k++)
+		h[k] = conj(snd.chirp[CHIRP_LEN - 1 - k]) / CHIRP_LEN;
+	snd.mf = ols_create(h, CHIRP_LEN, CHIRP_NFFT);
+	if (!snd.mf)
+		return false;
+
+	snd.fir = fopen("impulse.csv", "w+");
+	return snd.fir != NULL;
+}
+
+static void chirp_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	size_t s;
+
+	memset(tx_iq, 0, sizeof(tx_iq));
+	for (s = 0; s < CHIRP_LEN; s++) {
+		tx_iq[2*s]   = ampl * creal(snd.chirp[s]) / IQ_FULL_SCALE;
+		tx_iq[2*s+1] = ampl * cimag(snd.chirp[s]) / IQ_FULL_SCALE;
+	}
+	tx_write(buf, tx_iq, TX_BUF_SAMPLES);
+}
+
+/* one full TX period of matched filter output is in snd.burst */
+static void chirp_burst(void)
+{
+	float complex ir[IR_LEN];
+	size_t k, pk = 0, start;
+	double best = 0, frac, gd;
+
+	for (k = 0; k < TX_BUF_SAMPLES; k++) {
+		double m = cabs(snd.burst[k]);
+		if (m > best) { best = m; pk = k; }
+	}
+	frac = parabolic_peak(cabs(snd.burst[(pk + TX_BUF_SAMPLES - 1) % TX_BUF_SAMPLES]), best,
+	                      cabs(snd.burst[(pk + 1) % TX_BUF_SAMPLES]));
+
+	// impulse response around the peak, normalized to the TX amplitude
+	start = (pk + TX_BUF_SAMPLES - IR_PRE) % TX_BUF_SAMPLES;
+	for (k = 0; k < IR_LEN; k++)
+		ir[k] = snd.burst[(start + k) % TX_BUF_SAMPLES] * (2048.0 / ampl);
+	gd = fmod(start + group_delay(ir, IR_LEN), TX_BUF_SAMPLES);
+
+	log_ev(LOG_INFO, LOG_NONE, (uint64_t)snd.nburst * TX_BUF_SAMPLES,
+	       "burst %u: peak %.2f (%.1f dB), group delay %.2f samples (%.3f us)",
+	       snd.nburst, pk + frac, 20 * log10(best * 2048.0 / ampl + 1e-12),
+	       gd, gd / snd.fs * 1e6);
+	for (k = 0; k < IR_LEN; k++)
+		fprintf(snd.fir, "%u, %d, %.6f, %.6f, %.6f\n", snd.nburst, (int)k - IR_PRE,
+		        creal(ir[k]), cimag(ir[k]), cabs(ir[k]));
+	snd.nburst++;
+}
+
+static void chirp_rx_block(const int16_t *iq, size_t n)
+{
+	double t0 = now_sec();
+	size_t s, nout, used = 0;
+
+	for (s = 0; s < n; s++)
+		snd.in[s] = (iq[2*s] + I * iq[2*s+1]) / IQ_FULL_SCALE;
+	nout = ols_process(snd.mf, snd.in, n, snd.out);
+
+	while (used < nout) {
+		size_t take = TX_BUF_SAMPLES - snd.fill;
+		if (take > nout - used)
+			take = nout - used;
+		memcpy(snd.burst + snd.fill, snd.out + used, take * sizeof(*snd.out));
+		snd.fill += take;
+		used += take;
+		if (snd.fill == TX_BUF_SAMPLES) {
+			chirp_burst();
+			snd.fill = 0;
+		}
+	}
+	snd.nsamp += n;
+	snd.busy += now_sec() - t0;
+}
+
+static void chirp_finish(void)
+{
+	if (snd.busy > 0)
+		printf("* matched filter: %.2f MS/s, %.1fx the %.2f MS/s sample rate\n",
+		       snd.nsamp / snd.busy * 1e-6, snd.nsamp / snd.busy / snd.fs, snd.fs * 1e-6);
+	ols_destroy(snd.mf);
+	if (snd.fir) { fclose(snd.fir); }
+}
+
+/*
+ * play mode: stream a float32 I/Q file (interleaved, full scale +-1.0, the
+ * GNU Radio complex format) out of TX, starting over at the end of the
+ * file.  When the file was recorded at another rate (-R) it is resampled
+ * to the TX rate on the way.  RX goes to the capture file like in tone mode.
+ */
+#define PLAY_CHUNK 1024   // file samples read per resampler call
+
+static const char *tx_path = NULL;
+static double tx_file_hz = 0;
+static FILE *ftx = NULL;
+
+static struct {
+	struct resampler *rs;
+	float complex in[PLAY_CHUNK];
+	float complex *fifo;   // resampled samples not sent yet
+	size_t fill;
+} play;
+
+static bool play_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	if (!tx_path) {
+		fprintf(stderr, "play mode needs a waveform file (-t)\n");
+		return false;
+	}
+	ftx = fopen(tx_path, "rb");
+	if (!ftx) {
+		perror(tx_path);
+		return false;
+	}
+	// play_read starts over at the end, there has to be something to start over with
+	if (fseek(ftx, 0, SEEK_END) || ftell(ftx) < (long)(2 * sizeof(float))) {
+		fprintf(stderr, "%s: no whole float32 I/Q sample\n", tx_path);
+		return false;
+	}
+	rewind(ftx);
+	if (tx_file_hz > 0 && tx_file_hz != txcfg->fs_hz) {
+		if (!resample_ok("-R", tx_file_hz, txcfg->fs_hz))
+			return false;
+		play.rs = resampler_create(txcfg->fs_hz / tx_file_hz);
+		if (!play.rs)
+			return false;
+		play.fifo = malloc((TX_BUF_SAMPLES + resampler_max_out(play.rs, PLAY_CHUNK)) * sizeof(*play.fifo));
+		if (!play.fifo)
+			return false;
+		printf("* %s resampled from %.6f to %.6f MS/s\n", tx_path, tx_file_hz * 1e-6, txcfg->fs_hz * 1e-6);
+	}
+	return open_capture(rxcfg);
+}
+
+/*
+ * n interleaved float I/Q pairs from the file, starting over at its end.  On
+ * a read error, or when a whole pass gives nothing because the file shrank,
+ * the rest is silence and the run stops.
+ */
+static void play_read(float *iq, size_t n)
+{
+	size_t k = 0, got;
+	bool wrapped = false;
+
+	while (k < n) {
+		got = fread(iq + 2 * k, 2 * sizeof(float), n - k, ftx);
+		k += got;
+		if (k == n)
+			break;
+		if (ferror(ftx) || (wrapped && !got)) {
+			log_ev(LOG_ERR, LOG_NONE, LOG_NONE, "%s: %s", tx_path, ferror(ftx) ? "read error" : "no whole I/Q sample left");
+			memset(iq + 2 * k, 0, (n - k) * 2 * sizeof(float));
+			exit_status = 1;
+			stop = true;
+			return;
+		}
+		rewind(ftx);
+		wrapped = true;
+	}
+}
+
+static void play_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	if (!play.rs) {
+		play_read(tx_iq, TX_BUF_SAMPLES);
+		tx_write(buf, tx_iq, TX_BUF_SAMPLES);
+		return;
+	}
+	// the resampler gives a varying number of samples per chunk, keep the rest for the next buffer
+	while (play.fill < TX_BUF_SAMPLES) {
+		size_t m;
+		play_read((float *)play.in, PLAY_CHUNK);
+		m = resampler_process(play.rs, play.in, PLAY_CHUNK, play.fifo + play.fill);
+		if (!m) {
+			// a chunk of PLAY_CHUNK >= RESAMP_MAX_RATIO always gives one
+			log_ev(LOG_ERR, LOG_NONE, LOG_NONE, "play: resampler out of memory");
+			memset(play.fifo + play.fill, 0, (TX_BUF_SAMPLES - play.fill) * sizeof(*play.fifo));
+			play.fill = TX_BUF_SAMPLES;
+			exit_status = 1;
+			stop = true;
+		}
+		play.fill += m;
+	}
+	memcpy(tx_iq, play.fifo, TX_BUF_SAMPLES * sizeof(*play.fifo));
+	play.fill -= TX_BUF_SAMPLES;
+	memmove(play.fifo, play.fifo + TX_BUF_SAMPLES, play.fill * sizeof(*play.fifo));
+	tx_write(buf, tx_iq, TX_BUF_SAMPLES);
+}
+
+static void play_finish(void)
+{
+	if (ftx) { fclose(ftx); }
+	resampler_destroy(play.rs);
+	free(play.fifo);
+	tone_finish();
+}
+
+/*
+ * calibration store: the corrections measured for the current LO, sample
+ * rate and gains (-c file) are applied to RX before the test mode sees it.
+ */
+static const char *cal_path = "ad9361-cal.txt";
+static const char *fft_path = NULL;   // FFT wisdom, dsp.h
+static struct calib_db *cal_db = NULL;
+static struct calib_key cal_key;
+static struct calib_corr cal_corr;
+static bool cal_have = false;
+
+/*
+ * the FFT wisdom lives in the user's cache directory, $XDG_CACHE_HOME or
+ * else ~/.cache, unless -w names a file; with neither set there is none
+ */
+static char fft_cache[4096];
+
+static const char *fft_default_path(void)
+{
+	const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+	int len = -1;
+
+	// a relative XDG_CACHE_HOME is invalid and ignored
+	if (xdg && *xdg == '/')
+		len = snprintf(fft_cache, sizeof(fft_cache), "%s/ad9361-fft.txt", xdg);
+	else if (home && *home)
+		len = snprintf(fft_cache, sizeof(fft_cache), "%s/.cache/ad9361-fft.txt", home);
+	if (len < 0 || len >= (int)sizeof(fft_cache))
+		fft_cache[0] = '\0';
+	return fft_cache;
+}
+
+/* the cache directory may not exist yet on a fresh account */
+static void fft_cache_mkdir(void)
+{
+	char dir[sizeof(fft_cache)];
+	char *slash;
+
+	strcpy(dir, fft_cache);
+	slash = strrchr(dir, '/');
+	if (slash && slash != dir) {
+		*slash = '\0';
+		mkdir(dir, 0700);
+	}
+}
+
+/*
+ * cal mode: a complex tone (I = cos, Q = sin) a whole number of periods
+ * long per TX buffer, RX DC, IQ imbalance and loopback gain are measured
+ * and merged into the calibration store.
+ */
+#define CAL_CYCLES 17
+
+static struct calib_acc cal_acc;
+
+static bool cal_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	if (!cal_db) {
+		fprintf(stderr, "cal mode needs a calibration store (-c)\n");
+		return false;
+	}
+	memset(&cal_acc, 0, sizeof(cal_acc));
+	return true;
+}
+
+static void cal_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	size_t s;
+
+	for (s = 0; s < TX_BUF_SAMPLES; s++) {
+		double ph = 2.0 * M_PI * CAL_CYCLES * s / TX_BUF_SAMPLES;
+		tx_iq[2*s]   = ampl * cos(ph) / IQ_FULL_SCALE;
+		tx_iq[2*s+1] = ampl * sin(ph) / IQ_FULL_SCALE;
+	}
+	tx_write(buf, tx_iq, TX_BUF_SAMPLES);
+}
+
+static void cal_rx_block(const int16_t *iq, size_t n)
+{
+	calib_acc_add(&cal_acc, iq, n);
+}
+
+static void cal_finish(void)
+{
+	const struct calib_entry *e;
+	struct calib_entry m = { cal_key };
+	int ret;
+
+	if (!cal_acc.n)
+		return;
+	calib_acc_result(&cal_acc, ampl, &m);
+	printf("* measured DC %.2f, %.2f, IQ gain %.4f, phase %.3f deg, loopback gain %.2f dB\n",
+	       m.dc[0], m.dc[1], m.iq_gain, m.iq_phase, m.loop_gain_db);
+	e = calib_update(cal_db, &m);
+	if (!e)
+		return;
+	printf("* stored DC %.2f, %.2f, IQ gain %.4f, phase %.3f deg, loopback gain %.2f dB (%u runs)\n",
+	       e->dc[0], e->dc[1], e->iq_gain, e->iq_phase, e->loop_gain_db, e->nmeas);
+	if ((ret = calib_save(cal_db)) < 0)
+		fprintf(stderr, "Error %d writing %s\n", ret, cal_path);
+}
+
+/*
+ * dpd mode: digital predistortion with the loopback standing in for the
+ * PA.  A random phase multitone over +-DPD_BW of the sample rate is sent,
+ * one TX buffer long so it repeats, through the predistorter.  RX is
+ * averaged over DPD_PERIODS periods, aligned to TX by circular cross
+ * correlation and a memory polynomial is fitted from RX (over the linear
+ * gain of the first iteration) back to the predistorted TX samples.  The
+ * fit replaces the predistorter and the next iteration measures the result.
+ * Each iteration prints the EVM of RX against the undistorted stimulus and
+ * the power next to the band (ACPR).
+ */
+#define DPD_BW      0.1   // stimulus band, fraction of the sample rate either side
+#define DPD_PEAK    0.8   // stimulus peak, full scale 1.0
+#define DPD_PERIODS 16    // TX buffers averaged per iteration
+#define DPD_SETTLE  (4 * TX_BUF_SAMPLES)   // RX ignored after a change of the predistorter
+#define DPD_ITERS   5
+
+static struct {
+	struct dpd pd;
+	float complex u[TX_BUF_SAMPLES];   // stimulus
+	float complex x[TX_BUF_SAMPLES];   // what went out, after the predistorter
+	double complex yacc[TX_BUF_SAMPLES];
+	struct fft_plan *fwd, *inv;
+	size_t kmax;                       // highest stimulus bin
+	unsigned long long pos;            // RX samples seen
+	unsigned long long start;          // where averaging starts for this iteration
+	int iter;
+	double complex gain;               // linear loopback gain of the first iteration
+	double apply_busy, fit_busy;
+	unsigned long long napplied;
+} dpd;
+
+static bool dpd_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	uint32_t seed = 1;
+	float peak = 0;
+	size_t k, s;
+
+	dpd.fwd = fft_plan_create(TX_BUF_SAMPLES, FFT_FORWARD);
+	dpd.inv = fft_plan_create(TX_BUF_SAMPLES, FFT_INVERSE);
+	if (!dpd.fwd || !dpd.inv)
+		return false;
+	dpd_init(&dpd.pd);
+
+	// random phases on every bin of the band but DC, so RX DC stays out of the way
+	dpd.kmax = (size_t)(DPD_BW * TX_BUF_SAMPLES);
+	memset(dpd.u, 0, sizeof(dpd.u));
+	for (k = 1; k <= dpd.kmax; k++) {
+		seed = seed * 1664525 + 1013904223;
+		dpd.u[k] = cexpf(I * 2 * M_PI * (seed >> 8) / 16777216.0f);
+		seed = seed * 1664525 + 1013904223;
+		dpd.u[TX_BUF_SAMPLES - k] = cexpf(I * 2 * M_PI * (seed >> 8) / 16777216.0f);
+	}
+	fft_execute(dpd.inv, dpd.u);
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		peak = fmaxf(peak, cabsf(dpd.u[s]));
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		dpd.u[s] *= DPD_PEAK / peak;
+	dpd.start = DPD_SETTLE;
+	printf("* dpd: %zu tones over +-%.0f kHz, memory polynomial of orders 1..%d, %d taps\n",
+	       2 * dpd.kmax, DPD_BW * rxcfg->fs_hz * 1e-3, 2 * DPD_ORDERS - 1, DPD_MEMORY);
+	return true;
+}
+
+static void dpd_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	double t0 = now_sec();
+
+	dpd_apply(&dpd.pd, dpd.u, TX_BUF_SAMPLES, dpd.x);
+	dpd.apply_busy += now_sec() - t0;
+	dpd.napplied += TX_BUF_SAMPLES;
+	tx_write(buf, (const float *)dpd.x, TX_BUF_SAMPLES);
+}
+
+/* EVM of RX against the stimulus and adjacent channel power of one period, dB */
+static void dpd_measure(const float complex *y, double *evm, double *acpr)
+{
+	static float complex spec[TX_BUF_SAMPLES];
+	double e = 0, p = 0, in = 0, adj = 0;
+	size_t s, k;
+
+	for (s = 0; s < TX_BUF_SAMPLES; s++) {
+		double complex d = y[s] / dpd.gain - dpd.u[s];
+		e += creal(d * conj(d));
+		p += crealf(dpd.u[s] * conjf(dpd.u[s]));
+	}
+	*evm = 10 * log10(e / p);
+
+	memcpy(spec, y, sizeof(spec));
+	fft_execute(dpd.fwd, spec);
+	for (k = 1; k <= 3 * dpd.kmax && k < TX_BUF_SAMPLES / 2; k++) {
+		double pw = crealf(spec[k] * conjf(spec[k])) +
+			    crealf(spec[TX_BUF_SAMPLES - k] * conjf(spec[TX_BUF_SAMPLES - k]));
+		if (k <= dpd.kmax)
+			in += pw;
+		else
+			adj += pw;
+	}
+	*acpr = 10 * log10(adj / in);
+}
+
+/* one iteration's averaged RX period is in yacc: measure, fit, update the predistorter */
+static void dpd_iterate(void)
+{
+	static float complex y[TX_BUF_SAMPLES], c[TX_BUF_SAMPLES], yext[DPD_MEMORY - 1 + TX_BUF_SAMPLES];
+	struct dpd_fit fit;
+	float complex w[DPD_NCOEF];
+	size_t s, lag = 0;
+	double best = -1, evm, acpr, nmse, t0;
+	double complex dc = 0;
+
+	// average in full scale units without the RX DC offset, the stimulus has none
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		dc += dpd.yacc[s];
+	dc /= TX_BUF_SAMPLES;
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		y[s] = (dpd.yacc[s] - dc) / (DPD_PERIODS * IQ_FULL_SCALE);
+
+	// circular cross correlation with what was sent, y[s + lag] ~ x[s]
+	memcpy(c, y, sizeof(c));
+	memcpy(yext, dpd.x, sizeof(c));
+	fft_execute(dpd.fwd, c);
+	fft_execute(dpd.fwd, yext);
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		c[s] *= conjf(yext[s]);
+	fft_execute(dpd.inv, c);
+	for (s = 0; s < TX_BUF_SAMPLES; s++) {
+		if (cabsf(c[s]) > best) {
+			best = cabsf(c[s]);
+			lag = s;
+		}
+	}
+	// yacc is indexed by RX sample number, the period started at dpd.start
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		c[s] = y[(s + lag) % TX_BUF_SAMPLES];
+	memcpy(y, c, sizeof(y));
+
+	if (dpd.iter == 0) {
+		double complex num = 0;
+		double den = 0;
+		for (s = 0; s < TX_BUF_SAMPLES; s++) {
+			num += y[s] * conjf(dpd.u[s]);
+			den += crealf(dpd.u[s] * conjf(dpd.u[s]));
+		}
+		dpd.gain = num / den;
+	}
+	dpd_measure(y, &evm, &acpr);
+
+	// postdistorter from RX over the gain back to TX, the period wraps around for the memory
+	t0 = now_sec();
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		yext[DPD_MEMORY - 1 + s] = y[s] / dpd.gain;
+	for (s = 0; s < DPD_MEMORY - 1; s++)
+		yext[s] = yext[TX_BUF_SAMPLES + s];
+	dpd_fit_reset(&fit);
+	dpd_fit_add(&fit, yext + DPD_MEMORY - 1, dpd.x, TX_BUF_SAMPLES);
+	if (dpd_fit_solve(&fit, w, &nmse) < 0) {
+		log_ev(LOG_ERR, LOG_NONE, dpd.pos, "dpd: fit failed, keeping the predistorter");
+		nmse = 0;
+	} else {
+		memcpy(dpd.pd.w, w, sizeof(w));
+	}
+	dpd.fit_busy += now_sec() - t0;
+
+	log_ev(LOG_INFO, LOG_NONE, dpd.pos, "dpd iteration %d: lag %zu, gain %.2f dB, EVM %.1f dB, ACPR %.1f dB, fit NMSE %.1f dB",
+	       dpd.iter, lag, 20 * log10(cabs(dpd.gain)), evm, acpr, nmse);
+}
+
+static void dpd_rx_block(const int16_t *iq, size_t n)
+{
+	size_t s;
+
+	for (s = 0; s < n; s++, dpd.pos++) {
+		if (dpd.pos < dpd.start)
+			continue;
+		dpd.yacc[(dpd.pos - dpd.start) % TX_BUF_SAMPLES] += iq[2 * s] + I * iq[2 * s + 1];
+		if (dpd.pos + 1 == dpd.start + DPD_PERIODS * TX_BUF_SAMPLES) {
+			dpd_iterate();
+			memset(dpd.yacc, 0, sizeof(dpd.yacc));
+			dpd.start = dpd.pos + 1 + DPD_SETTLE;
+			if (++dpd.iter == DPD_ITERS) {
+				stop = true;
+				return;
+			}
+		}
+	}
+}
+
+static void dpd_finish(void)
+{
+	size_t k;
+
+	if (dpd.iter < DPD_ITERS)
+		printf("* dpd: only %d of %d iterations, run with -n %d or more\n", dpd.iter, DPD_ITERS,
+		       DPD_ITERS * (DPD_SETTLE + DPD_PERIODS * TX_BUF_SAMPLES) / RX_BUF_SAMPLES);
+	if (dpd.iter)
+		printf("* dpd: fit %.3f ms per iteration, predistorter %.1f MS/s\n",
+		       dpd.fit_busy / dpd.iter * 1e3, dpd.apply_busy > 0 ? dpd.napplied / dpd.apply_busy * 1e-6 : 0);
+	for (k = 0; k < DPD_NCOEF; k++)
+		printf("* dpd: w[%zu][%zu] = %+.5f %+.5fj\n", 2 * (k / DPD_MEMORY) + 1, k % DPD_MEMORY,
+		       crealf(dpd.pd.w[k]), cimagf(dpd.pd.w[k]));
+	fft_plan_destroy(dpd.fwd);
+	fft_plan_destroy(dpd.inv);
+}
+
+/*
+ * ofdm mode: a QPSK OFDM modem over the loopback (ofdm.h), configured with
+ * -F nfft:cp:pilot:nsym.  RX is demodulated as it comes in; at the end the
+ * bit error rate, the SNR of every carrier (also written to ofdm.csv) and
+ * how fast the receiver ran compared to the sample rate are printed.
+ */
+#define OFDM_RMS 0.2   // TX level, full scale 1.0, leaves room for the peaks
+
+static const char *ofdm_spec = "256:32:8:16";
+
+static struct {
+	struct ofdm *o;
+	double fs;
+	double busy;
+	unsigned long long nsamp;
+	float complex tx[TX_BUF_SAMPLES];
+	float complex rx[RX_BUF_SAMPLES];
+} ofd;
+
+static bool ofdm_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	struct ofdm_cfg cfg;
+	struct ofdm *o;
+
+	if (ofdm_cfg_parse(ofdm_spec, &cfg)) {
+		fprintf(stderr, "bad OFDM configuration \"%s\", want nfft[:cp[:pilot[:nsym]]]\n", ofdm_spec);
+		return false;
+	}
+	o = ofd.o = ofdm_create(&cfg);
+	if (!o)
+		return false;
+	ofd.fs = rxcfg->fs_hz;
+	printf("* ofdm: %zu point FFT, %zu prefix, %zu carriers (%zu data), %zu symbols per frame of %zu samples\n",
+	       cfg.nfft, cfg.ncp, o->nused, o->ndata, cfg.nsym, o->frame_len);
+	printf("* ofdm: QPSK payload %.3f Mbit/s at %.2f MS/s\n",
+	       ofdm_frame_bits(o) * ofd.fs / o->frame_len * 1e-6, ofd.fs * 1e-6);
+	return true;
+}
+
+static void ofdm_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	size_t s;
+
+	ofdm_tx(ofd.o, ofd.tx, TX_BUF_SAMPLES);
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		ofd.tx[s] *= OFDM_RMS;
+	tx_write(buf, (const float *)ofd.tx, TX_BUF_SAMPLES);
+}
+
+static void ofdm_rx_block(const int16_t *iq, size_t n)
+{
+	double t0 = now_sec();
+	size_t s;
+
+	for (s = 0; s < n; s++)
+		ofd.rx[s] = (iq[2 * s] + I * iq[2 * s + 1]) / IQ_FULL_SCALE;
+	if (ofdm_rx(ofd.o, ofd.rx, n) < 0) {
+		log_ev(LOG_ERR, LOG_NONE, ofd.nsamp, "ofdm: out of memory");
+		stop = true;
+	}
+	ofd.busy += now_sec() - t0;
+	ofd.nsamp += n;
+}
+
+static void ofdm_finish(void)
+{
+	struct ofdm *o = ofd.o;
+	double lo = INFINITY, hi = -INFINITY, mean = 0;
+	size_t i, nc = 0;
+	FILE *f;
+
+	if (!o)
+		return;
+	printf("* ofdm: %llu frames, %llu rejected, %llu bits, %llu errors (BER %.2e), CFO %.1f Hz\n",
+	       o->frames, o->rejected, o->nbits, o->bit_errors,
+	       o->nbits ? (double)o->bit_errors / o->nbits : 0.0,
+	       o->frames ? o->cfo_sum / o->frames * ofd.fs : 0.0);
+	if (ofd.busy > 0)
+		printf("* ofdm: receiver %.2f MS/s, %.1fx the sample rate\n",
+		       ofd.nsamp / ofd.busy * 1e-6, ofd.nsamp / ofd.busy / ofd.fs);
+	f = fopen("ofdm.csv", "w");
+	if (f)
+		fprintf(f, "carrier, snr_db\n");
+	for (i = 0; i < o->nused; i++) {
+		double snr;
+		if (o->pilot[i] || !o->err[i])
+			continue;
+		snr = 10 * log10(o->sig[i] / o->err[i]);
+		if (f)
+			fprintf(f, "%d, %.2f\n", ofdm_carrier(o, i), snr);
+		lo = fmin(lo, snr);
+		hi = fmax(hi, snr);
+		mean += snr;
+		nc++;
+	}
+	if (f)
+		fclose(f);
+	if (nc)
+		printf("* ofdm: carrier SNR min %.1f dB, mean %.1f dB, max %.1f dB (ofdm.csv)\n", lo, mean / nc, hi);
+	ofdm_destroy(o);
+}
+
+/*
+ * sinad mode: converter style measurements instead of a capture.  A
+ * complex tone near 50KHz, on a whole number of cycles per TX buffer so
+ * it repeats without a seam, goes out at SINAD_DBFS.  RX goes into an
+ * averaged spectrum (spectrum.h) and every SINAD_AVG transforms the tone
+ * level, SNR, SINAD, THD, SFDR and ENOB are logged; at the end the same
+ * over the whole run, with the noise floor and the worst spur.
+ */
+#define SINAD_NFFT   4096
+#define SINAD_AVG    128    // transforms per report, 0.17 s at 3 MS/s
+#define SINAD_DBFS   -6.0   // TX tone level
+#define SINAD_SETTLE (4 * TX_BUF_SAMPLES)
+
+static struct {
+	struct spectrum *sp;
+	double fs;
+	size_t bin;                  // tone bin of the RX transform
+	double p[SINAD_NFFT];
+	double total[SINAD_NFFT];    // sum over the reports
+	unsigned ntotal;
+	unsigned long long pos;
+	float complex x[RX_BUF_SAMPLES];
+} meas;
+
+static bool sinad_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	meas.sp = spectrum_create(SINAD_NFFT);
+	if (!meas.sp)
+		return false;
+	meas.fs = rxcfg->fs_hz;
+	return true;
+}
+
+/* complex tone near hz on a whole number of cycles per TX buffer, returns the cycles */
+static long tx_tone(struct iio_buffer *buf, double fs, double hz, double dbfs)
+{
+	long cycles = lround(hz * TX_BUF_SAMPLES / fs);
+	double a = pow(10, dbfs / 20);
+	size_t s;
+
+	for (s = 0; s < TX_BUF_SAMPLES; s++) {
+		double ph = 2 * M_PI * cycles * s / TX_BUF_SAMPLES;
+		tx_iq[2 * s]     = a * cos(ph);
+		tx_iq[2 * s + 1] = a * sin(ph);
+	}
+	tx_write(buf, tx_iq, TX_BUF_SAMPLES);
+	return cycles;
+}
+
+static void sinad_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	long cycles = tx_tone(buf, txcfg->fs_hz, 50.0e3, SINAD_DBFS);
+
+	meas.bin = cycles * (SINAD_NFFT / TX_BUF_SAMPLES);
+	printf("* sinad: %.3f kHz tone at %.1f dBFS, %d point spectra, %d per report\n",
+	       cycles * txcfg->fs_hz / TX_BUF_SAMPLES * 1e-3, SINAD_DBFS, SINAD_NFFT, SINAD_AVG);
+}
+
+static void sinad_report(const double *p, enum log_level level, uint64_t sample)
+{
+	struct tone_meas m;
+
+	if (tone_analyze(p, SINAD_NFFT, meas.bin, &m) < 0) {
+		log_ev(LOG_ERR, LOG_NONE, sample, "sinad: out of memory");
+		stop = true;
+		return;
+	}
+	log_ev(level, LOG_NONE, sample, "tone %.2f dBFS, SNR %.2f dB, SINAD %.2f dB, THD %.2f dBc, SFDR %.2f dB, ENOB %.2f",
+	       m.level, m.snr, m.sinad, m.thd, m.sfdr, m.enob);
+}
+
+static void sinad_rx_block(const int16_t *iq, size_t n)
+{
+	size_t s, i;
+
+	if (meas.pos < SINAD_SETTLE) {
+		size_t skip = SINAD_SETTLE - meas.pos < n ? SINAD_SETTLE - meas.pos : n;
+		meas.pos += skip;
+		iq += 2 * skip;
+		n -= skip;
+	}
+	for (s = 0; s < n; s++)
+		meas.x[s] = (iq[2 * s] + I * iq[2 * s + 1]) / IQ_FULL_SCALE;
+	spectrum_feed(meas.sp, meas.x, n);
+	meas.pos += n;
+	if (meas.sp->navg < SINAD_AVG)
+		return;
+	spectrum_take(meas.sp, meas.p);
+	for (i = 0; i < SINAD_NFFT; i++)
+		meas.total[i] += meas.p[i];
+	meas.ntotal++;
+	sinad_report(meas.p, LOG_INFO, meas.pos);
+}
+
+static void sinad_finish(void)
+{
+	unsigned navg;
+	struct tone_meas m;
+	double f;
+	size_t i;
+
+	if (!meas.sp)
+		return;
+	// the transforms of an unfinished report count too
+	navg = spectrum_take(meas.sp, meas.p);
+	for (i = 0; i < SINAD_NFFT; i++)
+		meas.total[i] = (meas.total[i] * SINAD_AVG + meas.p[i] * navg) /
+				    (meas.ntotal * SINAD_AVG + navg);
+	navg += meas.ntotal * SINAD_AVG;
+	spectrum_destroy(meas.sp);
+	if (!navg) {
+		printf("* sinad: no complete transform, run with -n %d or more\n",
+		       (SINAD_SETTLE + SINAD_NFFT) / RX_BUF_SAMPLES + 1);
+		return;
+	}
+	if (tone_analyze(meas.total, SINAD_NFFT, meas.bin, &m) < 0)
+		return;
+	f = (m.spur < SINAD_NFFT / 2 ? (double)m.spur : (double)m.spur - SINAD_NFFT) * meas.fs / SINAD_NFFT;
+	printf("* sinad: %u transforms, tone %.2f dBFS, noise floor %.2f dBFS/bin (%.2f dBFS/Hz)\n",
+	       navg, m.level, m.floor, m.floor - 10 * log10(meas.fs / SINAD_NFFT));
+	printf("* sinad: SNR %.2f dB, SINAD %.2f dB, THD %.2f dBc, SFDR %.2f dB (spur at %.3f kHz), image %.2f dBc\n",
+	       m.snr, m.sinad, m.thd, m.sfdr, f * 1e-3, m.image);
+	printf("* sinad: ENOB %.2f bits, %.2f bits referred to full scale\n",
+	       m.enob, m.enob - m.level / 6.02);
+}
+
+/*
+ * imd mode: two tone intermodulation against TX attenuation.  Two complex
+ * tones near 50 and 62KHz, IMD_DBFS each, go out while the TX attenuation
+ * steps through -A from:to:step (dB, the hardwaregain values).  For every
+ * step RX is averaged over IMD_AVG spectra and the tones, the third and
+ * fifth order products and the intercept are logged.  At the end the third
+ * order products are fitted against the tone level, which gives the slope
+ * (3 for a well behaved chain) and the intercept.
+ *
+ * The sweep never stops streaming: when a step has its spectra the next
+ * attenuation is written right away from the RX loop, the samples of the
+ * next IMD_SETTLE (the kernel's queued buffers and the settling of the
+ * attenuator) are dropped, and the spectra of the new step are taken
+ * block by block as the samples come in, so a step costs little more
+ * than the samples it averages.
+ */
+#define IMD_NFFT   4096
+#define IMD_AVG    16
+#define IMD_DBFS   -12.0   // each tone
+#define IMD_SETTLE (4 * TX_BUF_SAMPLES)
+#define IMD_STEPS  128
+
+static const char *imd_spec = "-42:-26:2";
+
+static struct {
+	struct spectrum *sp;
+	struct iio_channel *phy;          // TX attenuation
+	long long restore;
+	long long att[IMD_STEPS];
+	int nsteps, step;
+	size_t k1, k2;                    // tone bins of the RX transform
+	unsigned long long pos;           // RX samples seen
+	unsigned long long start;         // first sample of the step after settling
+	unsigned long long fed;           // samples of the step in the spectrum
+	double p[IMD_NFFT];
+	struct imd_meas m[IMD_STEPS];
+	double t0, t1, wr_busy;
+	float complex x[RX_BUF_SAMPLES];
+} imd;
+
+static int imd_set_att(long long att)
+{
+	double t0 = now_sec();
+	// a replayed sweep has the attenuation it was captured with
+	int ret = imd.phy ? iio_channel_attr_write_longlong(imd.phy, "hardwaregain", att) : 0;
+
+	imd.wr_busy += now_sec() - t0;
+	return ret;
+}
+
+static bool imd_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	long long from, to, step, a;
+
+	if (sscanf(imd_spec, "%lld:%lld:%lld", &from, &to, &step) != 3 || step <= 0 || from > to ||
+	    (to - from) / step >= IMD_STEPS) {
+		fprintf(stderr, "bad attenuation sweep \"%s\", want from:to:step with from <= to\n", imd_spec);
+		return false;
+	}
+	for (a = from; a <= to; a += step)
+		imd.att[imd.nsteps++] = a;
+	imd.sp = spectrum_create(IMD_NFFT);
+	if (!imd.sp || (ctx && !get_phy_chan(TX, 0, &imd.phy)))
+		return false;
+	imd.restore = txcfg->gain;
+	if (imd_set_att(imd.att[0]) < 0) {
+		fprintf(stderr, "Could not set the TX attenuation to %lld\n", imd.att[0]);
+		return false;
+	}
+	imd.start = IMD_SETTLE;
+	printf("* imd: TX attenuation %lld to %lld dB in %d steps, %d spectra of %d each\n",
+	       from, imd.att[imd.nsteps - 1], imd.nsteps, IMD_AVG, IMD_NFFT);
+	return true;
+}
+
+static void imd_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	long c1 = lround(50.0e3 * TX_BUF_SAMPLES / txcfg->fs_hz), c2 = c1 + 4;
+	double a = pow(10, IMD_DBFS / 20);
+	size_t s;
+
+	for (s = 0; s < TX_BUF_SAMPLES; s++) {
+		double p1 = 2 * M_PI * c1 * s / TX_BUF_SAMPLES, p2 = 2 * M_PI * c2 * s / TX_BUF_SAMPLES;
+		tx_iq[2 * s]     = a * (cos(p1) + cos(p2));
+		tx_iq[2 * s + 1] = a * (sin(p1) + sin(p2));
+	}
+	tx_write(buf, tx_iq, TX_BUF_SAMPLES);
+	imd.k1 = c1 * (IMD_NFFT / TX_BUF_SAMPLES);
+	imd.k2 = c2 * (IMD_NFFT / TX_BUF_SAMPLES);
+	printf("* imd: tones at %.3f and %.3f kHz, %.1f dBFS each\n",
+	       c1 * txcfg->fs_hz / TX_BUF_SAMPLES * 1e-3, c2 * txcfg->fs_hz / TX_BUF_SAMPLES * 1e-3, IMD_DBFS);
+}
+
+/* the step has its spectra: measure, and go on to the next attenuation */
+static void imd_step(void)
+{
+	struct imd_meas *m = &imd.m[imd.step];
+
+	spectrum_take(imd.sp, imd.p);
+	if (imd_analyze(imd.p, IMD_NFFT, imd.k1, imd.k2, m) < 0) {
+		log_ev(LOG_ERR, LOG_NONE, imd.pos, "imd: out of memory");
+		stop = true;
+		return;
+	}
+	log_ev(LOG_INFO, LOG_NONE, imd.pos, "att %lld dB: tones %.2f dBFS, IM3 %.2f dBc, IM5 %.2f dBc, OIP3 %.2f dBFS, floor %.2f dBFS",
+	       imd.att[imd.step], (m->tone[0] + m->tone[1]) / 2, fmax(m->im3[0], m->im3[1]),
+	       fmax(m->im5[0], m->im5[1]), m->oip3, m->floor);
+	if (++imd.step == imd.nsteps) {
+		imd.t1 = now_sec();
+		stop = true;
+		return;
+	}
+	if (imd_set_att(imd.att[imd.step]) < 0) {
+		log_ev(LOG_ERR, LOG_NONE, imd.pos, "imd: could not set the TX attenuation to %lld", imd.att[imd.step]);
+		stop = true;
+		return;
+	}
+	imd.start = imd.pos + IMD_SETTLE;
+	imd.fed = 0;
+	spectrum_reset(imd.sp);
+}
+
+static void imd_rx_block(const int16_t *iq, size_t n)
+{
+	while (n && !stop) {
+		size_t k, s;
+
+		if (imd.pos < imd.start) {
+			k = imd.start - imd.pos < n ? imd.start - imd.pos : n;
+		} else {
+			if (!imd.t0)
+				imd.t0 = now_sec();
+			k = (size_t)(IMD_AVG * IMD_NFFT - imd.fed) < n ? (size_t)(IMD_AVG * IMD_NFFT - imd.fed) : n;
+			for (s = 0; s < k; s++)
+				imd.x[s] = (iq[2 * s] + I * iq[2 * s + 1]) / IQ_FULL_SCALE;
+			spectrum_feed(imd.sp, imd.x, k);
+			imd.fed += k;
+		}
+		imd.pos += k;
+		iq += 2 * k;
+		n -= k;
+		if (imd.fed == IMD_AVG * IMD_NFFT)
+			imd_step();
+	}
+}
+
+static void imd_finish(void)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, fixed = 0;
+	int k, np = 0;
+
+	if (!imd.sp)
+		return;
+	spectrum_destroy(imd.sp);
+	if (imd.phy && iio_channel_attr_write_longlong(imd.phy, "hardwaregain", imd.restore) < 0)
+		fprintf(stderr, "Could not restore the TX attenuation to %lld\n", imd.restore);
+	if (imd.step < imd.nsteps)
+		printf("* imd: only %d of %d steps, run with -n %d or more\n", imd.step, imd.nsteps,
+		       imd.nsteps * (IMD_SETTLE + IMD_AVG * IMD_NFFT) / RX_BUF_SAMPLES + 1);
+	if (!imd.step)
+		return;
+	if (imd.t1 > imd.t0)
+		printf("* imd: %d steps in %.1f ms, %.2f ms per step, attenuation writes %.3f ms in all\n",
+		       imd.step, (imd.t1 - imd.t0) * 1e3, (imd.t1 - imd.t0) * 1e3 / imd.step, imd.wr_busy * 1e3);
+
+	// products at least 10 dB over the noise: IM3 (dBFS) against the tone level
+	for (k = 0; k < imd.step; k++) {
+		const struct imd_meas *m = &imd.m[k];
+		double x = (m->tone[0] + m->tone[1]) / 2, y = x + fmax(m->im3[0], m->im3[1]);
+
+		if (m->im3_snr < 10)
+			continue;
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+		fixed += m->oip3;
+		np++;
+	}
+	if (np < 2) {
+		printf("* imd: third order products above the noise at %d steps, too few to fit\n", np);
+		return;
+	}
+	{
+		double b = (np * sxy - sx * sy) / (np * sxx - sx * sx), a = (sy - b * sx) / np;
+		printf("* imd: %d steps above the noise, IM3 slope %.2f dB/dB, OIP3 %.2f dBFS (fit), %.2f dBFS (slope 3)\n",
+		       np, b, a / (1 - b), fixed / np);
+	}
+}
+
+/*
+ * mtone mode: frequency response in one shot.  A comb of tones over the
+ * TX rf_bandwidth, one TX buffer long so every tone is on a bin, with
+ * Schroeder phases for a low crest factor.  Positive frequencies use the
+ * even bins and negative ones the odd bins, so the IQ image of every tone
+ * lands on an empty bin and is measured instead of disturbing another
+ * tone.  RX is averaged synchronously over whole periods and a single
+ * transform gives the response at every tone: gain, phase and, from the
+ * phase slope between neighbours, group delay.  The whole delay comes
+ * from a circular cross correlation first so the slopes are unambiguous;
+ * like chirp mode it is the delay within the TX period.  Every
+ * MT_PERIODS periods the running average is measured and logged, at the
+ * end the response is written to mtone.csv.
+ */
+#define MT_PEAK    0.25   // stimulus peak, full scale 1.0, low enough for compression to stay out of the response
+#define MT_PERIODS 16
+#define MT_SETTLE  (4 * TX_BUF_SAMPLES)
+#define MT_MAX     (TX_BUF_SAMPLES / 2)
+
+static struct {
+	int bin[MT_MAX];                   // tones, in order of frequency
+	size_t m;
+	float complex x[TX_BUF_SAMPLES];   // stimulus
+	float complex X[TX_BUF_SAMPLES];   // and its spectrum
+	double complex yacc[TX_BUF_SAMPLES];
+	unsigned long long pos;
+	unsigned nper;                     // periods in yacc
+	struct fft_plan *fwd, *inv;
+	double fs;
+	// last measurement, per tone
+	double gain[MT_MAX], phase[MT_MAX], gd[MT_MAX], image[MT_MAX];
+	double delay;                      // mean delay, samples
+	double busy;
+	unsigned nmeas;
+} mt;
+
+static bool mtone_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	long kmax = (long)((double)txcfg->bw_hz / 2 / txcfg->fs_hz * TX_BUF_SAMPLES), k;
+	double peak = 0, ms = 0;
+	size_t s;
+
+	if (kmax > TX_BUF_SAMPLES / 2 - 2)
+		kmax = TX_BUF_SAMPLES / 2 - 2;
+	if (kmax < 2) {
+		fprintf(stderr, "mtone: rf_bandwidth too narrow for tones on %d bins\n", TX_BUF_SAMPLES);
+		return false;
+	}
+	for (k = -kmax; k <= kmax; k++)
+		if (k && ((k > 0) == !(k & 1)))
+			mt.bin[mt.m++] = k;
+	mt.fwd = fft_plan_create(TX_BUF_SAMPLES, FFT_FORWARD);
+	mt.inv = fft_plan_create(TX_BUF_SAMPLES, FFT_INVERSE);
+	if (!mt.fwd || !mt.inv || multitone_generate(mt.x, TX_BUF_SAMPLES, mt.bin, mt.m) < 0)
+		return false;
+	for (s = 0; s < TX_BUF_SAMPLES; s++) {
+		peak = fmax(peak, cabsf(mt.x[s]));
+		ms += crealf(mt.x[s] * conjf(mt.x[s]));
+	}
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		mt.x[s] *= MT_PEAK / peak;
+	memcpy(mt.X, mt.x, sizeof(mt.X));
+	fft_execute(mt.fwd, mt.X);
+	mt.fs = rxcfg->fs_hz;
+	printf("* mtone: %zu tones over +-%.1f kHz, %.2f kHz apart on each side, crest factor %.2f dB\n",
+	       mt.m, kmax * mt.fs / TX_BUF_SAMPLES * 1e-3, 2 * mt.fs / TX_BUF_SAMPLES * 1e-3,
+	       20 * log10(peak / sqrt(ms / TX_BUF_SAMPLES)));
+	return true;
+}
+
+static void mtone_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	tx_write(buf, (const float *)mt.x, TX_BUF_SAMPLES);
+}
+
+static size_t mtone_fold(long k)
+{
+	return (size_t)((k % TX_BUF_SAMPLES + TX_BUF_SAMPLES) % TX_BUF_SAMPLES);
+}
+
+/* response at every tone from the periods averaged so far */
+static void mtone_measure(void)
+{
+	static float complex y[TX_BUF_SAMPLES], c[TX_BUF_SAMPLES];
+	static double ph[MT_MAX];
+	double complex dc = 0;
+	double best = -1, sk = 0, sp = 0, skk = 0, skp = 0, b, a, t0 = now_sec();
+	double lo = INFINITY, hi = -INFINITY, glo = INFINITY, ghi = -INFINITY, img = -INFINITY, mean = 0;
+	size_t s, i, lag = 0;
+
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		dc += mt.yacc[s];
+	dc /= TX_BUF_SAMPLES;
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		y[s] = (mt.yacc[s] - dc) / (mt.nper * (double)IQ_FULL_SCALE);
+	fft_execute(mt.fwd, y);
+
+	// whole delay from the circular cross correlation, y[s + lag] ~ x[s]
+	for (s = 0; s < TX_BUF_SAMPLES; s++)
+		c[s] = y[s] * conjf(mt.X[s]);
+	fft_execute(mt.inv, c);
+	for (s = 0; s < TX_BUF_SAMPLES; s++) {
+		if (cabsf(c[s]) > best) {
+			best = cabsf(c[s]);
+			lag = s;
+		}
+	}
+
+	// response at the tones with the whole delay taken out, phase unwrapped along the comb
+	for (i = 0; i < mt.m; i++) {
+		size_t k = mtone_fold(mt.bin[i]);
+		float complex h = y[k] / mt.X[k] * cexpf(I * 2 * M_PI * mt.bin[i] * (double)lag / TX_BUF_SAMPLES);
+
+		mt.gain[i] = 20 * log10(cabsf(h));
+		mt.image[i] = 20 * log10(cabsf(y[mtone_fold(-mt.bin[i])]) / cabsf(y[k]));
+		ph[i] = cargf(h);
+		if (i)
+			ph[i] = ph[i - 1] + remainder(ph[i] - ph[i - 1], 2 * M_PI);
+		sk += mt.bin[i];
+		sp += ph[i];
+		skk += (double)mt.bin[i] * mt.bin[i];
+		skp += mt.bin[i] * ph[i];
+	}
+	// linear phase is the rest of the mean delay, what is left over the phase response
+	b = (mt.m * skp - sk * sp) / (mt.m * skk - sk * sk);
+	a = (sp - b * sk) / mt.m;
+	mt.delay = lag - b * TX_BUF_SAMPLES / (2 * M_PI);
+	for (i = 0; i < mt.m; i++) {
+		size_t l = i ? i - 1 : i, r = i + 1 < mt.m ? i + 1 : i;
+
+		mt.phase[i] = (ph[i] - a - b * mt.bin[i]) * 180 / M_PI;
+		mt.gd[i] = lag - (ph[r] - ph[l]) / (mt.bin[r] - mt.bin[l]) * TX_BUF_SAMPLES / (2 * M_PI);
+		lo = fmin(lo, mt.gain[i]);
+		hi = fmax(hi, mt.gain[i]);
+		glo = fmin(glo, mt.gd[i]);
+		ghi = fmax(ghi, mt.gd[i]);
+		img = fmax(img, mt.image[i]);
+		mean += pow(10, mt.gain[i] / 10);
+	}
+	mt.busy += now_sec() - t0;
+	mt.nmeas++;
+	log_ev(LOG_INFO, LOG_NONE, mt.pos, "mtone: %u periods, gain %.2f dB, flatness %.3f dB p-p, delay %.3f us, group delay %.1f ns p-p, image %.1f dBc worst",
+	       mt.nper, 10 * log10(mean / mt.m), hi - lo, mt.delay / mt.fs * 1e6, (ghi - glo) / mt.fs * 1e9, img);
+}
+
+static void mtone_rx_block(const int16_t *iq, size_t n)
+{
+	size_t s;
+
+	for (s = 0; s < n; s++, mt.pos++) {
+		if (mt.pos < MT_SETTLE)
+			continue;
+		mt.yacc[(mt.pos - MT_SETTLE) % TX_BUF_SAMPLES] += iq[2 * s] + I * iq[2 * s + 1];
+		if ((mt.pos - MT_SETTLE) % TX_BUF_SAMPLES == TX_BUF_SAMPLES - 1 &&
+		    ++mt.nper % MT_PERIODS == 0)
+			mtone_measure();
+	}
+}
+
+static void mtone_finish(void)
+{
+	size_t i;
+	FILE *f;
+
+	if (mt.nper && mt.nper % MT_PERIODS)
+		mtone_measure();
+	if (!mt.nmeas) {
+		printf("* mtone: no whole period received, run with -n %d or more\n",
+		       (MT_SETTLE + TX_BUF_SAMPLES) / RX_BUF_SAMPLES);
+	} else {
+		printf("* mtone: %u periods, response of %zu tones in mtone.csv, %.3f ms per measurement\n",
+		       mt.nper, mt.m, mt.busy / mt.nmeas * 1e3);
+		f = fopen("mtone.csv", "w");
+		if (f) {
+			fprintf(f, "freq_khz, gain_db, phase_deg, group_delay_us, image_dbc\n");
+			for (i = 0; i < mt.m; i++)
+				fprintf(f, "%.3f, %.3f, %.3f, %.4f, %.2f\n", mt.bin[i] * mt.fs / TX_BUF_SAMPLES * 1e-3,
+					mt.gain[i], mt.phase[i], mt.gd[i] / mt.fs * 1e6, mt.image[i]);
+			fclose(f);
+		}
+	}
+	fft_plan_destroy(mt.fwd);
+	fft_plan_destroy(mt.inv);
+}
+
+/*
+ * coh mode: RX1 against RX0 for array calibration.  Both RX channels are
+ * streamed, the buffer is split into the two channels in one pass and
+ * for every block the complex correlation of RX1 with RX0 (integer SIMD
+ * sums, iq_corr) gives the phase and amplitude of RX1 relative to RX0
+ * and their coherence, with the DC of both taken out.  The samples are
+ * used raw, the calibration store only has corrections for RX0.  Every
+ * COH_REPORT samples the values since the last report and how far the
+ * phase of single blocks strayed from them are logged; at the end the
+ * values of the run and how fast the correlation ran against the rate.
+ */
+#define COH_DBFS   -6.0
+#define COH_REPORT (1 << 20)
+
+static struct {
+	struct iq_corr rep;         // since the last report
+	struct iq_corr total;
+	unsigned long long nrep, ntotal;
+	double dmin, dmax;          // phase of single blocks against the report's, degrees
+	double dsum2;               // squared, over the run
+	unsigned long long nblk;
+	unsigned long long pos;
+	double busy, fs;
+} coh;
+
+/* phase (degrees) and amplitude (dB) of b relative to a and their coherence, DC removed */
+static double complex coh_eval(const struct iq_corr *c, unsigned long long n, double *ratio_db, double *coherence)
+{
+	double complex ma = (c->sum_a[0] + I * c->sum_a[1]) / (double)n;
+	double complex mb = (c->sum_b[0] + I * c->sum_b[1]) / (double)n;
+	double complex ab = (c->ab[0] + I * c->ab[1]) - n * mb * conj(ma);
+	double aa = c->aa - n * creal(ma * conj(ma)), bb = c->bb - n * creal(mb * conj(mb));
+
+	if (ratio_db)
+		*ratio_db = 10 * log10(bb / aa);
+	if (coherence)
+		*coherence = creal(ab * conj(ab)) / (aa * bb);
+	return ab;
+}
+
+static void corr_add(struct iq_corr *d, const struct iq_corr *s)
+{
+	int k;
+
+	for (k = 0; k < 2; k++) {
+		d->sum_a[k] += s->sum_a[k];
+		d->sum_b[k] += s->sum_b[k];
+		d->ab[k] += s->ab[k];
+	}
+	d->aa += s->aa;
+	d->bb += s->bb;
+}
+
+static bool coh_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	coh.fs = rxcfg->fs_hz;
+	coh.dmin = INFINITY;
+	coh.dmax = -INFINITY;
+	return true;
+}
+
+static void coh_tx_fill(struct iio_buffer *buf, const struct stream_cfg *txcfg)
+{
+	long cycles = tx_tone(buf, txcfg->fs_hz, 50.0e3, COH_DBFS);
+
+	printf("* coh: %.3f kHz tone at %.1f dBFS, RX1 against RX0 every %d samples\n",
+	       cycles * txcfg->fs_hz / TX_BUF_SAMPLES * 1e-3, COH_DBFS, RX_BUF_SAMPLES);
+}
+
+static void coh_rx_block(const int16_t *iq, size_t n)
+{
+	struct iq_corr blk = { { 0 } };
+	double t0 = now_sec(), ratio, c, d;
+	double complex ab;
+
+	iq_corr(iq, rx1_iq, n, &blk);
+	corr_add(&coh.rep, &blk);
+	coh.nrep += n;
+	// a block's phase against the running one, no wrapping around +-180
+	ab = coh_eval(&blk, n, NULL, NULL);
+	d = carg(ab * conj(coh_eval(&coh.rep, coh.nrep, NULL, NULL))) * 180 / M_PI;
+	coh.dmin = fmin(coh.dmin, d);
+	coh.dmax = fmax(coh.dmax, d);
+	coh.dsum2 += d * d;
+	coh.nblk++;
+	coh.busy += now_sec() - t0;
+	coh.pos += n;
+
+	if (coh.nrep < COH_REPORT)
+		return;
+	ab = coh_eval(&coh.rep, coh.nrep, &ratio, &c);
+	log_ev(LOG_INFO, LOG_NONE, coh.pos, "RX1-RX0: phase %.3f deg (blocks %+.3f to %+.3f), amplitude %.3f dB, coherence %.6f",
+	       carg(ab) * 180 / M_PI, coh.dmin, coh.dmax, ratio, c);
+	corr_add(&coh.total, &coh.rep);
+	coh.ntotal += coh.nrep;
+	memset(&coh.rep, 0, sizeof(coh.rep));
+	coh.nrep = 0;
+	coh.dmin = INFINITY;
+	coh.dmax = -INFINITY;
+}
+
+static void coh_finish(void)
+{
+	double ratio, c;
+	double complex ab;
+
+	corr_add(&coh.total, &coh.rep);
+	coh.ntotal += coh.nrep;
+	if (!coh.ntotal)
+		return;
+	ab = coh_eval(&coh.total, coh.ntotal, &ratio, &c);
+	printf("* coh: %llu samples, RX1-RX0 phase %.3f deg, amplitude %.3f dB, coherence %.6f\n",
+	       coh.ntotal, carg(ab) * 180 / M_PI, ratio, c);
+	printf("* coh: phase of single blocks %.3f deg rms from the running value\n", sqrt(coh.dsum2 / coh.nblk));
+	if (coh.busy > 0)
+		printf("* coh: correlation %.1f MS/s per channel pair, %.0fx the sample rate\n",
+		       coh.ntotal / coh.busy * 1e-6, coh.ntotal / coh.busy / coh.fs);
+}
+
+/*
+ * remote mode: for running on the Pluto itself, where the Cortex-A9 and
+ * not USB is the limit.  The tone goes out like in tone mode and RX is
+ * reduced on the board (decimated, summarized or bfp compressed) and sent
+ * to a host over TCP instead of being written to a file, see net.h.
+ */
+#define NET_BATCH 16384  // input samples per message
+
+static const char *net_dest = NULL;
+static enum net_kind net_kind = NET_IQ16;
+static unsigned net_ratio = 8;
+
+static struct {
+	int fd;
+	struct fir_decim *dec;
+	float complex in[RX_BUF_SAMPLES];
+	float complex out[RX_BUF_SAMPLES + 1];
+	struct { int min[2], max[2]; long sum[2]; unsigned n; } sum;
+	char *msg;             // net_header followed by the payload
+	size_t len;            // payload bytes so far
+	size_t cap;
+	struct net_header h;
+	unsigned long long sent;  // bytes sent
+	unsigned long long nsamp; // input samples
+	double busy;           // time spent reducing and sending
+} rmt = { .fd = -1 };
+
+/* most payload bytes n input samples can add, partial entries carried over included */
+static size_t remote_max_payload(size_t n)
+{
+	switch (net_kind) {
+	case NET_IQ16:    return (n / net_ratio + 1) * 2 * sizeof(int16_t);
+	case NET_SUMMARY: return (n / net_ratio + 1) * sizeof(struct pyr_entry);
+	default:          return (n / BFP_BLOCK + 1) * sizeof(struct bfp_block_header) + 2 * n;
+	}
+}
+
+static bool remote_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	if (!net_dest) {
+		fprintf(stderr, "remote mode needs a host:port to send to (-s)\n");
+		return false;
+	}
+	if (net_kind == NET_BFP)
+		net_ratio = 1;
+	if (!net_ratio || net_ratio > UINT16_MAX) {
+		fprintf(stderr, "bad reduction ratio %u\n", net_ratio);
+		return false;
+	}
+	if (net_kind == NET_IQ16 && !(rmt.dec = fir_decim_create(net_ratio, 8 * net_ratio + 1)))
+		return false;
+
+	// a message is flushed once it covers NET_BATCH samples, so at most one block more
+	rmt.cap = sizeof(rmt.h) + remote_max_payload(NET_BATCH + RX_BUF_SAMPLES);
+	rmt.msg = malloc(rmt.cap);
+	if (!rmt.msg)
+		return false;
+
+	rmt.fd = net_connect(net_dest);
+	if (rmt.fd < 0) {
+		fprintf(stderr, "connecting to %s: %s\n", net_dest, strerror(-rmt.fd));
+		return false;
+	}
+	memcpy(rmt.h.magic, "IQNT", 4);
+	rmt.h.kind = net_kind;
+	rmt.h.ratio = net_ratio;
+	printf("* sending %s 1:%u to %s\n", net_kind_name(net_kind), net_ratio, net_dest);
+	return true;
+}
+
+static void remote_flush(void)
+{
+	int ret;
+
+	if (!rmt.h.nsamp)
+		return;
+	rmt.h.len = rmt.len;
+	memcpy(rmt.msg, &rmt.h, sizeof(rmt.h));
+	ret = net_send(rmt.fd, rmt.msg, sizeof(rmt.h) + rmt.len);
+	if (ret < 0) {
+		log_ev(LOG_ERR, LOG_NONE, rmt.h.first, "Error %d sending to %s", ret, net_dest);
+		stop = true;
+	}
+	rmt.sent += sizeof(rmt.h) + rmt.len;
+	rmt.h.first += rmt.h.nsamp;
+	rmt.h.nsamp = 0;
+	rmt.len = 0;
+}
+
+static void remote_decimate(const int16_t *iq, size_t n)
+{
+	int16_t *out = (int16_t *)(rmt.msg + sizeof(rmt.h) + rmt.len);
+	size_t k, nout;
+
+	for (k = 0; k < n; k++)
+		rmt.in[k] = iq[2*k] + I * iq[2*k+1];
+	nout = fir_decim_process(rmt.dec, rmt.in, n, rmt.out);
+	for (k = 0; k < nout; k++) {
+		out[2*k]   = lrintf(crealf(rmt.out[k]));
+		out[2*k+1] = lrintf(cimagf(rmt.out[k]));
+	}
+	rmt.len += nout * 2 * sizeof(int16_t);
+}
+
+static void remote_summarize(const int16_t *iq, size_t n)
+{
+	struct pyr_entry e;
+	size_t k;
+	int c;
+
+	for (k = 0; k < n; k++) {
+		for (c = 0; c < 2; c++) {
+			int v = iq[2*k+c];
+			if (!rmt.sum.n || v < rmt.sum.min[c]) rmt.sum.min[c] = v;
+			if (!rmt.sum.n || v > rmt.sum.max[c]) rmt.sum.max[c] = v;
+			rmt.sum.sum[c] = (rmt.sum.n ? rmt.sum.sum[c] : 0) + v;
+		}
+		if (++rmt.sum.n < net_ratio)
+			continue;
+		for (c = 0; c < 2; c++) {
+			e.min[c] = rmt.sum.min[c];
+			e.max[c] = rmt.sum.max[c];
+			e.mean[c] = rmt.sum.sum[c] / (long)net_ratio;
+		}
+		memcpy(rmt.msg + sizeof(rmt.h) + rmt.len, &e, sizeof(e));
+		rmt.len += sizeof(e);
+		rmt.sum.n = 0;
+	}
+}
+
+static void remote_compress(const int16_t *iq, size_t n)
+{
+	struct bfp_block_header bh = { 0 };
+	int16_t dec[2 * BFP_BLOCK];
+
+	while (n) {
+		char *p = rmt.msg + sizeof(rmt.h) + rmt.len;
+		size_t take = n < BFP_BLOCK ? n : BFP_BLOCK;
+
+		bh.exp = bfp_encode(iq, 2 * take, (int8_t *)(p + sizeof(bh)));
+		bh.nsamp = take;
+		bfp_decode((int8_t *)(p + sizeof(bh)), 2 * take, bh.exp, dec);
+		bh.sqnr_cdb = (int16_t)lround(sqnr_db(iq, dec, 2 * take) * 100.0);
+		memcpy(p, &bh, sizeof(bh));
+		rmt.len += sizeof(bh) + 2 * take;
+		iq += 2 * take;
+		n -= take;
+	}
+}
+
+static void remote_rx_block(const int16_t *iq, size_t n)
+{
+	double t0 = now_sec();
+
+	// never happens with the cap above, but a block must not write past it
+	if (sizeof(rmt.h) + rmt.len + remote_max_payload(n) > rmt.cap)
+		remote_flush();
+	switch (net_kind) {
+	case NET_IQ16:    remote_decimate(iq, n); break;
+	case NET_SUMMARY: remote_summarize(iq, n); break;
+	default:          remote_compress(iq, n); break;
+	}
+	rmt.h.nsamp += n;
+	rmt.nsamp += n;
+	if (rmt.h.nsamp >= NET_BATCH)
+		remote_flush();
+	rmt.busy += now_sec() - t0;
+}
+
+static void remote_finish(void)
+{
+	remote_flush();
+	if (rmt.nsamp && rmt.sent)
+		printf("* sent %llu bytes for %llu samples (%.1fx less than raw), %.2f MS/s reduction rate\n",
+		       rmt.sent, rmt.nsamp, rmt.nsamp * 4.0 / rmt.sent,
+		       rmt.busy > 0 ? rmt.nsamp / rmt.busy * 1e-6 : 0.0);
+	net_close(rmt.fd);
+	fir_decim_destroy(rmt.dec);
+	free(rmt.msg);
+}
+
+/*
+ * tee mode: tone, with the one copy of every RX block shared by several
+ * sinks on their own threads (-k): the capture file, the remote mode
+ * reduction and a running summary on stdout.
+ */
+#define TEE_BLOCKS   64       // RX blocks the slowest sink may lag behind
+#define STATS_SAMPLES (1 << 20)
+
+static const char *tee_spec = "file,stats";
+static struct tee *tee = NULL;
+static bool tee_file, tee_net, tee_stats;
+
+static struct {
+	unsigned long long first;
+	double sum[2], pwr;
+	int peak;
+	size_t n;
+} stats;
+
+static void stats_block(const int16_t *iq, size_t n)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		int i = iq[2*k], q = iq[2*k+1];
+		stats.sum[0] += i;
+		stats.sum[1] += q;
+		stats.pwr += (double)i * i + (double)q * q;
+		if (abs(i) > stats.peak) stats.peak = abs(i);
+		if (abs(q) > stats.peak) stats.peak = abs(q);
+		if (++stats.n < STATS_SAMPLES)
+			continue;
+		log_ev(LOG_INFO, LOG_NONE, stats.first, "%zu samples: rms %.1f, peak %d, DC %.2f, %.2f",
+		       stats.n, sqrt(stats.pwr / stats.n), stats.peak,
+		       stats.sum[0] / stats.n, stats.sum[1] / stats.n);
+		stats.first += stats.n;
+		memset(stats.sum, 0, sizeof(stats.sum));
+		stats.pwr = 0;
+		stats.peak = 0;
+		stats.n = 0;
+	}
+}
+
+static bool tee_start(const struct stream_cfg *txcfg, const struct stream_cfg *rxcfg)
+{
+	struct tee_sink sinks[TEE_MAX_SINKS];
+	char spec[64], *tok, *save;
+	size_t n = 0;
+
+	snprintf(spec, sizeof(spec), "%s", tee_spec);
+	for (tok = strtok_r(spec, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (!strcmp(tok, "file") && !tee_file) {
+			if (!(tee_file = open_capture(rxcfg)))
+				return false;
+			sinks[n++] = (struct tee_sink){ "file", tone_rx_block };
+		} else if (!strcmp(tok, "net") && !tee_net) {
+			if (!(tee_net = remote_start(txcfg, rxcfg)))
+				return false;
+			sinks[n++] = (struct tee_sink){ "net", remote_rx_block };
+		} else if (!strcmp(tok, "stats") && !tee_stats) {
+			tee_stats = true;
+			sinks[n++] = (struct tee_sink){ "stats", stats_block };
+		} else {
+			fprintf(stderr, "unknown or repeated tee sink \"%s\"\n", tok);
+			return false;
+		}
+	}
+	tee = tee_create(sinks, n, RX_BUF_SAMPLES, TEE_BLOCKS);
+	if (!tee)
+		return false;
+	printf("* tee to %s\n", tee_spec);
+	return true;
+}
+
+static int16_t *tee_rx_buffer(void)
+{
+	return tee_get(tee);
+}
+
+static void tee_rx_block(const int16_t *iq, size_t n)
+{
+	tee_submit(tee, (int16_t *)iq, n);
+}
+
+static void tee_finish(void)
+{
+	if (tee) {
+		// drains what the sinks still have queued
+		unsigned long stalls = tee_stalls(tee);
+		tee_close(tee);
+		if (stalls)
+			printf("* tee waited %lu times for a slow sink\n", stalls);
+	}
+	if (tee_file)
+		tone_finish();
+	if (tee_net)
+		remote_finish();
+}
+
+/*
+ * spectral mask check alongside any mode, with -M file: the RX blocks the
+ * mode gets also go into an averaged spectrum, and every MASK_AVG
+ * transforms it is compared with the mask (spectrum.h).  The margin,
+ * where it is smallest and the number of bins over the limit are logged
+ * per interval; at the end the worst interval is printed and the average
+ * and max hold spectra go to mask.csv next to the limit.
+ */
+#define MASK_NFFT   4096
+#define MASK_AVG    64    // transforms per interval, 87 ms at 3 MS/s
+#define MASK_SETTLE (4 * TX_BUF_SAMPLES)
+
+static const char *mask_path = NULL;
+static long long tx_att = -30;   // -a
+
+static struct {
+	struct spec_mask m;
+	struct spectrum *sp;
+	double fs;
+	double lim[MASK_NFFT];       // per bin, power ratio
+	double p[MASK_NFFT];
+	double avg[MASK_NFFT];       // sum over the intervals
+	double hold[MASK_NFFT];      // max over the intervals
+	unsigned nint, nfail;
+	struct mask_result worst;
+	unsigned worst_int;
+	unsigned long long pos;
+	double busy;
+	float complex x[RX_BUF_SAMPLES];
+} mchk;
+
+static double mask_khz(size_t k)
+{
+	return (k < MASK_NFFT / 2 ? (double)k : (double)k - MASK_NFFT) * mchk.fs / MASK_NFFT * 1e-3;
+}
+
+static bool mask_start(const struct stream_cfg *rxcfg)
+{
+	int ret = mask_load(mask_path, &mchk.m);
+
+	if (ret < 0) {
+		if (ret != -EINVAL)
+			fprintf(stderr, "%s: %s\n", mask_path, strerror(-ret));
+		return false;
+	}
+	mchk.sp = spectrum_create(MASK_NFFT);
+	if (!mchk.sp)
+		return false;
+	mchk.fs = rxcfg->fs_hz;
+	mask_bins(&mchk.m, MASK_NFFT, mchk.fs, mchk.lim);
+	mchk.worst.margin = INFINITY;
+	printf("* mask: %zu points from %s in %s, %d point spectra (%.2f kHz bins), %d per interval\n",
+	       mchk.m.npt, mask_path, mchk.m.dbfs ? "dBFS" : "dBc of the peak", MASK_NFFT,
+	       mchk.fs / MASK_NFFT * 1e-3, MASK_AVG);
+	return true;
+}
+
+static void mask_rx_block(const int16_t *iq, size_t n)
+{
+	double t0 = now_sec();
+	struct mask_result r;
+	size_t s;
+
+	if (mchk.pos < MASK_SETTLE) {
+		size_t skip = MASK_SETTLE - mchk.pos < n ? MASK_SETTLE - mchk.pos : n;
+		mchk.pos += skip;
+		iq += 2 * skip;
+		n -= skip;
+	}
+	for (s = 0; s < n; s++)
+		mchk.x[s] = (iq[2 * s] + I * iq[2 * s + 1]) / IQ_FULL_SCALE;
+	spectrum_feed(mchk.sp, mchk.x, n);
+	mchk.pos += n;
+	if (mchk.sp->navg >= MASK_AVG) {
+		spectrum_take(mchk.sp, mchk.p);
+		mask_check(&mchk.m, mchk.lim, mchk.p, MASK_NFFT, &r);
+		for (s = 0; s < MASK_NFFT; s++) {
+			mchk.avg[s] += mchk.p[s];
+			mchk.hold[s] = fmax(mchk.hold[s], mchk.p[s]);
+		}
+		mchk.nint++;
+		if (r.over)
+			mchk.nfail++;
+		if (r.margin < mchk.worst.margin) {
+			mchk.worst = r;
+			mchk.worst_int = mchk.nint;
+		}
+		log_ev(r.over ? LOG_WARN : LOG_INFO, LOG_NONE, mchk.pos,
+		       "mask: margin %.2f dB at %.2f kHz, %llu bins over, reference %.2f dBFS",
+		       r.margin, mask_khz(r.worst), (unsigned long long)r.over, r.ref);
+	}
+	mchk.busy += now_sec() - t0;
+}
+
+static void mask_finish(void)
+{
+	struct mask_result r;
+	size_t k;
+	FILE *f;
+
+	if (!mchk.sp)
+		return;
+	spectrum_destroy(mchk.sp);
+	if (!mchk.nint) {
+		printf("* mask: no complete interval, run with -n %d or more\n",
+		       (MASK_SETTLE + MASK_AVG * MASK_NFFT) / RX_BUF_SAMPLES);
+		return;
+	}
+	printf("* mask: %u intervals, %u over the mask, worst margin %.2f dB at %.2f kHz (interval %u)\n",
+	       mchk.nint, mchk.nfail, mchk.worst.margin, mask_khz(mchk.worst.worst), mchk.worst_int);
+	if (mchk.busy > 0)
+		printf("* mask: analyzer %.1f MS/s, %.1fx the sample rate\n",
+		       mchk.pos / mchk.busy * 1e-6, mchk.pos / mchk.busy / mchk.fs);
+	// the limit follows the reference of the average spectrum
+	for (k = 0; k < MASK_NFFT; k++)
+		mchk.avg[k] /= mchk.nint;
+	mask_check(&mchk.m, mchk.lim, mchk.avg, MASK_NFFT, &r);
+	f = fopen("mask.csv", "w");
+	if (!f)
+		return;
+	fprintf(f, "freq_khz, avg_dbfs, max_dbfs, limit_dbfs\n");
+	for (k = MASK_NFFT / 2; k < MASK_NFFT + MASK_NFFT / 2; k++) {
+		size_t b = k % MASK_NFFT;
+		fprintf(f, "%.3f, %.2f, %.2f, %.2f\n", mask_khz(b), 10 * log10(mchk.avg[b]),
+			10 * log10(mchk.hold[b]), 10 * log10(mchk.lim[b]) + r.ref);
+	}
+	fclose(f);
+}
+
+/*
+ * ZeroMQ PUB sink alongside any mode, with -z port[:fmt[:batch[:hwm]]]:
+ * the RX blocks the mode gets are also published on a PUB socket
+ * (zmtp.h), batch samples per message, as interleaved int16 I/Q (sc16)
+ * or float32 I/Q scaled to [-1, 1) (f32, gr_complex for the GNU Radio
+ * ZMQ SUB Source).  The messages have no topic, subscribe to "".  A
+ * subscriber hwm messages behind loses the newer ones, the RX loop never
+ * waits for it.
+ */
+#define ZPUB_BATCH     4096
+#define ZPUB_HWM       64
+#define ZPUB_LINGER_MS 200
+
+static const char *zpub_spec = NULL;
+
+static struct {
+	struct zpub *p;
+	bool f32;
+	size_t batch, fill;
+	void *msg;
+	unsigned long long pos;
+	unsigned long dropped;       // at the last message, to log when it starts
+	double fs, busy;
+} zp;
+
+static bool zpub_start(const struct stream_cfg *rxcfg)
+{
+	char port[16], fmt[8] = "sc16";
+	unsigned long batch = ZPUB_BATCH, hwm = ZPUB_HWM;
+
+	if (sscanf(zpub_spec, "%15[^:]:%7[^:]:%lu:%lu", port, fmt, &batch, &hwm) < 1 ||
+	    (strcmp(fmt, "sc16") && strcmp(fmt, "f32")) || !batch || batch > (1 << 20) || !hwm) {
+		fprintf(stderr, "bad -z %s, want port[:sc16|f32[:batch[:hwm]]]\n", zpub_spec);
+		return false;
+	}
+	zp.f32 = !strcmp(fmt, "f32");
+	zp.batch = batch;
+	zp.fs = rxcfg->fs_hz;
+	zp.msg = malloc(batch * 2 * (zp.f32 ? sizeof(float) : sizeof(int16_t)));
+	if (!zp.msg)
+		return false;
+	zp.p = zpub_open(port, hwm);
+	if (!zp.p) {
+		fprintf(stderr, "zmq port %s: %s\n", port, strerror(errno));
+		return false;
+	}
+	printf("* zmq: publishing on tcp://*:%s, %s, %lu samples per message, hwm %lu\n",
+	       port, fmt, batch, hwm);
+	return true;
+}
+
+static void zpub_flush(void)
+{
+	struct zpub_stats st;
+
+	zpub_send(zp.p, zp.msg, zp.fill * 2 * (zp.f32 ? sizeof(float) : sizeof(int16_t)));
+	zp.fill = 0;
+	zpub_get_stats(zp.p, &st);
+	if (st.dropped && !zp.dropped)
+		log_ev(LOG_WARN, LOG_NONE, zp.pos, "zmq: a subscriber reached the hwm, dropping messages for it");
+	zp.dropped = st.dropped;
+}
+
+static void zpub_rx_block(const int16_t *iq, size_t n)
+{
+	double t0 = now_sec();
+
+	while (n) {
+		size_t k = zp.batch - zp.fill < n ? zp.batch - zp.fill : n, s;
+
+		if (zp.f32) {
+			float *d = (float *)zp.msg + 2 * zp.fill;
+			for (s = 0; s < 2 * k; s++)
+				d[s] = iq[s] / IQ_FULL_SCALE;
+		} else {
+			memcpy((int16_t *)zp.msg + 2 * zp.fill, iq, 2 * k * sizeof(int16_t));
+		}
+		zp.fill += k;
+		zp.pos += k;
+		iq += 2 * k;
+		n -= k;
+		if (zp.fill == zp.batch)
+			zpub_flush();
+	}
+	zp.busy += now_sec() - t0;
+}
+
+static void zpub_finish(void)
+{
+	struct zpub_stats st;
+
+	if (!zp.p)
+		return;
+	if (zp.fill)
+		zpub_flush();
+	zpub_close(zp.p, ZPUB_LINGER_MS, &st);
+	free(zp.msg);
+	printf("* zmq: %lu subscribers, %lu messages published, %lu sent, %lu dropped at the hwm, %.1f MB\n",
+	       st.peers, st.published, st.sent, st.dropped, st.bytes * 1e-6);
+	if (zp.busy > 0)
+		printf("* zmq: publisher %.1f MS/s, %.1fx the sample rate\n", zp.pos / zp.busy * 1e-6,
+		       zp.pos / zp.busy / zp.fs);
+}
+
+static const struct test_mode modes[] = {
+	{ "tone",  "50KHz sine on Q, RX dumped to output.csv", tone_start, tone_tx_fill, tone_rx_block, tone_finish },
+	{ "chirp", "chirp sounder, impulse response and group delay per burst", chirp_start, chirp_tx_fill, chirp_rx_block, chirp_finish },
+	{ "play",  "stream a float32 I/Q file (-t) out of TX, RX like tone", play_start, play_tx_fill, tone_rx_block, play_finish, true },
+	{ "remote", "tone, RX reduced on the board (-r) and sent to a host (-s)", remote_start, tone_tx_fill, remote_rx_block, remote_finish },
+	{ "cal",   "measure RX DC, IQ imbalance and loopback gain into the store (-c)", cal_start, cal_tx_fill, cal_rx_block, cal_finish, false, true },
+	{ "tee",   "tone, RX shared by several sinks (-k) on their own threads", tee_start, tone_tx_fill, tee_rx_block, tee_finish, false, false, tee_rx_buffer },
+	{ "dpd",   "fit a memory polynomial predistorter over the loopback, iteratively", dpd_start, dpd_tx_fill, dpd_rx_block, dpd_finish, true },
+	{ "ofdm",  "OFDM modem (-F), BER, SNR per carrier and receiver speed", ofdm_start, ofdm_tx_fill, ofdm_rx_block, ofdm_finish, true },
+	{ "sinad", "tone, SNR, SINAD, THD, SFDR and ENOB from averaged spectra", sinad_start, sinad_tx_fill, sinad_rx_block, sinad_finish },
+	{ "imd",   "two tones, IM3/IM5 and OIP3 over a TX attenuation sweep (-A)", imd_start, imd_tx_fill, imd_rx_block, imd_finish },
+	{ "mtone", "multitone, gain, phase and group delay over the band in one capture", mtone_start, mtone_tx_fill, mtone_rx_block, mtone_finish },
+	{ "coh",   "RX0 and RX1 together, phase and amplitude of RX1 relative to RX0", coh_start, coh_tx_fill, coh_rx_block, coh_finish, false, true, NULL, true },
+};
+
+static const struct test_mode *find_mode(const char *name)
+{
+	size_t k;
+	for (k = 0; k < sizeof(modes) / sizeof(modes[0]); k++)
+		if (!strcmp(modes[k].name, name))
+			return &modes[k];
+	return NULL;
+}
+
+/*
+ * replay, -i file[:speed]: the RX blocks come from a raw capture
+ * (interleaved int16 I/Q, -f raw) instead of the radio and go through
+ * the same chain, the mode and the mask check, unthrottled or paced at
+ * speed times the sample rate.  The calibration is left out since a
+ * capture holds the samples as the mode saw them.  No context is opened,
+ * the modes still make their TX waveform for what they compare against
+ * but it goes nowhere.  The time the chain takes is measured apart from
+ * reading and pacing.
+ */
+static struct {
+	const char *path;
+	double speed;              // 0: as fast as it goes
+	FILE *f;
+	double t0;                 // first block
+	double busy;               // in the chain
+	unsigned long long n;
+} replay;
+
+static bool replay_open(const char *spec)
+{
+	static char path[4096];
+	const char *colon = strrchr(spec, ':');
+	char *end = NULL;
+
+	// a path with a colon in it and no speed is taken whole
+	if (colon)
+		replay.speed = strtod(colon + 1, &end);
+	if (!colon || end == colon + 1 || *end) {
+		colon = NULL;
+		replay.speed = 0;
+	}
+	snprintf(path, sizeof(path), "%.*s", colon ? (int)(colon - spec) : (int)strlen(spec), spec);
+	replay.path = path;
+	if (!*path || replay.speed < 0)
+		return false;
+	replay.f = fopen(path, "rb");
+	if (!replay.f) {
+		perror(path);
+		return false;
+	}
+	return true;
+}
+
+/* up to max samples into iq, paced when a speed was given, 0 at the end */
+static size_t replay_read(int16_t *iq, size_t max, double fs)
+{
+	size_t n = fread(iq, 4, max, replay.f);
+	double due;
+
+	if (!replay.n)
+		replay.t0 = now_sec();
+	if (replay.speed > 0 && n) {
+		due = replay.t0 + replay.n / (fs * replay.speed) - now_sec();
+		if (due > 0) {
+			struct timespec ts = { (time_t)due, (long)((due - (time_t)due) * 1e9) };
+			nanosleep(&ts, NULL);
+		}
+	}
+	replay.n += n;
+	return n;
+}
+
+static void replay_close(double fs)
+{
+	double dt = now_sec() - replay.t0;
+
+	if (!replay.f)
+		return;
+	if (ferror(replay.f))
+		fprintf(stderr, "Error reading %s\n", replay.path);
+	fclose(replay.f);
+	if (!replay.n || dt <= 0)
+		return;
+	printf("* replay: %llu samples from %s in %.3f s, %.1f MS/s, %.2fx the sample rate\n",
+	       replay.n, replay.path, dt, replay.n / dt * 1e-6, replay.n / dt / fs);
+	if (replay.busy > 0)
+		printf("* replay: the processing alone %.1f MS/s, %.2fx the sample rate\n",
+		       replay.n / replay.busy * 1e-6, replay.n / replay.busy / fs);
+}
+
+/* RX error recovery bookkeeping */
+#define RX_RETRIES 10
+
+static struct {
+	unsigned long errors;      // failed refills
+	unsigned long recovered;   // refills that succeeded after retrying
+	unsigned long short_reads;
+	double worst;              // longest time from a failed refill to the next good one
+	double total;
+} rxrec;
+
+/* find the AD9361, configure and enable its streaming channels and make the buffers */
+static void stream_setup(const char *uri, const struct test_mode *mode,
+			 struct stream_cfg *rxcfg, struct stream_cfg *txcfg)
+{
+	// Streaming devices
+	struct iio_device *tx;
+	struct iio_device *rx;
+
+	printf("* Acquiring IIO context\n");
+	if (!uri) {
+		IIO_ENSURE((ctx = iio_create_default_context()) && "No context");
+	}
+	else {
+		IIO_ENSURE((ctx = iio_create_context_from_uri(uri)) && "No context");
+	}
+	IIO_ENSURE(iio_context_get_devices_count(ctx) > 0 && "No devices");
+
+	printf("* Acquiring AD9361 streaming devices\n");
+	IIO_ENSURE(get_ad9361_stream_dev(TX, &tx) && "No tx dev found");
+	IIO_ENSURE(get_ad9361_stream_dev(RX, &rx) && "No rx dev found");
+
+	printf("* Configuring AD9361 for streaming\n");
+	IIO_ENSURE(cfg_ad9361_streaming_ch(rxcfg, RX, 0) && "RX port 0 not found");
+	IIO_ENSURE(cfg_ad9361_streaming_ch(txcfg, TX, 0) && "TX port 0 not found");
+	if (mode->dual_rx)
+		IIO_ENSURE(cfg_ad9361_streaming_ch(rxcfg, RX, 1) && "RX port 1 not found");
+
+	printf("* Initializing AD9361 IIO streaming channels\n");
+	IIO_ENSURE(get_ad9361_stream_ch(RX, rx, 0, &rx0_i) && "RX chan i not found");
+	IIO_ENSURE(get_ad9361_stream_ch(RX, rx, 1, &rx0_q) && "RX chan q not found");
+	IIO_ENSURE(get_ad9361_stream_ch(TX, tx, 0, &tx0_i) && "TX chan i not found");
+	IIO_ENSURE(get_ad9361_stream_ch(TX, tx, 1, &tx0_q) && "TX chan q not found");
+	if (mode->dual_rx) {
+		IIO_ENSURE(get_ad9361_stream_ch(RX, rx, 2, &rx1_i) && "RX1 chan i not found");
+		IIO_ENSURE(get_ad9361_stream_ch(RX, rx, 3, &rx1_q) && "RX1 chan q not found");
+	}
+
+	printf("* Enabling IIO streaming channels\n");
+	iio_channel_enable(rx0_i);
+	iio_channel_enable(rx0_q);
+	iio_channel_enable(tx0_i);
+	iio_channel_enable(tx0_q);
+	if (mode->dual_rx) {
+		iio_channel_enable(rx1_i);
+		iio_channel_enable(rx1_q);
+	}
+
+	printf("* Creating non-cyclic IIO buffers\n");
+	rxbuf = iio_device_create_buffer(rx, RX_BUF_SAMPLES, false);
+	if (!rxbuf) {
+		perror("Could not create RX buffer");
+		shutdown();
+	}
+	// even though "cyclic mode" is defined as false below the tx seems to
+	// continue cycle through the buffer forever
+	txbuf = iio_device_create_buffer(tx, TX_BUF_SAMPLES, false);
+	if (!txbuf) {
+		perror("Could not create TX buffer");
+		shutdown();
+	}
+}
+
+/*
+ * refill the RX buffer, retrying the errors a busy or slow link gives
+ * (timeouts, interrupted calls).  Returns the number of bytes or the error
+ * that could not be recovered from.
+ */
+static ssize_t rx_refill(unsigned long nbuf, uint64_t sample)
+{
+	double t0 = 0;
+	ssize_t ret = 0;
+	int tries;
+
+	for (tries = 0; tries <= RX_RETRIES; tries++) {
+		ret = iio_buffer_refill(rxbuf);
+		if (ret >= 0)
+			break;
+		if (!tries)
+			t0 = now_sec();
+		rxrec.errors++;
+		if (ret != -ETIMEDOUT && ret != -EAGAIN && ret != -EINTR)
+			return ret;
+		log_ev(LOG_WARN, nbuf, sample, "RX refill failed with %d, retry %d", (int)ret, tries + 1);
+	}
+	if (ret >= 0 && tries) {
+		double dt = now_sec() - t0;
+		rxrec.recovered++;
+		rxrec.total += dt;
+		if (dt > rxrec.worst) rxrec.worst = dt;
+	}
+	return ret;
+}
+
+/* -R and -O: a sample rate in Hz, positive and finite */
+static int hz_parse(const char *s, double *hz)
+{
+	char *end;
+	double v = strtod(s, &end);
+
+	if (end == s || *end || !isfinite(v) || v <= 0)
+		return -1;
+	*hz = v;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	size_t k;
+	fprintf(stderr, "usage: %s [-m mode] [-n buffers] [-i file[:speed]] [-o file] [-f fmt] [-p] [-t file]\n"
+	        "       [-R hz] [-O hz] [-c file] [-w file] [-s host:port] [-k sinks] [-F ofdm] [-A sweep] [-M mask] [-a att] [-z port] [-l file] [-v] [-r how[:ratio]] [uri]\n", prog);
+	fprintf(stderr, "  -i file[:speed]  replay a raw capture through the mode instead of RX, unthrottled\n"
+	                "           or at speed times the sample rate; the whole file unless -n is given, no radio needed\n");
+	fprintf(stderr, "  -o file  capture file (output.csv, or output.iq for binary formats)\n");
+	fprintf(stderr, "  -f fmt   capture format:");
+	for (k = 0; k < CAP_NFMT; k++)
+		fprintf(stderr, " %s", capture_fmt_name(k));
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -p       keep a min/max/mean overview pyramid next to the capture\n");
+	fprintf(stderr, "  -t file  float32 I/Q waveform for play mode\n");
+	fprintf(stderr, "  -R hz    sample rate of the play mode file, resampled to the TX rate (within 64x)\n");
+	fprintf(stderr, "  -O hz    resample the capture to this rate (within 64x of the RX rate)\n");
+	fprintf(stderr, "  -c file  calibration store (%s), \"\" for none\n", cal_path);
+	fprintf(stderr, "  -w file  FFT wisdom, the tuned FFT layouts (%s), \"\" for none\n",
+		*fft_path ? fft_path : "none without $XDG_CACHE_HOME or $HOME");
+	fprintf(stderr, "  -s host:port  where remote mode sends to\n");
+	fprintf(stderr, "  -k sinks comma separated sinks of tee mode: file, net, stats (%s)\n", tee_spec);
+	fprintf(stderr, "  -r how[:ratio]  remote mode reduction, dec (decimate, default 8), sum (min/max/mean\n"
+	                "           per ratio samples, default 8) or bfp\n");
+	fprintf(stderr, "  -F nfft[:cp[:pilot[:nsym]]]  OFDM mode frame layout (%s)\n", ofdm_spec);
+	fprintf(stderr, "  -A from:to:step  imd mode TX attenuation sweep in dB (%s)\n", imd_spec);
+	fprintf(stderr, "  -M file  check the RX spectrum against the mask in file, in any mode\n");
+	fprintf(stderr, "  -a dB    TX attenuation, hardwaregain (%lld)\n", tx_att);
+	fprintf(stderr, "  -z port[:fmt[:batch[:hwm]]]  also publish RX on a ZeroMQ PUB socket, sc16 or f32\n"
+	                "           (sc16:%d:%d), in any mode\n", ZPUB_BATCH, ZPUB_HWM);
+	fprintf(stderr, "  -l file  write the log there instead of stdout\n");
+	fprintf(stderr, "  -v       more log output (debug events)\n");
+	fprintf(stderr, "modes:\n");
+	for (k = 0; k < sizeof(modes) / sizeof(modes[0]); k++)
+		fprintf(stderr, "  %-8s %s\n", modes[k].name, modes[k].help);
+}
+
 /* simple configuration and streaming */
 /* usage:
  * Default context, assuming local IIO devices, i.e., this script is run on ADALM-Pluto for example
  $./a.out
  * URI context, find out the uri by typing `iio_info -s` at the command line of the host PC
  $./a.out usb:x.x.x
+ * Pick the test mode with -m (tone is the default) and the number of RX buffers with -n
+ $./a.out -m chirp -n 400 usb:x.x.x
+ * Long binary capture with an overview pyramid for browsing it afterwards
+ $./a.out -n 100000 -f raw -o long.iq -p usb:x.x.x
+ * On the Pluto, decimate by 16 and send to a host running "iqtool listen 5555 out.iq"
+ $./a.out -m remote -r dec:16 -s 192.168.2.10:5555 -n 100000
  */
 int main (int argc, char **argv)
 {
-	// Streaming devices
-	struct iio_device *tx;
-	struct iio_device *rx;
-
 	// RX sample counter
 	size_t nrx = 0;
 
@@ -228,6 +2487,81 @@ int main (int argc, char **argv)
 	struct stream_cfg rxcfg;
 	struct stream_cfg txcfg;
 
+	const struct test_mode *mode = &modes[0];
+	struct fft_cache_stats fft_st;
+	const char *log_path = NULL;
+	enum log_level log_lvl = LOG_INFO;
+	FILE *log_out = stdout;
+	const char *replay_spec = NULL;
+	int nbufs = 40;
+	bool nbufs_set = false;
+	int opt, ret;
+
+	fft_path = fft_default_path();
+	while ((opt = getopt(argc, argv, "m:n:i:o:f:pt:R:O:c:w:s:r:k:F:A:M:a:z:l:vh")) != -1) {
+		switch (opt) {
+		case 'm':
+			mode = find_mode(optarg);
+			if (!mode) { usage(argv[0]); return 1; }
+			break;
+		case 'n': nbufs = atoi(optarg); nbufs_set = true; break;
+		case 'i': replay_spec = optarg; break;
+		case 'o': out_path = optarg; break;
+		case 'f':
+			if (capture_fmt_parse(optarg, &out_fmt)) { usage(argv[0]); return 1; }
+			break;
+		case 'p': out_overview = true; break;
+		case 't': tx_path = optarg; break;
+		case 'R':
+			if (hz_parse(optarg, &tx_file_hz)) { usage(argv[0]); return 1; }
+			break;
+		case 'O':
+			if (hz_parse(optarg, &out_hz)) { usage(argv[0]); return 1; }
+			break;
+		case 'c': cal_path = optarg; break;
+		case 'w': fft_path = optarg; break;
+		case 'k': tee_spec = optarg; break;
+		case 'F': ofdm_spec = optarg; break;
+		case 'A': imd_spec = optarg; break;
+		case 'M': mask_path = optarg; break;
+		case 'a': tx_att = atoll(optarg); break;
+		case 'z': zpub_spec = optarg; break;
+		case 'l': log_path = optarg; break;
+		case 'v': log_lvl = LOG_DEBUG; break;
+		case 's': net_dest = optarg; break;
+		case 'r': {
+			char *colon = strchr(optarg, ':');
+			if (colon) { *colon = 0; net_ratio = strtoul(colon + 1, NULL, 0); }
+			if (net_kind_parse(optarg, &net_kind)) { usage(argv[0]); return 1; }
+			break;
+		}
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	// events from the streaming loop are formatted on a thread of their own
+	if (log_path && !(log_out = fopen(log_path, "w"))) {
+		perror(log_path);
+		return 1;
+	}
+	log_start(log_out, log_lvl);
+
+	// a capture in place of the RX stream
+	if (replay_spec) {
+		if (mode->dual_rx) {
+			fprintf(stderr, "%s mode needs both RX channels, a capture has one\n", mode->name);
+			return 1;
+		}
+		if (!replay_open(replay_spec)) {
+			usage(argv[0]);
+			return 1;
+		}
+		if (replay.speed > 0)
+			printf("* Replaying %s at %gx the sample rate\n", replay.path, replay.speed);
+		else
+			printf("* Replaying %s as fast as it goes\n", replay.path);
+	}
+
 	// Listen to ctrl+c and IIO_ENSURE
 	signal(SIGINT, handle_sig);
 
@@ -254,54 +2588,45 @@ int main (int argc, char **argv)
 	// Carrier frequency
 	txcfg.lo_hz = GHZ(2.5); // 2.5 GHz rf frequency
 	txcfg.rfport = "A"; // port A (select for rf freq.)
-	txcfg.gain = -30;   // attentuation on the transmit channel.
-
-	printf("* Acquiring IIO context\n");
-	if (argc == 1) {
-		IIO_ENSURE((ctx = iio_create_default_context()) && "No context");
-	}
-	else if (argc == 2) {
-		IIO_ENSURE((ctx = iio_create_context_from_uri(argv[1])) && "No context");
+	txcfg.gain = tx_att;   // attentuation on the transmit channel.
+
+	// a replay needs no device, TX goes nowhere and RX comes from the file
+	if (!replay.path)
+		stream_setup(optind < argc ? argv[optind] : NULL, mode, &rxcfg, &txcfg);
+
+	// corrections from earlier runs at the same settings
+	cal_key = (struct calib_key){ rxcfg.lo_hz, rxcfg.fs_hz, rxcfg.gain, txcfg.gain };
+	if (*cal_path && !(cal_db = calib_load(cal_path)))
+		fprintf(stderr, "Could not read calibration store %s\n", cal_path);
+	if (cal_db) {
+		const struct calib_entry *e = calib_find(cal_db, &cal_key);
+		if (e) {
+			calib_corr_init(&cal_corr, e);
+			cal_have = true;
+			printf("* Calibration from %s (%u runs): DC %.2f, %.2f, IQ gain %.4f, phase %.3f deg, loopback gain %.2f dB\n",
+			       cal_path, e->nmeas, e->dc[0], e->dc[1], e->iq_gain, e->iq_phase, e->loop_gain_db);
+		} else {
+			printf("* No calibration for these settings in %s\n", cal_path);
+		}
 	}
-	IIO_ENSURE(iio_context_get_devices_count(ctx) > 0 && "No devices");
-
-	printf("* Acquiring AD9361 streaming devices\n");
-	IIO_ENSURE(get_ad9361_stream_dev(TX, &tx) && "No tx dev found");
-	IIO_ENSURE(get_ad9361_stream_dev(RX, &rx) && "No rx dev found");
-
-	printf("* Configuring AD9361 for streaming\n");
-	IIO_ENSURE(cfg_ad9361_streaming_ch(&rxcfg, RX, 0) && "RX port 0 not found");
-	IIO_ENSURE(cfg_ad9361_streaming_ch(&txcfg, TX, 0) && "TX port 0 not found");
-
-	printf("* Initializing AD9361 IIO streaming channels\n");
-	IIO_ENSURE(get_ad9361_stream_ch(RX, rx, 0, &rx0_i) && "RX chan i not found");
-	IIO_ENSURE(get_ad9361_stream_ch(RX, rx, 1, &rx0_q) && "RX chan q not found");
-	IIO_ENSURE(get_ad9361_stream_ch(TX, tx, 0, &tx0_i) && "TX chan i not found");
-	IIO_ENSURE(get_ad9361_stream_ch(TX, tx, 1, &tx0_q) && "TX chan q not found");
 
-	printf("* Enabling IIO streaming channels\n");
-	iio_channel_enable(rx0_i);
-	iio_channel_enable(rx0_q);
-	iio_channel_enable(tx0_i);
-	iio_channel_enable(tx0_q);
+	// FFT layouts tuned by earlier runs, the plans of the mode are made from them
+	if (*fft_path && (ret = fft_wisdom_load(fft_path)) < 0)
+		fprintf(stderr, "Could not read FFT wisdom %s: %s\n", fft_path, strerror(-ret));
 
-	printf("* Creating non-cyclic IIO buffers\n");
-	rxbuf = iio_device_create_buffer(rx, 256, false);
-	if (!rxbuf) {
-		perror("Could not create RX buffer");
+	printf("* Starting %s mode\n", mode->name);
+	if (mode->start && !mode->start(&txcfg, &rxcfg)) {
+		fprintf(stderr, "Could not start %s mode\n", mode->name);
 		shutdown();
 	}
-	// even though "cyclic mode" is defined as false below the tx seems to
-	// continue cycle through the buffer forever
-	txbuf = iio_device_create_buffer(tx, 256*4, false);
-	if (!txbuf) {
-		perror("Could not create TX buffer");
+	if (mask_path && !mask_start(&rxcfg)) {
+		fprintf(stderr, "Could not start the mask check\n");
+		shutdown();
+	}
+	if (zpub_spec && !zpub_start(&rxcfg)) {
+		fprintf(stderr, "Could not start the zmq publisher\n");
 		shutdown();
 	}
-
-	// DAD let's create a couple of files so we can see what is transmitted/received
-	FILE *foutp = fopen("output.csv", "w+");
-	FILE *finp = fopen("input.csv", "w+");
 
 	printf("* Starting IO streaming\n");
 
@@ -309,42 +2634,21 @@ int main (int argc, char **argv)
 	char *p_dat, *p_end;
 	ptrdiff_t p_inc;
 	int rx_loop;  // loop counter for receive.
+	static int16_t rx_iq[2 * RX_BUF_SAMPLES];
+	int16_t *iq;
 
-
-	float freq = 2.0 * M_PI * 50.0e3;  // 2*pi*50KHz
-	double ampl = 48; // peak value for a 12 bit value is 4096
-		
-	double i = 1. / txcfg.fs_hz;
-
-	// WRITE: Get pointers to TX buf and write IQ to TX buf port 0
-	p_inc = iio_buffer_step(txbuf);
-	p_end = iio_buffer_end(txbuf);
-
-// fill the transmit buffer with a sine wave.
-	for (p_dat = (char *)iio_buffer_first(txbuf, tx0_i); p_dat < p_end; p_dat += p_inc) {
-		// 12-bit sample needs to be MSB aligned so shift by 4
-		// https://wiki.analog.com/resources/eval/user-guides/ad-fmcomms2-ebz/software/basic_iq_datafiles#binary_format
-
-		// fill tx buffer with sine wave
-		short ipart = 0;
-		short qpart = ampl * cos(freq * i)*16; // to move the 12 bits to the MSB of the 16 bit array.
-
-		((int16_t *)p_dat)[0] = ipart & 0xFFF0;
-		((int16_t *)p_dat)[1] = qpart & 0xFFF0;
-
-		// fill output file with the data so we can see what was sent.
-		fprintf(finp, "%d, %d\n", ((int16_t*)p_dat)[0], ((int16_t*)p_dat)[1]);
-
-		i += 1. / txcfg.fs_hz;
-		}
+	// without a TX buffer the modes still set up what they compare RX against
+	mode->tx_fill(txbuf, &txcfg);
 
 	// Schedule TX buffer (start the transmission...)
-	nbytes_tx = iio_buffer_push(txbuf);
-	if (nbytes_tx < 0) { printf("Error pushing buf %d\n", (int) nbytes_tx); shutdown(); }
+	if (txbuf) {
+		nbytes_tx = iio_buffer_push(txbuf);
+		if (nbytes_tx < 0) { printf("Error pushing buf %d\n", (int) nbytes_tx); shutdown(); }
+	}
 
 
 	//  RX buffer  (start the reception of data but throw the initial samples away till tx starts)
-	for (rx_loop = 0; rx_loop < 2; rx_loop++) {
+	for (rx_loop = 0; rx_loop < 2 && !replay.path; rx_loop++) {
 		//  RX buffer  (start the reception of data)
 		nbytes_rx = iio_buffer_refill(rxbuf);
 		if (nbytes_rx < 0) { printf("Error refilling buf %d\n",(int) nbytes_rx); shutdown(); }
@@ -362,28 +2666,87 @@ int main (int argc, char **argv)
     nrx = 0;
 
     // Now start actually capturing data into the rx buffer a lot of times.
-	for (rx_loop = 0; rx_loop < 40; rx_loop++) {
-		//  RX buffer  (start the reception of data)
-		nbytes_rx = iio_buffer_refill(rxbuf);
-		if (nbytes_rx < 0) { printf("Error refilling buf %d\n",(int) nbytes_rx); shutdown(); }
-
-		// READ: Get pointers to RX buf and read IQ from RX buf port 0
-		p_inc = iio_buffer_step(rxbuf);
-		p_end = iio_buffer_end(rxbuf);
-		for (p_dat = (char *)iio_buffer_first(rxbuf, rx0_i); p_dat < p_end; p_dat += p_inc) {
-			// grab the I and Q and dump it to a file
-			const int16_t i = ((int16_t*)p_dat)[0]; // Real (I)
-			const int16_t q = ((int16_t*)p_dat)[1]; // Imag (Q)
-
-			nrx++;
-			// how about also writing amplitude and phase in degrees to the file?
-			fprintf(foutp, "%d, %d, %.4f, %.4f\n", i, q, (double)sqrt((i*i)+(q*q)), (180/M_PI)*atan((double)q/(double)i));
+	for (rx_loop = 0; (rx_loop < nbufs || (replay.path && !nbufs_set)) && !stop; rx_loop++) {
+		size_t n = 0;
+		double t0;
+
+		iq = mode->rx_buffer ? mode->rx_buffer() : rx_iq;
+		if (replay.path) {
+			n = replay_read(iq, RX_BUF_SAMPLES, rxcfg.fs_hz);
+			if (!n)
+				break;
+		} else {
+			//  RX buffer  (start the reception of data)
+			nbytes_rx = rx_refill(rx_loop, nrx);
+			if (nbytes_rx < 0) {
+				// keep what was captured so far
+				log_ev(LOG_ERR, rx_loop, nrx, "Error refilling buf %d", (int)nbytes_rx);
+				exit_status = 1;
+				break;
+			}
+
+			// READ: Get pointers to RX buf and copy IQ from RX buf port 0 for the test mode
+			p_inc = iio_buffer_step(rxbuf);
+			p_end = iio_buffer_end(rxbuf);
+			p_dat = (char *)iio_buffer_first(rxbuf, rx0_i);
+			if (p_dat < p_end)
+				n = (p_end - p_dat + p_inc - 1) / p_inc;
+			if (n > RX_BUF_SAMPLES)
+				n = RX_BUF_SAMPLES;
+			if (mode->dual_rx)
+				iq_extract2(p_dat, p_inc, n, iq, rx1_iq);
+			else
+				iq_extract(p_dat, p_inc, n, iq);
+			if (cal_have && !mode->raw)
+				calib_apply(&cal_corr, iq, n);
+			if (n < RX_BUF_SAMPLES) {
+				rxrec.short_reads++;
+				log_ev(LOG_DEBUG, rx_loop, nrx, "short read, %zu samples", n);
+			}
+		}
+		nrx += n;
+		t0 = now_sec();
+		mode->rx_block(iq, n);
+		if (mask_path)
+			mask_rx_block(iq, n);
+		if (zpub_spec)
+			zpub_rx_block(iq, n);
+		replay.busy += now_sec() - t0;
+
+		// streaming modes keep the TX buffer going at the RX rate
+		if (mode->tx_stream && (rx_loop + 1) % (TX_BUF_SAMPLES / RX_BUF_SAMPLES) == 0) {
+			mode->tx_fill(txbuf, &txcfg);
+			nbytes_tx = txbuf ? iio_buffer_push(txbuf) : 0;
+			if (nbytes_tx < 0) {
+				// as for RX, the modes still finish what they have
+				log_ev(LOG_ERR, rx_loop, nrx, "Error pushing buf %d", (int)nbytes_tx);
+				exit_status = 1;
+				break;
+			}
 		}
 	}
+	log_flush();
 
     printf("* data values received RX %d\n", nrx);
-	fclose(finp);
-	fclose(foutp);
+	if (replay.path)
+		replay_close(rxcfg.fs_hz);
+	if (rxrec.errors || rxrec.short_reads)
+		printf("* RX errors %lu, %lu recovered (worst %.3f ms, total %.3f ms), %lu short reads\n",
+		       rxrec.errors, rxrec.recovered, rxrec.worst * 1e3, rxrec.total * 1e3, rxrec.short_reads);
+	if (mode->finish) { mode->finish(); }
+	if (mask_path)
+		mask_finish();
+	if (zpub_spec)
+		zpub_finish();
+	calib_close(cal_db);
+	fft_cache_stats(&fft_st);
+	if (fft_st.made)
+		printf("* FFT: %u plans made, %u handed out again, %u sizes tuned in %.1f ms\n",
+		       fft_st.made, fft_st.hits, fft_st.tuned, fft_st.tune_sec * 1e3);
+	if (fft_path == fft_cache && *fft_path)
+		fft_cache_mkdir();
+	if (*fft_path && (ret = fft_wisdom_save(fft_path)) < 0)
+		fprintf(stderr, "Error %d writing %s\n", ret, fft_path);
 
 	shutdown();
 
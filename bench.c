@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * bench - microbenchmarks for the per-sample kernels in iqconv.c
+ *
+ * Every kernel is run in its reference and SIMD version over several
+ * block sizes, with the buffers aligned to 64 bytes and offset by one
+ * element.  Results are checked against the reference first.  The
+ * resampler from dsp.c and the predistorter from dpd.c are timed too (no
+ * reference, throughput is input samples), 64 point FFTs one by one
+ * against fft_execute_batch() and one FFT of the block size in both
+ * twiddle layouts.
+ *
+ * usage:
+ *  bench [--filter=text] [--min-time=seconds]
+ **/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "dpd.h"
+#include "dsp.h"
+#include "iqconv.h"
+
+#define MAX_N 65536
+
+/* buffers handed to a kernel, offset by one element when unaligned */
+struct bench_buf {
+	size_t n;
+	int16_t *s16;    // 4 int16 per sample, room for two channel layouts
+	float *f32;      // 2 floats per sample
+	uint16_t *f16;
+	int8_t *s8;
+	int16_t *out16;
+	float *outf;
+};
+
+struct bench {
+	const char *name;
+	const char *variant;
+	void (*run)(struct bench_buf *b);
+};
+
+static void bm_extract1_ref(struct bench_buf *b) { iq_extract_ref(b->s16, 4, b->n, b->out16); }
+static void bm_extract1(struct bench_buf *b)     { iq_extract(b->s16, 4, b->n, b->out16); }
+static void bm_extract2_ref(struct bench_buf *b) { iq_extract_ref(b->s16, 8, b->n, b->out16); }
+static void bm_extract2(struct bench_buf *b)     { iq_extract(b->s16, 8, b->n, b->out16); }
+static void bm_split_ref(struct bench_buf *b)    { iq_extract2_ref(b->s16, 8, b->n, b->out16, b->out16 + 2 * b->n); }
+static void bm_split(struct bench_buf *b)        { iq_extract2(b->s16, 8, b->n, b->out16, b->out16 + 2 * b->n); }
+static void bm_mag_ref(struct bench_buf *b)      { iq_magnitude_ref(b->s16, b->n, b->outf); }
+static void bm_mag(struct bench_buf *b)          { iq_magnitude(b->s16, b->n, b->outf); }
+static void bm_phase_ref(struct bench_buf *b)    { iq_phase_ref(b->s16, b->n, b->outf); }
+static void bm_phase(struct bench_buf *b)        { iq_phase(b->s16, b->n, b->outf); }
+static void bm_pack_ref(struct bench_buf *b)     { tx_pack_ref(b->f32, b->n, b->out16, 4); }
+static void bm_pack(struct bench_buf *b)         { tx_pack(b->f32, b->n, b->out16, 4); }
+static void bm_bfp_enc_ref(struct bench_buf *b)  { bfp_encode_ref(b->s16, 2 * b->n, b->s8); }
+static void bm_bfp_enc(struct bench_buf *b)      { bfp_encode(b->s16, 2 * b->n, b->s8); }
+static void bm_bfp_dec_ref(struct bench_buf *b)  { bfp_decode_ref(b->s8, 2 * b->n, 4, b->out16); }
+static void bm_bfp_dec(struct bench_buf *b)      { bfp_decode(b->s8, 2 * b->n, 4, b->out16); }
+static void bm_f16_ref(struct bench_buf *b)      { s16_to_f16_ref(b->s16, 2 * b->n, b->f16); }
+static void bm_f16(struct bench_buf *b)          { s16_to_f16(b->s16, 2 * b->n, b->f16); }
+static void bm_f32_ref(struct bench_buf *b)      { f16_to_f32_ref(b->f16, 2 * b->n, b->outf); }
+static void bm_f32(struct bench_buf *b)          { f16_to_f32(b->f16, 2 * b->n, b->outf); }
+static void bm_crc_ref(struct bench_buf *b)      { b->out16[0] = crc32c_ref(0, b->s16, 4 * b->n); }
+static void bm_crc(struct bench_buf *b)          { b->out16[0] = crc32c(0, b->s16, 4 * b->n); }
+
+/* RX0 against RX1, the two halves of the sample buffer */
+static struct iq_corr corr;
+static void bm_corr_ref(struct bench_buf *b)     { iq_corr_ref(b->s16, b->s16 + 2 * b->n, b->n, &corr); }
+static void bm_corr(struct bench_buf *b)         { iq_corr(b->s16, b->s16 + 2 * b->n, b->n, &corr); }
+
+/* resampler state is carried from run to run like in a stream */
+static float complex rs_out[4 * MAX_N];
+
+static void bm_resample(struct bench_buf *b, double ratio, struct resampler **r)
+{
+	if (!*r && !(*r = resampler_create(ratio))) {
+		perror("resampler_create");
+		exit(1);
+	}
+	resampler_process(*r, (const float complex *)b->f32, b->n, rs_out);
+}
+
+static struct resampler *rs_up, *rs_down;
+static void bm_resample_up(struct bench_buf *b)   { bm_resample(b, 2.56, &rs_up); }
+static void bm_resample_down(struct bench_buf *b) { bm_resample(b, 0.75, &rs_down); }
+
+/* 64 point FFTs over the block, one call each or all in one batch */
+static struct fft_plan *fft64;
+
+static void bm_fft(struct bench_buf *b, bool batch)
+{
+	size_t k;
+
+	if (!fft64 && !(fft64 = fft_plan_create(64, FFT_FORWARD))) {
+		perror("fft_plan_create");
+		exit(1);
+	}
+	memcpy(rs_out, b->f32, b->n * sizeof(*rs_out));
+	if (batch)
+		fft_execute_batch(fft64, rs_out, b->n / 64);
+	else
+		for (k = 0; k + 64 <= b->n; k += 64)
+			fft_execute(fft64, rs_out + k);
+}
+
+static void bm_fft_single(struct bench_buf *b) { bm_fft(b, false); }
+static void bm_fft_batch(struct bench_buf *b)  { bm_fft(b, true); }
+
+/* one transform of the block size in either twiddle layout, plans kept per size */
+static struct fft_plan *fft_impl_plans[FFT_IMPLS][32];
+
+static struct fft_plan *impl_plan(size_t n, enum fft_impl impl)
+{
+	unsigned l = 0;
+
+	while (((size_t)1 << l) < n)
+		l++;
+	if (!fft_impl_plans[impl][l] && !(fft_impl_plans[impl][l] = fft_plan_create_impl(n, FFT_FORWARD, impl))) {
+		perror("fft_plan_create_impl");
+		exit(1);
+	}
+	return fft_impl_plans[impl][l];
+}
+
+static void bm_fft_impl(struct bench_buf *b, enum fft_impl impl)
+{
+	memcpy(rs_out, b->f32, b->n * sizeof(*rs_out));
+	fft_execute(impl_plan(b->n, impl), rs_out);
+}
+
+static void bm_fft_strided(struct bench_buf *b) { bm_fft_impl(b, FFT_STRIDED); }
+static void bm_fft_staged(struct bench_buf *b)  { bm_fft_impl(b, FFT_STAGED); }
+
+/* predistorter with all coefficients in use */
+static struct dpd pd;
+
+static void bm_dpd(struct bench_buf *b)
+{
+	size_t k;
+
+	if (pd.w[0] == 0)
+		for (k = 0; k < DPD_NCOEF; k++)
+			pd.w[k] = (k ? 0.01f : 1.0f) + 0.01f * I;
+	dpd_apply(&pd, (const float complex *)b->f32, b->n, rs_out);
+}
+
+static const struct bench benches[] = {
+	{ "iq_extract_1ch", "ref",  bm_extract1_ref },
+	{ "iq_extract_1ch", "simd", bm_extract1 },
+	{ "iq_extract_2ch", "ref",  bm_extract2_ref },
+	{ "iq_extract_2ch", "simd", bm_extract2 },
+	{ "iq_extract2",    "ref",  bm_split_ref },
+	{ "iq_extract2",    "simd", bm_split },
+	{ "iq_corr",        "ref",  bm_corr_ref },
+	{ "iq_corr",        "simd", bm_corr },
+	{ "iq_magnitude",   "ref",  bm_mag_ref },
+	{ "iq_magnitude",   "simd", bm_mag },
+	{ "iq_phase",       "ref",  bm_phase_ref },
+	{ "iq_phase",       "simd", bm_phase },
+	{ "tx_pack",        "ref",  bm_pack_ref },
+	{ "tx_pack",        "simd", bm_pack },
+	{ "bfp_encode",     "ref",  bm_bfp_enc_ref },
+	{ "bfp_encode",     "simd", bm_bfp_enc },
+	{ "bfp_decode",     "ref",  bm_bfp_dec_ref },
+	{ "bfp_decode",     "simd", bm_bfp_dec },
+	{ "s16_to_f16",     "ref",  bm_f16_ref },
+	{ "s16_to_f16",     "simd", bm_f16 },
+	{ "f16_to_f32",     "ref",  bm_f32_ref },
+	{ "f16_to_f32",     "simd", bm_f32 },
+	{ "crc32c",         "ref",  bm_crc_ref },
+	{ "crc32c",         "simd", bm_crc },
+	{ "resample_x2.56", "simd", bm_resample_up },
+	{ "resample_x0.75", "simd", bm_resample_down },
+	{ "dpd_apply",      "c",    bm_dpd },
+	{ "fft64",          "single", bm_fft_single },
+	{ "fft64",          "batch",  bm_fft_batch },
+	{ "fft",            "strided", bm_fft_strided },
+	{ "fft",            "staged",  bm_fft_staged },
+};
+
+static const size_t sizes[] = { 64, 256, 4096, MAX_N };
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* 64 byte aligned storage, each buffer gets a spare element for the offset runs */
+static struct bench_buf base;
+
+static void *alloc_aligned(size_t bytes)
+{
+	void *p = aligned_alloc(64, (bytes + 64 + 63) & ~(size_t)63);
+	if (!p) {
+		perror("aligned_alloc");
+		exit(1);
+	}
+	return p;
+}
+
+static void fill_inputs(void)
+{
+	size_t k;
+
+	srand(1);
+	for (k = 0; k < 4 * (MAX_N + 1); k++)
+		base.s16[k] = (int16_t)(rand() % 4096 - 2048);
+	for (k = 0; k < 2 * (MAX_N + 1); k++)
+		base.f32[k] = (rand() / (float)RAND_MAX) * 2.4f - 1.2f;
+	s16_to_f16_ref(base.s16, 2 * (MAX_N + 1), base.f16);
+	for (k = 0; k < 2 * (MAX_N + 1); k++)
+		base.s8[k] = (int8_t)(rand() % 256 - 128);
+}
+
+static struct bench_buf view(size_t n, bool aligned)
+{
+	struct bench_buf b = base;
+	size_t o = aligned ? 0 : 1;
+
+	b.n = n;
+	b.s16 += o; b.f32 += o; b.f16 += o; b.s8 += o;
+	b.out16 += o; b.outf += o;
+	return b;
+}
+
+/* compare the SIMD kernels against the references over all sizes and both alignments */
+static int check(void)
+{
+	static int16_t r16[4 * (MAX_N + 1)];
+	static float rf[2 * (MAX_N + 1)];
+	static uint16_t rh[2 * (MAX_N + 1)];
+	static int8_t r8[2 * (MAX_N + 1)];
+	int fails = 0;
+	size_t si, k;
+	int al;
+
+#define FAIL(what) do { fprintf(stderr, "check failed: %s n=%zu %s\n", what, n, al ? "aligned" : "unaligned"); fails++; } while (0)
+
+	for (si = 0; si < sizeof(sizes) / sizeof(sizes[0]); si++) {
+		for (al = 0; al < 2; al++) {
+			struct bench_buf b = view(sizes[si], al);
+			size_t n = b.n;
+			unsigned e1, e2;
+
+			iq_extract_ref(b.s16, 8, n, r16);
+			iq_extract(b.s16, 8, n, b.out16);
+			if (memcmp(r16, b.out16, 4 * n)) FAIL("iq_extract");
+
+			iq_extract2_ref(b.s16, 8, n, r16, r16 + 2 * n);
+			iq_extract2(b.s16, 8, n, b.out16, b.out16 + 2 * n);
+			if (memcmp(r16, b.out16, 8 * n)) FAIL("iq_extract2");
+
+			{
+				struct iq_corr c1 = { { 0 } }, c2 = { { 0 } };
+				iq_corr_ref(b.s16, b.s16 + 2 * n, n, &c1);
+				iq_corr(b.s16, b.s16 + 2 * n, n, &c2);
+				if (memcmp(&c1, &c2, sizeof(c1))) FAIL("iq_corr");
+
+				// full scale 16 bit input is clipped to 12 bit by both
+				for (k = 0; k < 4 * n; k++)
+					r16[k] = k & 1 ? INT16_MIN : INT16_MAX;
+				memset(&c1, 0, sizeof(c1));
+				memset(&c2, 0, sizeof(c2));
+				iq_corr_ref(r16, r16 + 2 * n, n, &c1);
+				iq_corr(r16, r16 + 2 * n, n, &c2);
+				if (memcmp(&c1, &c2, sizeof(c1)) || c1.aa != (int64_t)n * (2047 * 2047 + 2048 * 2048))
+					FAIL("iq_corr full scale");
+			}
+
+			iq_magnitude_ref(b.s16, n, rf);
+			iq_magnitude(b.s16, n, b.outf);
+			for (k = 0; k < n; k++)
+				if (fabsf(rf[k] - b.outf[k]) > 1e-5f * (rf[k] + 1)) { FAIL("iq_magnitude"); break; }
+
+			iq_phase_ref(b.s16, n, rf);
+			iq_phase(b.s16, n, b.outf);
+			for (k = 0; k < n; k++)
+				if (fabsf(rf[k] - b.outf[k]) > 2e-5f) { FAIL("iq_phase"); break; }
+
+			tx_pack_ref(b.f32, n, r16, 4);
+			tx_pack(b.f32, n, b.out16, 4);
+			if (memcmp(r16, b.out16, 4 * n)) FAIL("tx_pack");
+
+			// both channels enabled, the pairs in between stay as they are
+			memset(r16, 0, 8 * n);
+			memset(b.out16, 0, 8 * n);
+			tx_pack_ref(b.f32, n, r16, 8);
+			tx_pack(b.f32, n, b.out16, 8);
+			if (memcmp(r16, b.out16, 8 * n)) FAIL("tx_pack strided");
+
+			e1 = bfp_encode_ref(b.s16, 2 * n, r8);
+			e2 = bfp_encode(b.s16, 2 * n, b.s8 + 2 * (MAX_N + 1) - 2 * n - 1);
+			if (e1 != e2 || memcmp(r8, b.s8 + 2 * (MAX_N + 1) - 2 * n - 1, 2 * n)) FAIL("bfp_encode");
+
+			bfp_decode_ref(b.s8, 2 * n, 4, r16);
+			bfp_decode(b.s8, 2 * n, 4, b.out16);
+			if (memcmp(r16, b.out16, 4 * n)) FAIL("bfp_decode");
+
+			s16_to_f16_ref(b.s16, 2 * n, rh);
+			s16_to_f16(b.s16, 2 * n, b.f16);
+			if (memcmp(rh, b.f16, 4 * n)) FAIL("s16_to_f16");
+
+			f16_to_f32_ref(b.f16, 2 * n, rf);
+			f16_to_f32(b.f16, 2 * n, b.outf);
+			if (memcmp(rf, b.outf, 8 * n)) FAIL("f16_to_f32");
+
+			if (crc32c_ref(0, b.s16, 4 * n) != crc32c(0, b.s16, 4 * n)) FAIL("crc32c");
+
+			// same twiddles and arithmetic, only where they are read from differs
+			memcpy(rs_out, b.f32, 8 * n);
+			memcpy(rs_out + n, b.f32, 8 * n);
+			fft_execute(impl_plan(n, FFT_STRIDED), rs_out);
+			fft_execute(impl_plan(n, FFT_STAGED), rs_out + n);
+			if (memcmp(rs_out, rs_out + n, 8 * n)) FAIL("fft staged");
+		}
+	}
+#undef FAIL
+	// the checks wrote into the input buffers, start the timing runs from known data
+	fill_inputs();
+	return fails;
+}
+
+static void run(const struct bench *bm, size_t n, bool aligned, double min_time)
+{
+	struct bench_buf b = view(n, aligned);
+	unsigned long iters = 1, k;
+	double t0, dt;
+	uint64_t c0, dc;
+	char name[80];
+
+	// warm up, then double the iterations until the run is long enough
+	bm->run(&b);
+	for (;;) {
+		t0 = now_sec();
+		c0 = cycles();
+		for (k = 0; k < iters; k++)
+			bm->run(&b);
+		dc = cycles() - c0;
+		dt = now_sec() - t0;
+		if (dt >= min_time || iters >= (1UL << 30))
+			break;
+		iters *= dt > 0 ? (min_time / dt > 2 ? (unsigned long)(min_time / dt * 1.2) : 2) : 2;
+	}
+
+	snprintf(name, sizeof(name), "%s/%s/%zu/%s", bm->name, bm->variant, n, aligned ? "aligned" : "unaligned");
+	printf("%-40s %12.0f ns %10.1f MS/s", name, dt / iters * 1e9, n * iters / dt * 1e-6);
+	if (dc)
+		printf(" %10.3f cyc/S\n", (double)dc / iters / n);
+	else
+		printf(" %10s\n", "-");
+}
+
+int main(int argc, char **argv)
+{
+	const char *filter = NULL;
+	double min_time = 0.1;
+	size_t b, si;
+	int a, fails;
+
+	for (a = 1; a < argc; a++) {
+		if (!strncmp(argv[a], "--filter=", 9))
+			filter = argv[a] + 9;
+		else if (!strncmp(argv[a], "--min-time=", 11))
+			min_time = atof(argv[a] + 11);
+		else {
+			fprintf(stderr, "usage: %s [--filter=text] [--min-time=seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	base.s16 = alloc_aligned(4 * (MAX_N + 1) * sizeof(int16_t));
+	base.f32 = alloc_aligned(2 * (MAX_N + 1) * sizeof(float));
+	base.f16 = alloc_aligned(2 * (MAX_N + 1) * sizeof(uint16_t));
+	base.s8 = alloc_aligned(2 * (MAX_N + 1) * sizeof(int8_t));
+	base.out16 = alloc_aligned(4 * (MAX_N + 1) * sizeof(int16_t));
+	base.outf = alloc_aligned(2 * (MAX_N + 1) * sizeof(float));
+	fill_inputs();
+
+	fails = check();
+	printf("correctness checks: %s\n", fails ? "FAILED" : "passed");
+
+	printf("%-40s %15s %15s %16s\n", "Benchmark", "Time", "Throughput", "Cycles");
+	for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+		for (si = 0; si < sizeof(sizes) / sizeof(sizes[0]); si++) {
+			char name[80];
+			snprintf(name, sizeof(name), "%s/%s/%zu", benches[b].name, benches[b].variant, sizes[si]);
+			if (filter && !strstr(name, filter))
+				continue;
+			run(&benches[b], sizes[si], true, min_time);
+			run(&benches[b], sizes[si], false, min_time);
+		}
+	}
+	return fails != 0;
+}
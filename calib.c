@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * calib.c - persistent RX calibration store
+ **/
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "calib.h"
+
+#define CALIB_COLUMNS "# lo_hz fs_hz rx_gain tx_gain dc_i dc_q iq_gain iq_phase_deg loop_gain_db runs updated\n"
+
+static struct calib_entry *calib_add(struct calib_db *db, const struct calib_key *k)
+{
+	struct calib_entry *e;
+
+	if (db->n == db->cap) {
+		size_t cap = db->cap ? 2 * db->cap : 16;
+		e = realloc(db->e, cap * sizeof(*e));
+		if (!e)
+			return NULL;
+		db->e = e;
+		db->cap = cap;
+	}
+	e = &db->e[db->n++];
+	memset(e, 0, sizeof(*e));
+	e->key = *k;
+	return e;
+}
+
+struct calib_db *calib_load(const char *path)
+{
+	struct calib_db *db = calloc(1, sizeof(*db));
+	char line[256];
+	FILE *f;
+
+	if (!db || !(db->path = strdup(path))) {
+		free(db);
+		return NULL;
+	}
+	f = fopen(path, "r");
+	if (!f) {
+		if (errno == ENOENT)
+			return db;
+		calib_close(db);
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		struct calib_entry m, *e;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%lld %lld %lld %lld %lf %lf %lf %lf %lf %u %lld",
+			   &m.key.lo_hz, &m.key.fs_hz, &m.key.rx_gain, &m.key.tx_gain,
+			   &m.dc[0], &m.dc[1], &m.iq_gain, &m.iq_phase, &m.loop_gain_db,
+			   &m.nmeas, &m.updated) != 11) {
+			fprintf(stderr, "%s: skipping \"%.*s\"\n", path, (int)strcspn(line, "\n"), line);
+			continue;
+		}
+		if (!(e = calib_add(db, &m.key)))
+			break;
+		*e = m;
+	}
+	fclose(f);
+	return db;
+}
+
+int calib_save(const struct calib_db *db)
+{
+	char tmp[4096];
+	size_t k;
+	FILE *f;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", db->path) >= (int)sizeof(tmp))
+		return -ENAMETOOLONG;
+	f = fopen(tmp, "w");
+	if (!f)
+		return -errno;
+	fputs(CALIB_COLUMNS, f);
+	for (k = 0; k < db->n; k++) {
+		const struct calib_entry *e = &db->e[k];
+		fprintf(f, "%lld %lld %lld %lld %.3f %.3f %.6f %.4f %.3f %u %lld\n",
+			e->key.lo_hz, e->key.fs_hz, e->key.rx_gain, e->key.tx_gain,
+			e->dc[0], e->dc[1], e->iq_gain, e->iq_phase, e->loop_gain_db,
+			e->nmeas, e->updated);
+	}
+	if (fclose(f) || rename(tmp, db->path)) {
+		int ret = -errno;
+		remove(tmp);
+		return ret;
+	}
+	return 0;
+}
+
+void calib_close(struct calib_db *db)
+{
+	if (!db)
+		return;
+	free(db->path);
+	free(db->e);
+	free(db);
+}
+
+const struct calib_entry *calib_find(const struct calib_db *db, const struct calib_key *k)
+{
+	size_t i;
+	for (i = 0; i < db->n; i++)
+		if (!memcmp(&db->e[i].key, k, sizeof(*k)))
+			return &db->e[i];
+	return NULL;
+}
+
+const struct calib_entry *calib_update(struct calib_db *db, const struct calib_entry *m)
+{
+	struct calib_entry *e = (struct calib_entry *)calib_find(db, &m->key);
+	double w;
+
+	if (!e) {
+		if (!(e = calib_add(db, &m->key)))
+			return NULL;
+		*e = *m;
+		e->nmeas = 0;
+	}
+	// running average that forgets runs older than the last CALIB_MAX_WEIGHT
+	w = e->nmeas < CALIB_MAX_WEIGHT ? e->nmeas : CALIB_MAX_WEIGHT;
+	e->dc[0] = (w * e->dc[0] + m->dc[0]) / (w + 1);
+	e->dc[1] = (w * e->dc[1] + m->dc[1]) / (w + 1);
+	e->iq_gain = (w * e->iq_gain + m->iq_gain) / (w + 1);
+	e->iq_phase = (w * e->iq_phase + m->iq_phase) / (w + 1);
+	e->loop_gain_db = (w * e->loop_gain_db + m->loop_gain_db) / (w + 1);
+	e->nmeas++;
+	e->updated = time(NULL);
+	return e;
+}
+
+void calib_acc_add(struct calib_acc *a, const int16_t *iq, size_t n)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		double i = iq[2*k], q = iq[2*k+1];
+		a->sum[0] += i;
+		a->sum[1] += q;
+		a->ii += i * i;
+		a->qq += q * q;
+		a->iq += i * q;
+	}
+	a->n += n;
+}
+
+void calib_acc_result(const struct calib_acc *a, double tx_ampl, struct calib_entry *m)
+{
+	double mi, mq, ii, qq, iq;
+
+	if (!a->n)
+		return;
+	mi = a->sum[0] / a->n;
+	mq = a->sum[1] / a->n;
+	// second order statistics with the DC taken out
+	ii = a->ii / a->n - mi * mi;
+	qq = a->qq / a->n - mq * mq;
+	iq = a->iq / a->n - mi * mq;
+
+	m->dc[0] = mi;
+	m->dc[1] = mq;
+	// a circular signal has E[I^2] = E[Q^2] and E[IQ] = 0 before the imbalance
+	m->iq_gain = ii > 0 ? sqrt(qq / ii) : 1.0;
+	m->iq_phase = ii > 0 && qq > 0 ? asin(iq / sqrt(ii * qq)) * 180.0 / M_PI : 0.0;
+	m->loop_gain_db = tx_ampl > 0 && ii > 0 ? 10.0 * log10(2.0 * ii / (tx_ampl * tx_ampl)) : 0.0;
+}
+
+void calib_corr_init(struct calib_corr *c, const struct calib_entry *e)
+{
+	double ph = e->iq_phase * M_PI / 180.0;
+
+	c->dc[0] = e->dc[0];
+	c->dc[1] = e->dc[1];
+	c->qq = 1.0 / (e->iq_gain * cos(ph));
+	c->qi = -tan(ph);
+}
+
+/* round to int16, saturating like tx_pack: a large correction can push a full scale sample past it */
+static int16_t cal_sample(float v)
+{
+	if (v > INT16_MAX) v = INT16_MAX;
+	if (v < INT16_MIN) v = INT16_MIN;
+	return (int16_t)lrintf(v);
+}
+
+void calib_apply(const struct calib_corr *c, int16_t *iq, size_t n)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		float i = iq[2*k] - c->dc[0];
+		float q = iq[2*k+1] - c->dc[1];
+		iq[2*k]   = cal_sample(i);
+		iq[2*k+1] = cal_sample(c->qq * q + c->qi * i);
+	}
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * calib.h - persistent RX calibration store
+ *
+ * Measured DC offset, IQ imbalance and loopback gain are kept per radio
+ * setting (LO, sample rate, RX gain and TX attenuation) in a text file,
+ * one line per setting, so a run can start with the corrections of the
+ * last ones instead of measuring them again.  New measurements are merged
+ * into the stored values as a running average over the last
+ * CALIB_MAX_WEIGHT runs, which follows slow drift.
+ *
+ * IQ imbalance model: the Q path has gain iq_gain relative to I and sees
+ * iq_phase of I, Q_rx = iq_gain * (Q cos(phase) + I sin(phase)).
+ **/
+
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CALIB_MAX_WEIGHT 8
+
+struct calib_key {
+	long long lo_hz;
+	long long fs_hz;
+	long long rx_gain;
+	long long tx_gain;
+};
+
+struct calib_entry {
+	struct calib_key key;
+	double dc[2];           // DC offset of I and Q in RX counts
+	double iq_gain;         // Q amplitude relative to I
+	double iq_phase;        // quadrature error in degrees
+	double loop_gain_db;    // RX over TX amplitude, both in full scale units
+	unsigned nmeas;         // runs merged into this entry
+	long long updated;      // unix time of the last merge
+};
+
+struct calib_db {
+	char *path;
+	struct calib_entry *e;
+	size_t n;
+	size_t cap;
+};
+
+/* a missing file gives an empty store, returns NULL on errors */
+struct calib_db *calib_load(const char *path);
+/* write the store back (to a temporary file renamed over it), 0 or -errno */
+int calib_save(const struct calib_db *db);
+void calib_close(struct calib_db *db);
+const struct calib_entry *calib_find(const struct calib_db *db, const struct calib_key *k);
+/* merge a measurement into the entry for its key, returns the merged entry */
+const struct calib_entry *calib_update(struct calib_db *db, const struct calib_entry *m);
+
+/* accumulated RX statistics for a measurement */
+struct calib_acc {
+	double sum[2];
+	double ii, qq, iq;
+	unsigned long long n;
+};
+
+void calib_acc_add(struct calib_acc *a, const int16_t *iq, size_t n);
+/*
+ * DC and IQ imbalance of the accumulated samples, which must be a
+ * circular signal (a complex tone, noise).  With the TX amplitude in RX
+ * counts the loopback gain is filled in too.
+ */
+void calib_acc_result(const struct calib_acc *a, double tx_ampl, struct calib_entry *m);
+
+/* RX correction stage, Q = qq * (Q - dc Q) + qi * (I - dc I) */
+struct calib_corr {
+	float dc[2];
+	float qq, qi;
+};
+
+void calib_corr_init(struct calib_corr *c, const struct calib_entry *e);
+/* correct n interleaved I/Q pairs in place */
+void calib_apply(const struct calib_corr *c, int16_t *iq, size_t n);
+
+#endif
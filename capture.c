@@ -0,0 +1,941 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * capture.c - writing received I/Q samples to disk
+ **/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "iqconv.h"
+
+static const char *fmt_names[CAP_NFMT] = {
+	[CAP_CSV] = "csv",
+	[CAP_RAW] = "raw",
+	[CAP_CHUNK] = "chunk",
+	[CAP_BFP] = "bfp",
+	[CAP_F16] = "f16",
+};
+
+const char *capture_fmt_name(enum capture_fmt fmt)
+{
+	return fmt_names[fmt];
+}
+
+int capture_fmt_parse(const char *name, enum capture_fmt *fmt)
+{
+	size_t k;
+
+	for (k = 0; k < CAP_NFMT; k++) {
+		if (fmt_names[k] && !strcmp(fmt_names[k], name)) {
+			*fmt = (enum capture_fmt)k;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+/* the error of a failed write, a short fwrite need not set errno */
+static int io_err(void)
+{
+	return errno ? -errno : -EIO;
+}
+
+/* close f, 0 or a negative errno if it or an earlier write failed */
+static int file_close(FILE *f)
+{
+	int bad = ferror(f);
+
+	errno = 0;
+	if (fclose(f))
+		return io_err();
+	return bad ? -EIO : 0;
+}
+
+static int crc_open(struct crc_index *x, const char *path, enum capture_fmt fmt)
+{
+	struct crc_header h = { { 'I', 'Q', 'C', 'R' }, 1, CRC_BLOCK, fmt, 0 };
+	char name[PATH_MAX];
+
+	snprintf(name, sizeof(name), "%s.crc", path);
+	x->f = fopen(name, "w+b");
+	if (!x->f)
+		return -errno;
+	errno = 0;
+	if (fwrite(&h, sizeof(h), 1, x->f) != 1)
+		return io_err();
+	return 0;
+}
+
+static int crc_emit(struct crc_index *x)
+{
+	// one entry per block, flushed so a capture that dies keeps its index
+	errno = 0;
+	if (fwrite(&x->crc, sizeof(x->crc), 1, x->f) != 1 || fflush(x->f))
+		return io_err();
+	x->crc = 0;
+	x->fill = 0;
+	return 0;
+}
+
+static int crc_close(struct crc_index *x)
+{
+	int ret = 0, cret;
+
+	if (!x->f)
+		return 0;
+	if (x->fill)
+		ret = crc_emit(x);
+	// the length goes into the header now that it is known
+	errno = 0;
+	if ((fseeko(x->f, offsetof(struct crc_header, length), SEEK_SET) ||
+	     fwrite(&x->length, sizeof(x->length), 1, x->f) != 1) && !ret)
+		ret = io_err();
+	cret = file_close(x->f);
+	return ret ? ret : cret;
+}
+
+/* append len bytes to the capture file and checksum them */
+static int cap_put(struct capture *c, const void *buf, size_t len)
+{
+	struct crc_index *x = &c->crc;
+	const char *p = buf;
+	int ret;
+
+	errno = 0;
+	if (fwrite(buf, 1, len, c->f) != len)
+		return io_err();
+	x->length += len;
+	while (len) {
+		size_t take = CRC_BLOCK - x->fill;
+		if (take > len)
+			take = len;
+		x->crc = crc32c(x->crc, p, take);
+		x->fill += take;
+		p += take;
+		len -= take;
+		if (x->fill == CRC_BLOCK && (ret = crc_emit(x)) < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static void level_path(char *buf, size_t len, const char *path, int level)
+{
+	snprintf(buf, len, "%s.ovr%d", path, level);
+}
+
+static void acc_reset(struct pyr_acc *a)
+{
+	a->min[0] = a->min[1] = INT32_MAX;
+	a->max[0] = a->max[1] = INT32_MIN;
+	a->sum[0] = a->sum[1] = 0;
+	a->cnt = 0;
+	a->parts = 0;
+}
+
+static struct pyramid *pyramid_open(const char *path, enum capture_fmt fmt)
+{
+	struct pyramid *p = calloc(1, sizeof(*p));
+	char name[PATH_MAX];
+	uint32_t per = PYR_BASE;
+	int l;
+
+	if (!p)
+		return NULL;
+	for (l = 0; l < PYR_LEVELS; l++, per *= PYR_FANOUT) {
+		struct pyr_header h = { { 'I', 'Q', 'O', 'V' }, 1, l + 1, per, fmt };
+
+		level_path(name, sizeof(name), path, l + 1);
+		p->f[l] = fopen(name, "w+");
+		if (!p->f[l] || fwrite(&h, sizeof(h), 1, p->f[l]) != 1) {
+			while (l >= 0) {
+				if (p->f[l]) { fclose(p->f[l]); }
+				l--;
+			}
+			free(p);
+			return NULL;
+		}
+		acc_reset(&p->acc[l]);
+	}
+	return p;
+}
+
+/* close the current entry of level l and fold it into level l+1 */
+static void pyramid_emit(struct pyramid *p, int l)
+{
+	struct pyr_acc *a = &p->acc[l];
+	struct pyr_entry e;
+	int c;
+
+	for (c = 0; c < 2; c++) {
+		e.min[c] = a->min[c];
+		e.max[c] = a->max[c];
+		e.mean[c] = (int16_t)lround((double)a->sum[c] / (double)a->cnt);
+	}
+	fwrite(&e, sizeof(e), 1, p->f[l]);
+
+	if (l + 1 < PYR_LEVELS) {
+		struct pyr_acc *up = &p->acc[l + 1];
+		for (c = 0; c < 2; c++) {
+			if (a->min[c] < up->min[c]) up->min[c] = a->min[c];
+			if (a->max[c] > up->max[c]) up->max[c] = a->max[c];
+			up->sum[c] += a->sum[c];
+		}
+		up->cnt += a->cnt;
+		if (++up->parts == PYR_FANOUT)
+			pyramid_emit(p, l + 1);
+	}
+	acc_reset(a);
+}
+
+static void pyramid_update(struct pyramid *p, const int16_t *iq, size_t n)
+{
+	struct pyr_acc *a = &p->acc[0];
+
+	while (n) {
+		size_t take = PYR_BASE - a->parts, s;
+		int32_t mn0 = a->min[0], mx0 = a->max[0], mn1 = a->min[1], mx1 = a->max[1];
+		int64_t s0 = 0, s1 = 0;
+
+		if (take > n)
+			take = n;
+		for (s = 0; s < take; s++) {
+			int32_t i = iq[2*s], q = iq[2*s+1];
+			mn0 = i < mn0 ? i : mn0;
+			mx0 = i > mx0 ? i : mx0;
+			mn1 = q < mn1 ? q : mn1;
+			mx1 = q > mx1 ? q : mx1;
+			s0 += i;
+			s1 += q;
+		}
+		a->min[0] = mn0; a->max[0] = mx0;
+		a->min[1] = mn1; a->max[1] = mx1;
+		a->sum[0] += s0; a->sum[1] += s1;
+		a->cnt += take;
+		a->parts += take;
+		p->nsamp += take;
+		iq += 2 * take;
+		n -= take;
+
+		if (a->parts == PYR_BASE)
+			pyramid_emit(p, 0);
+	}
+}
+
+/* entry writes are not checked one by one, a failure shows at close */
+static int pyramid_close(struct pyramid *p)
+{
+	int ret = 0, cret;
+	int l;
+
+	// flush partially filled entries from the bottom up so the tail of the capture is covered
+	for (l = 0; l < PYR_LEVELS; l++) {
+		if (p->acc[l].cnt)
+			pyramid_emit(p, l);
+		// the sample count tells readers how much the last entry covers
+		errno = 0;
+		if ((fseeko(p->f[l], offsetof(struct pyr_header, nsamp), SEEK_SET) ||
+		     fwrite(&p->nsamp, sizeof(p->nsamp), 1, p->f[l]) != 1) && !ret)
+			ret = io_err();
+		cret = file_close(p->f[l]);
+		if (!ret)
+			ret = cret;
+	}
+	free(p);
+	return ret;
+}
+
+/* write out the open chunk, end is the capture index just past its last sample */
+static int chunk_flush(struct capture *c, uint64_t end)
+{
+	struct chunk_header h = { { 'C', 'H', 'N', 'K' } };
+	int64_t sum[2] = { 0, 0 };
+	double pwr = 0;
+	int32_t peak = 0;
+	size_t s;
+	int ret;
+	int ch;
+
+	if (!c->fill)
+		return 0;
+
+	for (ch = 0; ch < 2; ch++) {
+		const int16_t *x = c->col[ch];
+		int64_t sq = 0;
+		for (s = 0; s < c->fill; s++) {
+			int32_t v = x[s], a = v < 0 ? -v : v;
+			sum[ch] += v;
+			sq += v * v;
+			peak = a > peak ? a : peak;
+		}
+		pwr += (double)sq;
+		h.dc[ch] = (float)((double)sum[ch] / (double)c->fill);
+	}
+	for (s = 0; s < c->fill; s++)
+		h.clips += abs(c->col[0][s]) >= CLIP_LEVEL || abs(c->col[1][s]) >= CLIP_LEVEL;
+
+	h.nsamp = c->fill;
+	h.first = end - c->fill;
+	h.rms = (float)sqrt(pwr / (double)c->fill);
+	h.peak = peak > INT16_MAX ? INT16_MAX : peak;
+
+	if ((ret = cap_put(c, &h, sizeof(h))) < 0 ||
+	    (ret = cap_put(c, c->col[0], c->fill * sizeof(int16_t))) < 0 ||
+	    (ret = cap_put(c, c->col[1], c->fill * sizeof(int16_t))) < 0)
+		return ret;
+	c->fill = 0;
+	return 0;
+}
+
+static int chunk_write(struct capture *c, const int16_t *iq, size_t n)
+{
+	uint64_t pos = c->nsamp;
+
+	while (n) {
+		size_t take = CHUNK_LEN - c->fill, s;
+		int ret;
+
+		if (take > n)
+			take = n;
+		// split the interleaved samples into columns
+		for (s = 0; s < take; s++) {
+			c->col[0][c->fill + s] = iq[2*s];
+			c->col[1][c->fill + s] = iq[2*s+1];
+		}
+		c->fill += take;
+		pos += take;
+		iq += 2 * take;
+		n -= take;
+
+		if (c->fill == CHUNK_LEN && (ret = chunk_flush(c, pos)) < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static int chunk_open(struct capture *c)
+{
+	struct chunk_file_header h = { { 'I', 'Q', 'C', 'K' }, 1, CHUNK_LEN, 0 };
+
+	c->col[0] = malloc(CHUNK_LEN * sizeof(int16_t));
+	c->col[1] = malloc(CHUNK_LEN * sizeof(int16_t));
+	if (!c->col[0] || !c->col[1])
+		return -ENOMEM;
+	return cap_put(c, &h, sizeof(h));
+}
+
+static void bfp_stats_add(struct bfp_stats *st, double sqnr)
+{
+	if (!st->nblocks || sqnr < st->sqnr_min)
+		st->sqnr_min = sqnr;
+	st->sqnr_sum += sqnr;
+	st->nblocks++;
+}
+
+static int bfp_flush(struct capture *c)
+{
+	struct bfp_block_header h = { 0 };
+	int8_t mant[2 * BFP_BLOCK];
+	int16_t dec[2 * BFP_BLOCK];
+	size_t nval = 2 * c->fill;
+	double sqnr;
+	int ret;
+
+	if (!c->fill)
+		return 0;
+
+	h.exp = bfp_encode(c->blk, nval, mant);
+	h.nsamp = c->fill;
+	bfp_decode(mant, nval, h.exp, dec);
+	sqnr = sqnr_db(c->blk, dec, nval);
+	h.sqnr_cdb = (int16_t)lround(sqnr * 100.0);
+	bfp_stats_add(&c->bfp, sqnr);
+
+	if ((ret = cap_put(c, &h, sizeof(h))) < 0 || (ret = cap_put(c, mant, nval)) < 0)
+		return ret;
+	c->fill = 0;
+	return 0;
+}
+
+static int bfp_write(struct capture *c, const int16_t *iq, size_t n)
+{
+	while (n) {
+		size_t take = BFP_BLOCK - c->fill;
+		int ret;
+
+		if (take > n)
+			take = n;
+		memcpy(c->blk + 2 * c->fill, iq, 2 * take * sizeof(*iq));
+		c->fill += take;
+		iq += 2 * take;
+		n -= take;
+
+		if (c->fill == BFP_BLOCK && (ret = bfp_flush(c)) < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static int bfp_open(struct capture *c)
+{
+	struct bfp_file_header h = { { 'I', 'Q', 'B', 'F' }, 1, BFP_BLOCK, BFP_MANT_BITS };
+
+	c->blk = malloc(2 * BFP_BLOCK * sizeof(int16_t));
+	if (!c->blk)
+		return -ENOMEM;
+	return cap_put(c, &h, sizeof(h));
+}
+
+static int f16_write(struct capture *c, const int16_t *iq, size_t n)
+{
+	if (n > c->half_len) {
+		uint16_t *h = realloc(c->half, 2 * n * sizeof(*h));
+		if (!h)
+			return -ENOMEM;
+		c->half = h;
+		c->half_len = n;
+	}
+	s16_to_f16(iq, 2 * n, c->half);
+	return cap_put(c, c->half, 2 * n * sizeof(*c->half));
+}
+
+size_t capture_f16_read(FILE *f, float *iq, size_t n)
+{
+	uint16_t h[2 * 1024];
+	size_t total = 0;
+
+	while (total < n) {
+		size_t want = n - total, got;
+		if (want > 1024)
+			want = 1024;
+		got = fread(h, 2 * sizeof(*h), want, f);
+		f16_to_f32(h, 2 * got, iq + 2 * total);
+		total += got;
+		if (got < want)
+			break;
+	}
+	return total;
+}
+
+struct capture *capture_open(const char *path, enum capture_fmt fmt, bool overview)
+{
+	struct capture *c = calloc(1, sizeof(*c));
+
+	if (!c)
+		return NULL;
+	c->fmt = fmt;
+	c->f = fopen(path, fmt == CAP_CSV ? "w+" : "w+b");
+	if (!c->f) {
+		free(c);
+		return NULL;
+	}
+	if (crc_open(&c->crc, path, fmt) < 0)
+		goto err;
+	if (fmt == CAP_CHUNK && chunk_open(c) < 0)
+		goto err;
+	if (fmt == CAP_BFP && bfp_open(c) < 0)
+		goto err;
+	if (overview) {
+		c->pyr = pyramid_open(path, fmt);
+		if (!c->pyr)
+			goto err;
+	}
+	return c;
+
+err:
+	free(c->col[0]);
+	free(c->col[1]);
+	free(c->blk);
+	if (c->crc.f)
+		fclose(c->crc.f);
+	fclose(c->f);
+	free(c);
+	return NULL;
+}
+
+int capture_write(struct capture *c, const int16_t *iq, size_t n)
+{
+	size_t s;
+	int ret;
+
+	switch (c->fmt) {
+	case CAP_CSV:
+		for (s = 0; s < n; s++) {
+			const int16_t i = iq[2*s], q = iq[2*s+1];
+			char line[64];
+			int len = snprintf(line, sizeof(line), "%d, %d, %.4f, %.4f\n", i, q, (double)sqrt((i*i)+(q*q)), (180/M_PI)*atan((double)q/(double)i));
+			if ((ret = cap_put(c, line, len)) < 0)
+				return ret;
+		}
+		break;
+	case CAP_RAW:
+		if ((ret = cap_put(c, iq, n * 2 * sizeof(*iq))) < 0)
+			return ret;
+		break;
+	case CAP_CHUNK:
+		ret = chunk_write(c, iq, n);
+		if (ret < 0)
+			return ret;
+		break;
+	case CAP_BFP:
+		ret = bfp_write(c, iq, n);
+		if (ret < 0)
+			return ret;
+		break;
+	case CAP_F16:
+		ret = f16_write(c, iq, n);
+		if (ret < 0)
+			return ret;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (c->pyr)
+		pyramid_update(c->pyr, iq, n);
+	c->nsamp += n;
+	return 0;
+}
+
+int capture_close(struct capture *c)
+{
+	int ret = 0, r;
+
+	if (!c)
+		return 0;
+	if (c->fmt == CAP_CHUNK) {
+		ret = chunk_flush(c, c->nsamp);
+		free(c->col[0]);
+		free(c->col[1]);
+	}
+	if (c->fmt == CAP_BFP) {
+		ret = bfp_flush(c);
+		free(c->blk);
+	}
+	if (c->pyr && (r = pyramid_close(c->pyr)) < 0 && !ret)
+		ret = r;
+	free(c->half);
+	if ((r = crc_close(&c->crc)) < 0 && !ret)
+		ret = r;
+	if ((r = file_close(c->f)) < 0 && !ret)
+		ret = r;
+	free(c);
+	return ret;
+}
+
+int capture_chunk_query(const char *path, const struct chunk_filter *filter,
+			void (*fn)(const struct chunk_header *h, void *arg), void *arg)
+{
+	struct chunk_file_header fh;
+	struct chunk_header h;
+	FILE *f = fopen(path, "rb");
+	int nmatch = 0;
+
+	if (!f)
+		return -errno;
+	if (fread(&fh, sizeof(fh), 1, f) != 1 || memcmp(fh.magic, "IQCK", 4)) {
+		fclose(f);
+		return -EINVAL;
+	}
+
+	while (fread(&h, sizeof(h), 1, f) == 1) {
+		if (memcmp(h.magic, "CHNK", 4)) {
+			nmatch = -EINVAL;
+			break;
+		}
+		if (h.peak > filter->peak_above && h.rms > filter->rms_above &&
+		    h.clips >= filter->min_clips) {
+			fn(&h, arg);
+			nmatch++;
+		}
+		// skip the sample columns, only the headers are looked at
+		if (fseeko(f, (off_t)h.nsamp * 2 * sizeof(int16_t), SEEK_CUR)) {
+			nmatch = -errno;
+			break;
+		}
+	}
+	fclose(f);
+	return nmatch;
+}
+
+static void bin_fold(struct pyr_acc *b, const struct pyr_entry *e, uint64_t weight)
+{
+	int c;
+
+	for (c = 0; c < 2; c++) {
+		if (e->min[c] < b->min[c]) b->min[c] = e->min[c];
+		if (e->max[c] > b->max[c]) b->max[c] = e->max[c];
+		b->sum[c] += (int64_t)e->mean[c] * (int64_t)weight;
+	}
+	b->cnt += weight;
+}
+
+static int bins_finish(struct pyr_acc *acc, struct pyr_entry *bins, size_t width)
+{
+	size_t b;
+	int c, nb = 0;
+
+	for (b = 0; b < width; b++) {
+		if (!acc[b].cnt)
+			continue;
+		for (c = 0; c < 2; c++) {
+			bins[nb].min[c] = acc[b].min[c];
+			bins[nb].max[c] = acc[b].max[c];
+			bins[nb].mean[c] = (int16_t)lround((double)acc[b].sum[c] / (double)acc[b].cnt);
+		}
+		nb++;
+	}
+	return nb;
+}
+
+/* an overview being read: the range, its bins and the files it reads */
+struct overview {
+	const char *path;
+	uint64_t first, count;  // count clipped to the end of the capture
+	uint64_t nsamp;         // samples in the capture
+	size_t width;
+	struct pyr_acc *acc;
+	FILE *f[PYR_LEVELS + 1]; // level files by level, opened when needed
+	FILE *raw;              // the capture itself when it is CAP_RAW
+};
+
+static uint64_t ov_bin(const struct overview *o, uint64_t s)
+{
+	return (s - o->first) * o->width / o->count;
+}
+
+/* first sample of bin b + 1 */
+static uint64_t ov_bin_end(const struct overview *o, uint64_t b)
+{
+	return o->first + ((b + 1) * o->count + o->width - 1) / o->width;
+}
+
+static FILE *ov_level(struct overview *o, int l, struct pyr_header *h)
+{
+	char name[PATH_MAX];
+
+	if (!o->f[l]) {
+		level_path(name, sizeof(name), o->path, l);
+		o->f[l] = fopen(name, "rb");
+		if (!o->f[l])
+			return NULL;
+	}
+	if (fseeko(o->f[l], 0, SEEK_SET) || fread(h, sizeof(*h), 1, o->f[l]) != 1 ||
+	    memcmp(h->magic, "IQOV", 4)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return o->f[l];
+}
+
+/* the raw samples [lo, hi) one by one */
+static int ov_fold_raw(struct overview *o, uint64_t lo, uint64_t hi)
+{
+	int16_t iq[2];
+
+	if (fseeko(o->raw, (off_t)(lo * sizeof(iq)), SEEK_SET))
+		return -errno;
+	for (; lo < hi && fread(iq, sizeof(iq), 1, o->raw) == 1; lo++) {
+		struct pyr_entry e = { { iq[0], iq[1] }, { iq[0], iq[1] }, { iq[0], iq[1] } };
+		bin_fold(&o->acc[ov_bin(o, lo)], &e, 1);
+	}
+	return 0;
+}
+
+/*
+ * fold the samples [lo, hi) into the bins from the entries of level l.  An
+ * entry that is not wholly inside one bin is taken from the level below,
+ * at level 1 from the samples of a raw capture, or else split over the
+ * bins by the samples it covers in each.  Entries missing because the
+ * capture was not closed are looked for further down too.
+ */
+static int ov_fold(struct overview *o, int l, uint64_t lo, uint64_t hi)
+{
+	struct pyr_header h;
+	struct pyr_entry e;
+	uint64_t per, idx;
+	FILE *f = ov_level(o, l, &h);
+	int ret;
+
+	if (!f)
+		return -errno;
+	per = h.per_entry;
+	idx = lo / per;
+	if (fseeko(f, (off_t)(sizeof(h) + idx * sizeof(e)), SEEK_SET))
+		return -errno;
+	for (; idx * per < hi; idx++) {
+		uint64_t s = idx * per < lo ? lo : idx * per;
+		uint64_t t = (idx + 1) * per < hi ? (idx + 1) * per : hi;
+		uint64_t b = ov_bin(o, s), whole = (idx + 1) * per < o->nsamp ? (idx + 1) * per : o->nsamp;
+
+		if (fread(&e, sizeof(e), 1, f) != 1)
+			return l > 1 ? ov_fold(o, l - 1, s, hi) : 0;
+		if (s == idx * per && t == whole && ov_bin(o, t - 1) == b) {
+			bin_fold(&o->acc[b], &e, t - s);
+			continue;
+		}
+		if (l > 1 || o->raw) {
+			ret = l > 1 ? ov_fold(o, l - 1, s, t) : ov_fold_raw(o, s, t);
+			if (ret)
+				return ret;
+			// the level below moved its own file only
+			continue;
+		}
+		while (s < t) {
+			uint64_t next = ov_bin_end(o, b);
+
+			if (next > t)
+				next = t;
+			bin_fold(&o->acc[b], &e, next - s);
+			s = next;
+			b++;
+		}
+	}
+	return 0;
+}
+
+int capture_overview(const char *path, uint64_t first, uint64_t count,
+		     struct pyr_entry *bins, size_t width)
+{
+	struct overview o = { path };
+	struct pyr_header h;
+	uint64_t spp, per = PYR_BASE, b;
+	FILE *f;
+	int l, ret = 0;
+
+	if (!width || !count)
+		return -EINVAL;
+
+	// a capture that was not closed has no count, level 1 has all the whole entries then
+	f = ov_level(&o, 1, &h);
+	if (!f) {
+		ret = -errno;
+		goto out;
+	}
+	o.nsamp = h.nsamp;
+	if (!o.nsamp) {
+		if (fseeko(f, 0, SEEK_END)) {
+			ret = -errno;
+			goto out;
+		}
+		o.nsamp = (ftello(f) - sizeof(h)) / sizeof(struct pyr_entry) * PYR_BASE;
+	}
+
+	// bins over the part of the range that is in the capture, at least a sample each
+	if (first >= o.nsamp)
+		goto out;
+	if (count > o.nsamp - first)
+		count = o.nsamp - first;
+	if (width > count)
+		width = count;
+	o.first = first;
+	o.count = count;
+	o.width = width;
+	spp = count / width;
+
+	o.acc = malloc(width * sizeof(*o.acc));
+	if (!o.acc) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (b = 0; b < width; b++)
+		acc_reset(&o.acc[b]);
+	if (h.fmt == CAP_RAW && !(o.raw = fopen(path, "rb"))) {
+		ret = -errno;
+		goto out;
+	}
+
+	// coarsest level that still gives at least one entry per bin
+	for (l = 1; l < PYR_LEVELS && per * PYR_FANOUT <= spp; l++)
+		per *= PYR_FANOUT;
+	if (spp < PYR_BASE && o.raw)
+		ret = ov_fold_raw(&o, first, first + count);
+	else
+		ret = ov_fold(&o, l, first, first + count);
+
+out:
+	for (l = 1; l <= PYR_LEVELS; l++)
+		if (o.f[l])
+			fclose(o.f[l]);
+	if (o.raw)
+		fclose(o.raw);
+	if (!ret && o.acc)
+		ret = bins_finish(o.acc, bins, o.width);
+	free(o.acc);
+	return ret;
+}
+
+int capture_bfp_decode(const char *path, FILE *out, struct bfp_stats *st)
+{
+	struct bfp_file_header fh;
+	struct bfp_block_header h;
+	int8_t mant[2 * BFP_BLOCK];
+	int16_t iq[2 * BFP_BLOCK];
+	FILE *f = fopen(path, "rb");
+	int ret = 0;
+
+	if (!f)
+		return -errno;
+	memset(st, 0, sizeof(*st));
+	if (fread(&fh, sizeof(fh), 1, f) != 1 || memcmp(fh.magic, "IQBF", 4) ||
+	    fh.block_len > BFP_BLOCK || fh.mant_bits != BFP_MANT_BITS) {
+		fclose(f);
+		return -EINVAL;
+	}
+
+	while (fread(&h, sizeof(h), 1, f) == 1) {
+		size_t nval = 2 * (size_t)h.nsamp;
+
+		if (h.nsamp > fh.block_len || fread(mant, 1, nval, f) != nval) {
+			ret = -EINVAL;
+			break;
+		}
+		bfp_decode(mant, nval, h.exp, iq);
+		bfp_stats_add(st, h.sqnr_cdb / 100.0);
+		if (out && fwrite(iq, sizeof(int16_t), nval, out) != nval) {
+			ret = -errno;
+			break;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+/* blocks are handed out to the verify threads through a shared counter */
+struct verify_job {
+	int fd;
+	uint64_t nblocks;
+	uint64_t length;
+	const uint32_t *crc;
+	uint8_t *bad;
+	atomic_uint_fast64_t next;
+	atomic_int err;            // any thread may fail, the last error is kept
+};
+
+static void *verify_thread(void *arg)
+{
+	struct verify_job *j = arg;
+	uint8_t *buf = malloc(CRC_BLOCK);
+	uint64_t b;
+
+	if (!buf) {
+		atomic_store(&j->err, -ENOMEM);
+		return NULL;
+	}
+	while ((b = atomic_fetch_add(&j->next, 1)) < j->nblocks) {
+		off_t off = (off_t)b * CRC_BLOCK;
+		size_t len = j->length - off < CRC_BLOCK ? j->length - off : CRC_BLOCK;
+		ssize_t got = pread(j->fd, buf, len, off);
+
+		if (got < 0) {
+			atomic_store(&j->err, -errno);
+			break;
+		}
+		j->bad[b] = (size_t)got != len || crc32c(0, buf, len) != j->crc[b];
+	}
+	free(buf);
+	return NULL;
+}
+
+int capture_verify(const char *path, unsigned nthreads,
+		   void (*fn)(uint64_t block, uint64_t offset, uint32_t len, void *arg), void *arg,
+		   struct crc_header *hdr)
+{
+	struct verify_job j = { .fd = -1 };
+	pthread_t th[64];
+	char name[PATH_MAX];
+	uint32_t *crc = NULL;
+	struct stat st;
+	unsigned t, started = 0;
+	uint64_t b;
+	int nbad = 0, ret = 0;
+	bool unclosed = false;
+	FILE *f;
+
+	snprintf(name, sizeof(name), "%s.crc", path);
+	f = fopen(name, "rb");
+	if (!f)
+		return -errno;
+	if (fread(hdr, sizeof(*hdr), 1, f) != 1 || memcmp(hdr->magic, "IQCR", 4) ||
+	    hdr->block_len != CRC_BLOCK) {
+		fclose(f);
+		return -EINVAL;
+	}
+	// an index that was not closed has no length, its whole blocks are what can be checked
+	if (!hdr->length) {
+		off_t end;
+		if (fseeko(f, 0, SEEK_END) || (end = ftello(f)) < 0 || fseeko(f, sizeof(*hdr), SEEK_SET)) {
+			ret = -errno;
+			fclose(f);
+			return ret;
+		}
+		hdr->length = (uint64_t)(end - sizeof(*hdr)) / sizeof(*crc) * CRC_BLOCK;
+		unclosed = true;
+	}
+	j.length = hdr->length;
+	j.nblocks = (hdr->length + CRC_BLOCK - 1) / CRC_BLOCK;
+	crc = malloc(j.nblocks * sizeof(*crc) + 1);
+	j.bad = calloc(j.nblocks + 1, 1);
+	if (!crc || !j.bad) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (fread(crc, sizeof(*crc), j.nblocks, f) != j.nblocks) {
+		ret = -EINVAL;
+		goto out;
+	}
+	j.crc = crc;
+	j.fd = open(path, O_RDONLY);
+	if (j.fd < 0 || fstat(j.fd, &st)) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > sizeof(th) / sizeof(th[0]))
+		nthreads = sizeof(th) / sizeof(th[0]);
+	atomic_init(&j.next, 0);
+	atomic_init(&j.err, 0);
+	for (t = 0; t < nthreads; t++, started++)
+		if (pthread_create(&th[t], NULL, verify_thread, &j))
+			break;
+	if (!started)
+		verify_thread(&j);
+	for (t = 0; t < started; t++)
+		pthread_join(th[t], NULL);
+	if ((ret = atomic_load(&j.err)))
+		goto out;
+
+	for (b = 0; b < j.nblocks; b++) {
+		if (!j.bad[b])
+			continue;
+		nbad++;
+		if (fn)
+			fn(b, b * CRC_BLOCK, j.length - b * CRC_BLOCK < CRC_BLOCK ? j.length - b * CRC_BLOCK : CRC_BLOCK, arg);
+	}
+	// bytes appended after the capture was closed
+	if ((uint64_t)st.st_size > j.length && !unclosed) {
+		nbad++;
+		if (fn)
+			fn(j.nblocks, j.length, (uint32_t)(st.st_size - j.length), arg);
+	}
+	ret = nbad;
+
+out:
+	if (j.fd >= 0)
+		close(j.fd);
+	fclose(f);
+	free(crc);
+	free(j.bad);
+	return ret;
+}
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * capture.h - writing received I/Q samples to disk
+ *
+ * A capture is the sample file itself plus, optionally, an overview
+ * pyramid: min/max/mean of I and Q over 64 samples, 512 samples, 4096
+ * samples and so on, one file per level next to the capture
+ * (output.iq.ovr1, output.iq.ovr2, ...).  A viewer can draw any time range
+ * at any zoom from the level whose entries are about one pixel wide.
+ *
+ * The chunk format stores the samples as I and Q columns in chunks of
+ * CHUNK_LEN samples, each preceded by a header with the statistics of the
+ * chunk, so searches only have to read the headers.
+ *
+ * The bfp format is lossy: blocks of BFP_BLOCK samples share an exponent
+ * and keep 8 bit mantissas, about half the size of raw.  Every block
+ * header records the SQNR of that block.
+ *
+ * The f16 format is interleaved IEEE half precision I/Q scaled to [-1, 1),
+ * the same size as raw but directly usable as floats.
+ *
+ * Every capture also gets a checksum index, <capture>.crc, with the
+ * CRC32C of each CRC_BLOCK bytes of the capture file so copies can be
+ * verified block by block.
+ **/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum capture_fmt {
+	CAP_CSV,  // I, Q, amplitude, phase in degrees, one sample per line
+	CAP_RAW,  // interleaved little endian int16 I/Q, no header
+	CAP_CHUNK, // chunked columns with per chunk statistics
+	CAP_BFP,  // block floating point, 8 bit mantissas
+	CAP_F16,  // interleaved half precision I/Q, no header
+	CAP_NFMT
+};
+
+#define PYR_BASE   64  // samples per entry in level 1
+#define PYR_FANOUT 8   // entries of level k per entry of level k+1
+#define PYR_LEVELS 8
+
+/* one overview entry, index 0 is I and 1 is Q */
+struct pyr_entry {
+	int16_t min[2];
+	int16_t max[2];
+	int16_t mean[2];
+};
+
+/* overview level file header */
+struct pyr_header {
+	char magic[4];          // "IQOV"
+	uint32_t version;
+	uint32_t level;
+	uint32_t per_entry;     // samples summarized by one entry
+	uint32_t fmt;           // enum capture_fmt of the capture it describes
+	uint32_t pad;
+	uint64_t nsamp;         // samples in the capture, 0 until it is closed
+};
+
+#define CHUNK_LEN   65536 // samples per chunk
+#define CLIP_LEVEL  2047  // RX samples are 12 bit, sign extended
+
+/* chunk container file header */
+struct chunk_file_header {
+	char magic[4];          // "IQCK"
+	uint32_t version;
+	uint32_t chunk_len;     // samples per full chunk
+	uint32_t reserved;
+};
+
+/* header in front of every chunk, followed by nsamp I then nsamp Q */
+struct chunk_header {
+	char magic[4];          // "CHNK"
+	uint32_t nsamp;
+	uint64_t first;         // index of the first sample in the capture
+	float rms;              // sqrt(mean(I^2 + Q^2))
+	float dc[2];            // mean I and Q
+	int16_t peak;           // largest |I| or |Q|
+	uint16_t reserved;
+	uint32_t clips;         // samples with |I| or |Q| at CLIP_LEVEL
+	uint32_t pad;
+};
+
+#define BFP_BLOCK   128   // samples sharing one exponent
+
+/* bfp file header */
+struct bfp_file_header {
+	char magic[4];          // "IQBF"
+	uint32_t version;
+	uint32_t block_len;     // samples per full block
+	uint32_t mant_bits;
+};
+
+/* in front of every block, followed by 2 * nsamp int8 mantissas */
+struct bfp_block_header {
+	uint8_t exp;
+	uint8_t reserved;
+	uint16_t nsamp;
+	int16_t sqnr_cdb;       // SQNR of the block in 0.01 dB
+} __attribute__((packed));
+
+/* SQNR summary over the blocks of a bfp capture */
+struct bfp_stats {
+	uint64_t nblocks;
+	double sqnr_min;
+	double sqnr_sum;
+};
+
+#define CRC_BLOCK   (1 << 20) // capture bytes per checksum
+
+/* checksum index header, followed by one uint32_t CRC32C per block */
+struct crc_header {
+	char magic[4];          // "IQCR"
+	uint32_t version;
+	uint32_t block_len;     // bytes per block, the last one may be shorter
+	uint32_t fmt;           // enum capture_fmt
+	uint64_t length;        // capture bytes covered, filled in on close
+};
+
+struct crc_index {
+	FILE *f;
+	uint32_t crc;           // of the open block
+	uint32_t fill;          // bytes in the open block
+	uint64_t length;
+};
+
+struct pyr_acc {
+	int32_t min[2], max[2];
+	int64_t sum[2];
+	uint64_t cnt;           // samples folded in so far
+	unsigned parts;         // entries (or samples for level 1) folded in
+};
+
+struct pyramid {
+	FILE *f[PYR_LEVELS];
+	struct pyr_acc acc[PYR_LEVELS];
+	uint64_t nsamp;
+};
+
+struct capture {
+	enum capture_fmt fmt;
+	FILE *f;
+	struct pyramid *pyr;    // NULL when no overview is kept
+	uint64_t nsamp;
+	int16_t *col[2];        // CAP_CHUNK: I and Q columns of the open chunk
+	int16_t *blk;           // CAP_BFP: interleaved samples of the open block
+	uint16_t *half;         // CAP_F16: conversion buffer of half_len samples
+	size_t half_len;
+	size_t fill;
+	struct bfp_stats bfp;
+	struct crc_index crc;
+};
+
+/* chunk selection for capture_chunk_query, a chunk matches if all hold */
+struct chunk_filter {
+	int peak_above;         // -1 for any
+	double rms_above;       // < 0 for any
+	uint32_t min_clips;
+};
+
+const char *capture_fmt_name(enum capture_fmt fmt);
+int capture_fmt_parse(const char *name, enum capture_fmt *fmt);
+
+struct capture *capture_open(const char *path, enum capture_fmt fmt, bool overview);
+/* append n interleaved I/Q samples, returns 0 or a negative errno */
+int capture_write(struct capture *c, const int16_t *iq, size_t n);
+/* flush and close, returns 0 or the first negative errno (e.g. -ENOSPC) */
+int capture_close(struct capture *c);
+
+/*
+ * summarize samples [first, first + count) of a capture into width bins
+ * using the overview pyramid (or the raw samples when zoomed in further
+ * than level 1 and the capture is CAP_RAW).  The range is cut at the end
+ * of the capture and width at one bin per sample.  Returns the number of
+ * bins filled or a negative errno.
+ */
+int capture_overview(const char *path, uint64_t first, uint64_t count,
+		     struct pyr_entry *bins, size_t width);
+
+/*
+ * call fn for every chunk of a CAP_CHUNK capture that matches filter,
+ * reading only the chunk headers.  Returns the number of matches or a
+ * negative errno.
+ */
+int capture_chunk_query(const char *path, const struct chunk_filter *filter,
+			void (*fn)(const struct chunk_header *h, void *arg), void *arg);
+
+/*
+ * decode a CAP_BFP capture to interleaved int16 I/Q on out and collect the
+ * block SQNR statistics.  Returns 0 or a negative errno.
+ */
+int capture_bfp_decode(const char *path, FILE *out, struct bfp_stats *st);
+
+/*
+ * check every block of a capture against its checksum index, with
+ * nthreads threads reading blocks in parallel.  fn is called for every
+ * block that does not match, in order.  Returns the number of bad blocks
+ * (a capture of the wrong length counts its missing or extra tail as
+ * one) or a negative errno.  The index of a capture that was not closed
+ * has no length: its whole blocks are checked, hdr->length is set to what
+ * they cover and the bytes after them are not looked at.
+ */
+int capture_verify(const char *path, unsigned nthreads,
+		   void (*fn)(uint64_t block, uint64_t offset, uint32_t len, void *arg), void *arg,
+		   struct crc_header *hdr);
+
+/* read up to n samples of a CAP_F16 capture as float I/Q, returns samples read */
+size_t capture_f16_read(FILE *f, float *iq, size_t n);
+
+#endif
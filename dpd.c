@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * dpd.c - memory polynomial digital predistortion
+ **/
+
+#include <math.h>
+#include <string.h>
+
+#include "dpd.h"
+
+#define HIST (DPD_MEMORY - 1)
+
+/*
+ * planar basis of a batch: b[k] holds x |x|^(2k) for the HIST samples
+ * before the batch and the nb of the batch.  Split real and imaginary
+ * parts keep the loops over samples simple enough to vectorize.
+ */
+struct basis {
+	float re[DPD_ORDERS][HIST + DPD_BATCH];
+	float im[DPD_ORDERS][HIST + DPD_BATCH];
+};
+
+static void basis_build(struct basis *b, const float complex *x, size_t nb)
+{
+	size_t t, k;
+
+	for (t = 0; t < HIST + nb; t++) {
+		float re = crealf(x[t]), im = cimagf(x[t]);
+		float p = re * re + im * im, g = 1;
+
+		for (k = 0; k < DPD_ORDERS; k++) {
+			b->re[k][t] = re * g;
+			b->im[k][t] = im * g;
+			g *= p;
+		}
+	}
+}
+
+void dpd_init(struct dpd *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->w[0] = 1;
+}
+
+void dpd_apply(struct dpd *d, const float complex *in, size_t n, float complex *out)
+{
+	struct basis b;
+	float complex x[HIST + DPD_BATCH];
+	float yr[DPD_BATCH], yi[DPD_BATCH];
+	size_t done, nb, t, k, m;
+
+	for (done = 0; done < n; done += nb) {
+		nb = n - done < DPD_BATCH ? n - done : DPD_BATCH;
+		for (t = 0; t < HIST; t++)
+			x[HIST - 1 - t] = d->hist[t];
+		memcpy(x + HIST, in + done, nb * sizeof(*x));
+		// a short last batch is padded, whole batches let the loops below vectorize
+		memset(x + HIST + nb, 0, (DPD_BATCH - nb) * sizeof(*x));
+		basis_build(&b, x, DPD_BATCH);
+
+		memset(yr, 0, sizeof(yr));
+		memset(yi, 0, sizeof(yi));
+		for (k = 0; k < DPD_ORDERS; k++) {
+			for (m = 0; m < DPD_MEMORY; m++) {
+				const float *br = b.re[k] + HIST - m, *bi = b.im[k] + HIST - m;
+				float wr = crealf(d->w[k * DPD_MEMORY + m]), wi = cimagf(d->w[k * DPD_MEMORY + m]);
+
+				if (wr == 0 && wi == 0)
+					continue;
+				for (t = 0; t < DPD_BATCH; t++) {
+					yr[t] += wr * br[t] - wi * bi[t];
+					yi[t] += wr * bi[t] + wi * br[t];
+				}
+			}
+		}
+		for (t = 0; t < nb; t++)
+			out[done + t] = yr[t] + I * yi[t];
+		for (t = 0; t < HIST; t++)
+			d->hist[t] = x[HIST + nb - 1 - t];
+	}
+}
+
+void dpd_fit_reset(struct dpd_fit *f)
+{
+	memset(f, 0, sizeof(*f));
+}
+
+void dpd_fit_add(struct dpd_fit *f, const float complex *y, const float complex *x, size_t n)
+{
+	struct basis b;
+	const float *cr[DPD_NCOEF + 1], *ci[DPD_NCOEF + 1];
+	float one[DPD_BATCH], zero[DPD_BATCH];
+	size_t done, nb, t, i, j;
+
+	for (t = 0; t < DPD_BATCH; t++) {
+		one[t] = 1;
+		zero[t] = 0;
+	}
+	for (done = 0; done < n; done += nb) {
+		nb = n - done < DPD_BATCH ? n - done : DPD_BATCH;
+		basis_build(&b, y + done - HIST, nb);
+
+		// columns of the basis matrix for this batch, the constant last
+		for (i = 0; i < DPD_NCOEF; i++) {
+			cr[i] = b.re[i / DPD_MEMORY] + HIST - i % DPD_MEMORY;
+			ci[i] = b.im[i / DPD_MEMORY] + HIST - i % DPD_MEMORY;
+		}
+		cr[DPD_NCOEF] = one;
+		ci[DPD_NCOEF] = zero;
+
+		// Gram matrix and right hand side as dot products over the batch
+		for (i = 0; i <= DPD_NCOEF; i++) {
+			double br = 0, bi = 0;
+
+			for (j = i; j <= DPD_NCOEF; j++) {
+				double sr = 0, si = 0;
+				for (t = 0; t < nb; t++) {
+					sr += cr[i][t] * cr[j][t] + ci[i][t] * ci[j][t];
+					si += cr[i][t] * ci[j][t] - ci[i][t] * cr[j][t];
+				}
+				f->r[i][j] += sr + I * si;
+			}
+			for (t = 0; t < nb; t++) {
+				float xr = crealf(x[done + t]), xi = cimagf(x[done + t]);
+				br += cr[i][t] * xr + ci[i][t] * xi;
+				bi += cr[i][t] * xi - ci[i][t] * xr;
+			}
+			f->b[i] += br + I * bi;
+		}
+		for (t = 0; t < nb; t++) {
+			float xr = crealf(x[done + t]), xi = cimagf(x[done + t]);
+			f->xx += xr * xr + xi * xi;
+		}
+		f->n += nb;
+	}
+}
+
+int dpd_fit_solve(const struct dpd_fit *f, float complex *w, double *nmse_db)
+{
+	enum { N = DPD_NCOEF + 1 };
+	double complex L[N][N], z[N], c[N], e;
+	double load = 0;
+	int i, j, k;
+
+	for (i = 0; i < N; i++)
+		if (creal(f->r[i][i]) > load)
+			load = creal(f->r[i][i]);
+	load *= 1e-9;
+
+	// Cholesky, A = L L^H
+	memset(L, 0, sizeof(L));
+	for (j = 0; j < N; j++) {
+		double d = creal(f->r[j][j]) + load;
+		for (k = 0; k < j; k++)
+			d -= creal(L[j][k] * conj(L[j][k]));
+		if (!(d > 0))
+			return -1;
+		L[j][j] = sqrt(d);
+		for (i = j + 1; i < N; i++) {
+			double complex s = conj(f->r[j][i]);
+			for (k = 0; k < j; k++)
+				s -= L[i][k] * conj(L[j][k]);
+			L[i][j] = s / L[j][j];
+		}
+	}
+	// L z = b, L^H c = z
+	for (i = 0; i < N; i++) {
+		z[i] = f->b[i];
+		for (k = 0; k < i; k++)
+			z[i] -= L[i][k] * z[k];
+		z[i] /= L[i][i];
+	}
+	for (i = N - 1; i >= 0; i--) {
+		c[i] = z[i];
+		for (k = i + 1; k < N; k++)
+			c[i] -= conj(L[k][i]) * c[k];
+		c[i] /= L[i][i];
+	}
+
+	for (i = 0; i < DPD_NCOEF; i++)
+		w[i] = c[i];
+	if (nmse_db) {
+		// at the solution the residual is sum |x|^2 - b^H c
+		e = f->xx;
+		for (i = 0; i < N; i++)
+			e -= conj(f->b[i]) * c[i];
+		*nmse_db = 10 * log10(fmax(creal(e), 1e-30) / f->xx);
+	}
+	return 0;
+}
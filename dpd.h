@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * dpd.h - memory polynomial digital predistortion
+ *
+ * The model is the usual memory polynomial with odd orders only,
+ *
+ *   y(n) = sum_k sum_m w[k][m] x(n-m) |x(n-m)|^(2k)
+ *
+ * for k < DPD_ORDERS (orders 1, 3, 5) and m < DPD_MEMORY.  The same
+ * structure serves as PA model and as predistorter: the fit estimates the
+ * inverse of the loopback from the received samples (divided by the
+ * linear gain) back to what was transmitted, and the result is copied
+ * into the predistorter (indirect learning).
+ **/
+
+#ifndef DPD_H
+#define DPD_H
+
+#include <stddef.h>
+#include <complex.h>
+
+#define DPD_ORDERS 3
+#define DPD_MEMORY 3
+#define DPD_NCOEF  (DPD_ORDERS * DPD_MEMORY)
+#define DPD_BATCH  256    // rows of the basis matrix built at a time
+
+/* streaming predistorter, the last DPD_MEMORY - 1 inputs are carried over */
+struct dpd {
+	float complex w[DPD_NCOEF];       // w[k * DPD_MEMORY + m]
+	float complex hist[DPD_MEMORY - 1];  // newest first
+};
+
+/* identity: w[0] = 1, everything else 0 */
+void dpd_init(struct dpd *d);
+void dpd_apply(struct dpd *d, const float complex *in, size_t n, float complex *out);
+
+/*
+ * least squares fit of x ~= sum w phi(y) + c, accumulated as normal
+ * equations so any number of blocks can be added.  The constant c takes
+ * up RX DC offset and is not part of the result.
+ */
+struct dpd_fit {
+	double complex r[DPD_NCOEF + 1][DPD_NCOEF + 1];   // Gram matrix, upper triangle
+	double complex b[DPD_NCOEF + 1];
+	double xx;                                        // sum |x|^2
+	size_t n;
+};
+
+void dpd_fit_reset(struct dpd_fit *f);
+/* y[-DPD_MEMORY+1 .. -1] must be valid, they are the memory of the first rows */
+void dpd_fit_add(struct dpd_fit *f, const float complex *y, const float complex *x, size_t n);
+/*
+ * solve with a little diagonal loading, w gets DPD_NCOEF coefficients and
+ * nmse the residual over sum |x|^2 in dB.  0 or -1 if the matrix is singular.
+ */
+int dpd_fit_solve(const struct dpd_fit *f, float complex *w, double *nmse_db);
+
+#endif
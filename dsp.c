@@ -0,0 +1,900 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * dsp.c - signal processing helpers for the AD9361 loopback tests
+ **/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>     // AVX+FMA resampler kernel, chosen at run time
+#endif
+
+#include "dsp.h"
+
+/*
+ * x86 builds carry an AVX+FMA dot product next to the SSE2 one whatever
+ * the compiler targets, resampler_create picks it when the CPU has both
+ */
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RESAMP_FMA 1
+#else
+#define RESAMP_FMA 0
+#endif
+
+/* complex multiply without the C99 inf/nan recovery path */
+static inline float complex cmul(float complex a, float complex b)
+{
+	float ar = crealf(a), ai = cimagf(a), br = crealf(b), bi = cimagf(b);
+	return (ar * br - ai * bi) + I * (ar * bi + ai * br);
+}
+
+static unsigned ilog2(size_t n)
+{
+	unsigned l = 0;
+	while (((size_t)1 << l) < n)
+		l++;
+	return l;
+}
+
+struct fft_plan *fft_plan_create_impl(size_t n, int dir, enum fft_impl impl)
+{
+	struct fft_plan *p;
+	unsigned bits = ilog2(n);
+	size_t k, len;
+
+	if (n < 4 || ((size_t)1 << bits) != n || impl >= FFT_IMPLS)
+		return NULL;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+	p->n = n;
+	p->dir = dir;
+	p->impl = impl;
+	p->tw = malloc(n / 2 * sizeof(*p->tw));
+	p->rev = malloc(n * sizeof(*p->rev));
+	if (impl == FFT_STAGED)
+		p->stw = malloc((n / 2 - 1) * sizeof(*p->stw));
+	if (!p->tw || !p->rev || (impl == FFT_STAGED && !p->stw)) {
+		fft_plan_destroy(p);
+		return NULL;
+	}
+
+	for (k = 0; k < n / 2; k++)
+		p->tw[k] = cexp(dir * 2.0 * M_PI * I * (double)k / (double)n);
+	// the last stage reads tw itself, the ones before it have half - 2 .. 2 half - 3
+	if (p->stw)
+		for (len = 4; len < n; len <<= 1)
+			for (k = 0; k < len / 2; k++)
+				p->stw[len / 2 - 2 + k] = p->tw[k * (n / len)];
+
+	for (k = 0; k < n; k++) {
+		uint32_t r = 0;
+		unsigned b;
+		for (b = 0; b < bits; b++)
+			r |= ((k >> b) & 1) << (bits - 1 - b);
+		p->rev[k] = r;
+	}
+	return p;
+}
+
+static void fft_plan_free(struct fft_plan *p)
+{
+	if (!p)
+		return;
+	free(p->tw);
+	free(p->stw);
+	free(p->rev);
+	free(p);
+}
+
+const char *fft_impl_name(enum fft_impl impl)
+{
+	static const char *const names[FFT_IMPLS] = { "strided", "staged" };
+	return impl < FFT_IMPLS ? names[impl] : "?";
+}
+
+/*
+ * plan cache and wisdom.  The cache is a list of the plans in use, the
+ * wisdom a table of what was tuned, both behind one lock; tuning happens
+ * with it held, so a size is never timed twice.
+ */
+#define FFT_WISDOM_MAX 64
+#define FFT_TUNE_SAMPLES 8192   // per timing run, several transforms for the small sizes
+#define FFT_TUNE_RUNS 5         // per layout, the fastest counts
+
+#if defined(__SSE2__)
+#define FFT_FLAVOUR "sse2"
+#elif defined(__ARM_NEON)
+#define FFT_FLAVOUR "neon"
+#else
+#define FFT_FLAVOUR "c"
+#endif
+
+struct fft_wisdom {
+	size_t n;
+	int dir;
+	enum fft_impl impl;
+	double ns;            // per transform
+};
+
+static pthread_mutex_t fft_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fft_plan *fft_cache;
+static struct fft_wisdom wisdom[FFT_WISDOM_MAX];
+static size_t nwisdom;
+static bool wisdom_dirty;
+static struct fft_cache_stats fft_stats;
+
+static double fft_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static struct fft_wisdom *wisdom_find(size_t n, int dir)
+{
+	size_t i;
+
+	for (i = 0; i < nwisdom; i++)
+		if (wisdom[i].n == n && wisdom[i].dir == dir)
+			return &wisdom[i];
+	return NULL;
+}
+
+static struct fft_wisdom *wisdom_add(size_t n, int dir)
+{
+	struct fft_wisdom *w = wisdom_find(n, dir);
+
+	if (!w && nwisdom < FFT_WISDOM_MAX) {
+		w = &wisdom[nwisdom++];
+		w->n = n;
+		w->dir = dir;
+	}
+	return w;
+}
+
+/* time every layout on the same batch, returns the fastest, 0 and 0 ns if they can't be made */
+static enum fft_impl fft_tune(size_t n, int dir, double *ns)
+{
+	size_t count = n < FFT_TUNE_SAMPLES ? FFT_TUNE_SAMPLES / n : 1, k;
+	float complex *in = malloc(n * count * sizeof(*in)), *x = malloc(n * count * sizeof(*x));
+	enum fft_impl best = FFT_STRIDED, impl;
+	double t0 = fft_now();
+	int run;
+
+	*ns = 0;
+	if (!in || !x)
+		goto out;
+	for (k = 0; k < n * count; k++)
+		in[k] = (float)((k * 7919) % 1021) / 1021 - 0.5f + I * ((float)((k * 104729) % 997) / 997 - 0.5f);
+	for (impl = 0; impl < FFT_IMPLS; impl++) {
+		struct fft_plan *p = fft_plan_create_impl(n, dir, impl);
+		double t = INFINITY;
+
+		if (!p)
+			continue;
+		// the first run warms up the tables, the input is restored for every run
+		for (run = 0; run <= FFT_TUNE_RUNS; run++) {
+			double r0;
+			memcpy(x, in, n * count * sizeof(*x));
+			r0 = fft_now();
+			fft_execute_batch(p, x, count);
+			if (run)
+				t = fmin(t, fft_now() - r0);
+		}
+		fft_plan_free(p);
+		if (!*ns || t / count * 1e9 < *ns) {
+			*ns = t / count * 1e9;
+			best = impl;
+		}
+	}
+out:
+	free(in);
+	free(x);
+	fft_stats.tuned++;
+	fft_stats.tune_sec += fft_now() - t0;
+	return best;
+}
+
+struct fft_plan *fft_plan_create(size_t n, int dir)
+{
+	struct fft_plan *p;
+	struct fft_wisdom *w;
+	enum fft_impl impl;
+	double ns;
+
+	pthread_mutex_lock(&fft_lock);
+	for (p = fft_cache; p; p = p->next) {
+		if (p->n == n && p->dir == dir) {
+			p->refs++;
+			fft_stats.hits++;
+			goto out;
+		}
+	}
+	w = wisdom_find(n, dir);
+	if (w) {
+		impl = w->impl;
+	} else {
+		impl = fft_tune(n, dir, &ns);
+		if (ns > 0 && (w = wisdom_add(n, dir))) {
+			w->impl = impl;
+			w->ns = ns;
+			wisdom_dirty = true;
+		}
+	}
+	p = fft_plan_create_impl(n, dir, impl);
+	if (p) {
+		p->refs = 1;
+		p->next = fft_cache;
+		fft_cache = p;
+		fft_stats.made++;
+	}
+out:
+	pthread_mutex_unlock(&fft_lock);
+	return p;
+}
+
+void fft_plan_destroy(struct fft_plan *p)
+{
+	struct fft_plan **pp;
+
+	if (!p)
+		return;
+	if (!p->refs) {
+		fft_plan_free(p);
+		return;
+	}
+	pthread_mutex_lock(&fft_lock);
+	if (!--p->refs) {
+		for (pp = &fft_cache; *pp; pp = &(*pp)->next) {
+			if (*pp == p) {
+				*pp = p->next;
+				break;
+			}
+		}
+		fft_plan_free(p);
+	}
+	pthread_mutex_unlock(&fft_lock);
+}
+
+int fft_wisdom_load(const char *path)
+{
+	char line[128], flavour[16];
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return errno == ENOENT ? 0 : -errno;
+	// wisdom of another build is no good here, it gets tuned and written again
+	if (!fgets(line, sizeof(line), f) || sscanf(line, "# fft wisdom %15s", flavour) != 1 ||
+	    strcmp(flavour, FFT_FLAVOUR)) {
+		fclose(f);
+		return 0;
+	}
+	pthread_mutex_lock(&fft_lock);
+	while (fgets(line, sizeof(line), f)) {
+		char name[16];
+		struct fft_wisdom m, *w;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%zu %d %15s %lf", &m.n, &m.dir, name, &m.ns) != 4)
+			continue;
+		for (m.impl = 0; m.impl < FFT_IMPLS; m.impl++)
+			if (!strcmp(name, fft_impl_name(m.impl)))
+				break;
+		if (m.impl < FFT_IMPLS && (w = wisdom_add(m.n, m.dir)))
+			*w = m;
+	}
+	pthread_mutex_unlock(&fft_lock);
+	fclose(f);
+	return 0;
+}
+
+int fft_wisdom_save(const char *path)
+{
+	char tmp[4096];
+	size_t i;
+	FILE *f;
+	int ret = 0;
+
+	pthread_mutex_lock(&fft_lock);
+	if (!wisdom_dirty)
+		goto out;
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+		ret = -ENAMETOOLONG;
+		goto out;
+	}
+	f = fopen(tmp, "w");
+	if (!f) {
+		ret = -errno;
+		goto out;
+	}
+	fprintf(f, "# fft wisdom %s\n# n dir impl ns\n", FFT_FLAVOUR);
+	for (i = 0; i < nwisdom; i++)
+		fprintf(f, "%zu %d %s %.1f\n", wisdom[i].n, wisdom[i].dir,
+			fft_impl_name(wisdom[i].impl), wisdom[i].ns);
+	if (fclose(f) || rename(tmp, path)) {
+		ret = -errno;
+		remove(tmp);
+		goto out;
+	}
+	wisdom_dirty = false;
+out:
+	pthread_mutex_unlock(&fft_lock);
+	return ret;
+}
+
+void fft_cache_stats(struct fft_cache_stats *s)
+{
+	pthread_mutex_lock(&fft_lock);
+	*s = fft_stats;
+	pthread_mutex_unlock(&fft_lock);
+}
+
+/* contiguous twiddles of the stage of length len, NULL when they are to be gathered */
+static inline const float complex *fft_stage_tw(const struct fft_plan *p, size_t len)
+{
+	if (len == p->n)
+		return p->tw;
+	return p->stw ? p->stw + len / 2 - 2 : NULL;
+}
+
+void fft_execute(const struct fft_plan *p, float complex *x)
+{
+	fft_execute_batch(p, x, 1);
+}
+
+void fft_execute_batch(const struct fft_plan *p, float complex *x, size_t count)
+{
+	size_t n = p->n, total = n * count, k, b, len;
+
+	for (b = 0; b < total; b += n) {
+		float complex *v = x + b;
+		for (k = 0; k < n; k++) {
+			size_t r = p->rev[k];
+			if (r > k) {
+				float complex t = v[k];
+				v[k] = v[r];
+				v[r] = t;
+			}
+		}
+	}
+
+	// the transforms are contiguous and no butterfly crosses one, so every
+	// stage runs over the whole batch in one pass with the twiddles hot
+#if defined(__SSE2__)
+	// two complex per register, the first stage needs no twiddles
+	for (k = 0; k < total; k += 4) {
+		__m128 v0 = _mm_loadu_ps((float *)(x + k)), v1 = _mm_loadu_ps((float *)(x + k + 2));
+		__m128 a = _mm_movelh_ps(v0, v1), c = _mm_movehl_ps(v1, v0);
+		__m128 s = _mm_add_ps(a, c), d = _mm_sub_ps(a, c);
+		_mm_storeu_ps((float *)(x + k), _mm_movelh_ps(s, d));
+		_mm_storeu_ps((float *)(x + k + 2), _mm_movehl_ps(d, s));
+	}
+	for (len = 4; len <= n; len <<= 1) {
+		size_t half = len >> 1, stride = n / len, j;
+		const float complex *st = fft_stage_tw(p, len);
+		const __m128 sign = _mm_set_ps(1.0f, -1.0f, 1.0f, -1.0f);
+		for (k = 0; k < total; k += len) {
+			for (j = 0; j < half; j += 2) {
+				__m128 w = st ? _mm_loadu_ps((const float *)(st + j)) :
+					   _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(p->tw + j * stride)),
+							 (const __m64 *)(p->tw + (j + 1) * stride));
+				__m128 a = _mm_loadu_ps((float *)(x + k + j));
+				__m128 b = _mm_loadu_ps((float *)(x + k + j + half));
+				__m128 wr = _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 0, 0));
+				__m128 wi = _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 1, 1));
+				__m128 bs = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1));
+				__m128 c = _mm_add_ps(_mm_mul_ps(b, wr), _mm_mul_ps(_mm_mul_ps(bs, wi), sign));
+				_mm_storeu_ps((float *)(x + k + j), _mm_add_ps(a, c));
+				_mm_storeu_ps((float *)(x + k + j + half), _mm_sub_ps(a, c));
+			}
+		}
+	}
+#elif defined(__ARM_NEON)
+	for (k = 0; k < total; k += 2) {
+		float32x4_t v = vld1q_f32((float *)(x + k));
+		float32x2_t a = vget_low_f32(v), c = vget_high_f32(v);
+		vst1q_f32((float *)(x + k), vcombine_f32(vadd_f32(a, c), vsub_f32(a, c)));
+	}
+	for (len = 4; len <= n; len <<= 1) {
+		size_t half = len >> 1, stride = n / len, j;
+		const float complex *st = fft_stage_tw(p, len);
+		const float32x4_t sign = { -1.0f, 1.0f, -1.0f, 1.0f };
+		for (k = 0; k < total; k += len) {
+			for (j = 0; j < half; j += 2) {
+				float32x4_t w = st ? vld1q_f32((const float *)(st + j)) :
+						vcombine_f32(vld1_f32((const float *)(p->tw + j * stride)),
+							     vld1_f32((const float *)(p->tw + (j + 1) * stride)));
+				float32x4_t a = vld1q_f32((float *)(x + k + j));
+				float32x4_t b = vld1q_f32((float *)(x + k + j + half));
+				float32x4x2_t wt = vtrnq_f32(w, w);   // re re re re, im im im im
+				float32x4_t c = vmlaq_f32(vmulq_f32(b, wt.val[0]), vmulq_f32(vrev64q_f32(b), sign), wt.val[1]);
+				vst1q_f32((float *)(x + k + j), vaddq_f32(a, c));
+				vst1q_f32((float *)(x + k + j + half), vsubq_f32(a, c));
+			}
+		}
+	}
+#else
+	for (k = 0; k < total; k += 2) {
+		float complex a = x[k], c = x[k + 1];
+		x[k]     = a + c;
+		x[k + 1] = a - c;
+	}
+	for (len = 4; len <= n; len <<= 1) {
+		size_t half = len >> 1, stride = n / len, j;
+		const float complex *st = fft_stage_tw(p, len);
+		for (k = 0; k < total; k += len) {
+			for (j = 0; j < half; j++) {
+				float complex a = x[k + j];
+				float complex c = cmul(x[k + j + half], st ? st[j] : p->tw[j * stride]);
+				x[k + j]        = a + c;
+				x[k + j + half] = a - c;
+			}
+		}
+	}
+#endif
+}
+
+void chirp_generate(float complex *out, size_t n, double f0, double f1, double fs)
+{
+	// phase(t) = 2*pi*(f0*t + k/2*t^2) with sweep rate k = (f1-f0)/T
+	double T = (double)n / fs;
+	double k = (f1 - f0) / T;
+	size_t s;
+
+	for (s = 0; s < n; s++) {
+		double t = (double)s / fs;
+		double ph = 2.0 * M_PI * (f0 * t + 0.5 * k * t * t);
+		out[s] = (float)cos(ph) + I * (float)sin(ph);
+	}
+}
+
+int multitone_generate(float complex *out, size_t n, const int *bins, size_t m)
+{
+	struct fft_plan *inv = fft_plan_create(n, FFT_INVERSE);
+	size_t i;
+
+	if (!inv)
+		return -1;
+	memset(out, 0, n * sizeof(*out));
+	for (i = 0; i < m; i++) {
+		// Schroeder: phi_i = -pi i (i - 1) / m for i = 1 .. m
+		double ph = -M_PI * (double)(i + 1) * i / m;
+		out[((long)bins[i] % (long)n + (long)n) % (long)n] += (float)cos(ph) + I * (float)sin(ph);
+	}
+	fft_execute(inv, out);
+	fft_plan_destroy(inv);
+	return 0;
+}
+
+struct ols_filter *ols_create(const float complex *h, size_t m, size_t nfft)
+{
+	struct ols_filter *f;
+	size_t k;
+
+	if (m == 0 || m >= nfft)
+		return NULL;
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->nfft = nfft;
+	f->m = m;
+	f->step = nfft - m + 1;
+	f->H = calloc(nfft, sizeof(*f->H));
+	f->buf = calloc(nfft, sizeof(*f->buf));
+	f->work = calloc(nfft, sizeof(*f->work));
+	f->fwd = fft_plan_create(nfft, FFT_FORWARD);
+	f->inv = fft_plan_create(nfft, FFT_INVERSE);
+	if (!f->H || !f->buf || !f->work || !f->fwd || !f->inv) {
+		ols_destroy(f);
+		return NULL;
+	}
+
+	// fold the inverse transform scaling into the filter spectrum
+	for (k = 0; k < m; k++)
+		f->H[k] = h[k] / (float)nfft;
+	fft_execute(f->fwd, f->H);
+	return f;
+}
+
+void ols_destroy(struct ols_filter *f)
+{
+	if (!f)
+		return;
+	free(f->H);
+	free(f->buf);
+	free(f->work);
+	fft_plan_destroy(f->fwd);
+	fft_plan_destroy(f->inv);
+	free(f);
+}
+
+size_t ols_process(struct ols_filter *f, const float complex *in, size_t n, float complex *out)
+{
+	size_t hist = f->m - 1, nout = 0, k;
+
+	while (n) {
+		size_t take = f->step - f->fill;
+		if (take > n)
+			take = n;
+		memcpy(f->buf + hist + f->fill, in, take * sizeof(*in));
+		f->fill += take;
+		in += take;
+		n -= take;
+
+		if (f->fill < f->step)
+			break;
+
+		memcpy(f->work, f->buf, f->nfft * sizeof(*f->work));
+		fft_execute(f->fwd, f->work);
+		for (k = 0; k < f->nfft; k++)
+			f->work[k] = cmul(f->work[k], f->H[k]);
+		fft_execute(f->inv, f->work);
+
+		// the first m-1 outputs are wrapped around, the rest is the linear convolution
+		memcpy(out + nout, f->work + hist, f->step * sizeof(*out));
+		nout += f->step;
+
+		// keep the last m-1 inputs as history for the next block
+		memmove(f->buf, f->buf + f->step, hist * sizeof(*f->buf));
+		f->fill = 0;
+	}
+	return nout;
+}
+
+struct fir_decim *fir_decim_create(size_t d, size_t m)
+{
+	struct fir_decim *f;
+	double fc, w, sum = 0;
+	size_t k;
+
+	if (d == 0 || m == 0)
+		return NULL;
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->d = d;
+	f->m = m;
+	f->h = calloc(m, sizeof(*f->h));
+	if (!f->h) {
+		fir_decim_destroy(f);
+		return NULL;
+	}
+
+	// cutoff as a fraction of the input sample rate
+	fc = 0.8 * 0.5 / d;
+	for (k = 0; k < m; k++) {
+		double t = k - (m - 1) / 2.0;
+		w = m > 1 ? 0.54 - 0.46 * cos(2 * M_PI * k / (m - 1)) : 1;
+		f->h[k] = w * (t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t));
+		sum += f->h[k];
+	}
+	// unity gain at DC
+	for (k = 0; k < m; k++)
+		f->h[k] /= sum;
+	return f;
+}
+
+void fir_decim_destroy(struct fir_decim *f)
+{
+	if (!f)
+		return;
+	free(f->h);
+	free(f->buf);
+	free(f);
+}
+
+size_t fir_decim_process(struct fir_decim *f, const float complex *in, size_t n, float complex *out)
+{
+	size_t hist = f->m - 1, nout = 0, p, k;
+
+	if (hist + n > f->cap) {
+		float complex *b = realloc(f->buf, (hist + n) * sizeof(*b));
+		if (!b)
+			return 0;
+		if (!f->buf)
+			memset(b, 0, hist * sizeof(*b));
+		f->buf = b;
+		f->cap = hist + n;
+	}
+	memcpy(f->buf + hist, in, n * sizeof(*in));
+
+	// buf[p] is the newest input of the output, buf[p - m + 1] the oldest
+	for (p = hist + f->skip; p < hist + n; p += f->d) {
+		float re = 0, im = 0;
+		for (k = 0; k < f->m; k++) {
+			re += f->h[k] * crealf(f->buf[p - k]);
+			im += f->h[k] * cimagf(f->buf[p - k]);
+		}
+		out[nout++] = re + I * im;
+	}
+	f->skip = p - (hist + n);
+
+	memmove(f->buf, f->buf + n, hist * sizeof(*f->buf));
+	return nout;
+}
+
+/* zeroth order modified Bessel function, for the Kaiser window */
+static double bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	int k;
+
+	for (k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+#define RESAMP_BETA 8.0  // Kaiser window, about 80 dB stopband
+
+struct resampler *resampler_create(double ratio)
+{
+	struct resampler *r;
+	double fc, scale = ratio < 1 ? ratio : 1;
+	size_t len, ph, j;
+	double *proto;
+
+	if (!(ratio >= 1.0 / RESAMP_MAX_RATIO && ratio <= RESAMP_MAX_RATIO))
+		return NULL;
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+	r->ratio = ratio;
+	r->step = (uint64_t)llround(4294967296.0 / ratio);
+	// longer filters when decimating keep the transition band the same in output samples
+	r->ntap = ((size_t)ceil(RESAMP_TAPS / scale) + 3) & ~(size_t)3;
+
+	// prototype at RESAMP_PHASES points per input sample, h[m] = h(m / RESAMP_PHASES)
+	len = r->ntap * RESAMP_PHASES + 1;
+	proto = malloc(len * sizeof(*proto));
+	r->bank = calloc((RESAMP_PHASES + 1) * r->ntap, sizeof(*r->bank));
+	r->delta = calloc(RESAMP_PHASES * r->ntap, sizeof(*r->delta));
+	if (!proto || !r->bank || !r->delta) {
+		free(proto);
+		resampler_destroy(r);
+		return NULL;
+	}
+	fc = 0.45 * scale;
+	for (j = 0; j < len; j++) {
+		double tau = (double)j / RESAMP_PHASES - r->ntap / 2.0;
+		double x = 2.0 * tau / r->ntap;
+		double w = fabs(x) < 1 ? bessel_i0(RESAMP_BETA * sqrt(1 - x * x)) / bessel_i0(RESAMP_BETA) : 0;
+		proto[j] = w * (tau == 0 ? 2 * fc : sin(2 * M_PI * fc * tau) / (M_PI * tau));
+	}
+	// row ph holds h(k + ph / RESAMP_PHASES) for k = ntap-1 (oldest) down to 0 (newest)
+	for (ph = 0; ph <= RESAMP_PHASES; ph++)
+		for (j = 0; j < r->ntap; j++)
+			r->bank[ph * r->ntap + j] = proto[(r->ntap - 1 - j) * RESAMP_PHASES + ph];
+	// the step to the next row, the phases in between are row + f * delta
+	for (j = 0; j < RESAMP_PHASES * r->ntap; j++)
+		r->delta[j] = r->bank[j + r->ntap] - r->bank[j];
+	free(proto);
+#if RESAMP_FMA
+	__builtin_cpu_init();
+	r->fma = __builtin_cpu_supports("avx") && __builtin_cpu_supports("fma");
+#endif
+	return r;
+}
+
+void resampler_destroy(struct resampler *r)
+{
+	if (!r)
+		return;
+	free(r->bank);
+	free(r->delta);
+	free(r->re);
+	free(r->im);
+	free(r);
+}
+
+size_t resampler_max_out(const struct resampler *r, size_t n)
+{
+	return (size_t)ceil(n * r->ratio) + 2;
+}
+
+/*
+ * dot product of x with the coefficients h + f * d, the phase between two
+ * rows of the bank; y gets the real and imaginary part, n a multiple of 4
+ */
+#if RESAMP_FMA
+__attribute__((target("avx,fma")))
+static inline void dot_fma(const float *h, const float *d, float f, const float *re, const float *im,
+			   size_t n, float *y)
+{
+	__m256 w0 = _mm256_setzero_ps(), w1 = w0, vf = _mm256_set1_ps(f);
+	__m128 a0, a1;
+	size_t k;
+
+	for (k = 0; k + 8 <= n; k += 8) {
+		__m256 c = _mm256_fmadd_ps(vf, _mm256_loadu_ps(d + k), _mm256_loadu_ps(h + k));
+		w0 = _mm256_fmadd_ps(c, _mm256_loadu_ps(re + k), w0);
+		w1 = _mm256_fmadd_ps(c, _mm256_loadu_ps(im + k), w1);
+	}
+	a0 = _mm_add_ps(_mm256_castps256_ps128(w0), _mm256_extractf128_ps(w0, 1));
+	a1 = _mm_add_ps(_mm256_castps256_ps128(w1), _mm256_extractf128_ps(w1, 1));
+	if (k < n) {
+		__m128 c = _mm_fmadd_ps(_mm256_castps256_ps128(vf), _mm_loadu_ps(d + k), _mm_loadu_ps(h + k));
+		a0 = _mm_fmadd_ps(c, _mm_loadu_ps(re + k), a0);
+		a1 = _mm_fmadd_ps(c, _mm_loadu_ps(im + k), a1);
+	}
+	// sum of a0 to lane 0, of a1 to lane 1
+	a0 = _mm_add_ps(_mm_unpacklo_ps(a0, a1), _mm_unpackhi_ps(a0, a1));
+	a0 = _mm_add_ps(a0, _mm_movehl_ps(a0, a0));
+	y[0] = _mm_cvtss_f32(a0);
+	y[1] = _mm_cvtss_f32(_mm_shuffle_ps(a0, a0, 1));
+}
+#endif
+
+static inline void dot(const float *h, const float *d, float f, const float *re, const float *im,
+		       size_t n, float *y)
+{
+	size_t k;
+#if defined(__SSE2__)
+	__m128 a0 = _mm_setzero_ps(), a1 = a0, b0 = a0, b1 = a0, vf = _mm_set1_ps(f);
+
+	// two accumulators each so the adds of consecutive steps overlap
+	for (k = 0; k + 8 <= n; k += 8) {
+		__m128 c0 = _mm_add_ps(_mm_loadu_ps(h + k), _mm_mul_ps(vf, _mm_loadu_ps(d + k)));
+		__m128 c1 = _mm_add_ps(_mm_loadu_ps(h + k + 4), _mm_mul_ps(vf, _mm_loadu_ps(d + k + 4)));
+		a0 = _mm_add_ps(a0, _mm_mul_ps(c0, _mm_loadu_ps(re + k)));
+		a1 = _mm_add_ps(a1, _mm_mul_ps(c0, _mm_loadu_ps(im + k)));
+		b0 = _mm_add_ps(b0, _mm_mul_ps(c1, _mm_loadu_ps(re + k + 4)));
+		b1 = _mm_add_ps(b1, _mm_mul_ps(c1, _mm_loadu_ps(im + k + 4)));
+	}
+	if (k < n) {
+		__m128 c0 = _mm_add_ps(_mm_loadu_ps(h + k), _mm_mul_ps(vf, _mm_loadu_ps(d + k)));
+		a0 = _mm_add_ps(a0, _mm_mul_ps(c0, _mm_loadu_ps(re + k)));
+		a1 = _mm_add_ps(a1, _mm_mul_ps(c0, _mm_loadu_ps(im + k)));
+	}
+	a0 = _mm_add_ps(a0, b0);
+	a1 = _mm_add_ps(a1, b1);
+	a0 = _mm_add_ps(_mm_unpacklo_ps(a0, a1), _mm_unpackhi_ps(a0, a1));
+	a0 = _mm_add_ps(a0, _mm_movehl_ps(a0, a0));
+	y[0] = _mm_cvtss_f32(a0);
+	y[1] = _mm_cvtss_f32(_mm_shuffle_ps(a0, a0, 1));
+#elif defined(__ARM_NEON)
+	float32x4_t a0 = vdupq_n_f32(0), a1 = a0;
+	float32x2_t s;
+
+	for (k = 0; k < n; k += 4) {
+		float32x4_t c = vmlaq_n_f32(vld1q_f32(h + k), vld1q_f32(d + k), f);
+		a0 = vmlaq_f32(a0, c, vld1q_f32(re + k));
+		a1 = vmlaq_f32(a1, c, vld1q_f32(im + k));
+	}
+	s = vadd_f32(vget_low_f32(a0), vget_high_f32(a0)); y[0] = vget_lane_f32(vpadd_f32(s, s), 0);
+	s = vadd_f32(vget_low_f32(a1), vget_high_f32(a1)); y[1] = vget_lane_f32(vpadd_f32(s, s), 0);
+#else
+	y[0] = y[1] = 0;
+	for (k = 0; k < n; k++) {
+		float c = h[k] + f * d[k];
+		y[0] += c * re[k];
+		y[1] += c * im[k];
+	}
+#endif
+}
+
+/* outputs up to input position len, returns how many */
+static inline __attribute__((always_inline)) size_t resamp_run(struct resampler *r, size_t len,
+							       float complex *out, bool fma)
+{
+	const float *re = r->re, *im = r->im, *bank = r->bank, *delta = r->delta;
+	size_t ntap = r->ntap, nout = 0;
+	uint64_t t = r->t, step = r->step;
+
+	// output at position t uses re[i - ntap + 1 .. i], i = floor(t)
+	while (t >> 32 < len) {
+		size_t i = (t >> 32) - (ntap - 1);
+		uint32_t frac = (uint32_t)t;
+		size_t ph = frac >> (32 - RESAMP_PHASE_BITS);
+		float f = (frac << RESAMP_PHASE_BITS) * (1.0f / 4294967296.0f), y[2];
+
+#if RESAMP_FMA
+		if (fma)
+			dot_fma(bank + ph * ntap, delta + ph * ntap, f, re + i, im + i, ntap, y);
+		else
+#endif
+			dot(bank + ph * ntap, delta + ph * ntap, f, re + i, im + i, ntap, y);
+		out[nout++] = y[0] + I * y[1];
+		t += step;
+	}
+	r->t = t;
+	return nout;
+}
+
+static size_t resamp_run_plain(struct resampler *r, size_t len, float complex *out)
+{
+	return resamp_run(r, len, out, false);
+}
+
+#if RESAMP_FMA
+__attribute__((target("avx,fma")))
+static size_t resamp_run_fma(struct resampler *r, size_t len, float complex *out)
+{
+	return resamp_run(r, len, out, true);
+}
+#endif
+
+size_t resampler_process(struct resampler *r, const float complex *in, size_t n, float complex *out)
+{
+	size_t hist = r->ntap - 1, len = hist + n, nout, k, shift;
+
+	if (len > r->cap) {
+		float *re = realloc(r->re, len * sizeof(*re));
+		float *im = re ? realloc(r->im, len * sizeof(*im)) : NULL;
+		if (re) r->re = re;
+		if (!re || !im)
+			return 0;
+		r->im = im;
+		if (!r->cap) {
+			memset(r->re, 0, hist * sizeof(*r->re));
+			memset(r->im, 0, hist * sizeof(*r->im));
+			r->t = (uint64_t)hist << 32;
+		}
+		r->cap = len;
+	}
+	// planar copy so the dot products run over contiguous floats
+	for (k = 0; k < n; k++) {
+		r->re[hist + k] = crealf(in[k]);
+		r->im[hist + k] = cimagf(in[k]);
+	}
+
+#if RESAMP_FMA
+	if (r->fma)
+		nout = resamp_run_fma(r, len, out);
+	else
+#endif
+		nout = resamp_run_plain(r, len, out);
+
+	// keep the last ntap - 1 inputs
+	shift = len - hist;
+	memmove(r->re, r->re + shift, hist * sizeof(*r->re));
+	memmove(r->im, r->im + shift, hist * sizeof(*r->im));
+	r->t -= (uint64_t)shift << 32;
+	return nout;
+}
+
+double group_delay(const float complex *h, size_t n)
+{
+	// sum_k H[k+1] conj(H[k]) = n * sum_t |h[t]|^2 exp(-j 2 pi t / n), so the
+	// spectral phase slope can be taken straight from the time samples
+	double complex acc = 0;
+	double d;
+	size_t t;
+
+	for (t = 0; t < n; t++) {
+		double e = creal(h[t]) * creal(h[t]) + cimag(h[t]) * cimag(h[t]);
+		acc += e * cexp(-2.0 * M_PI * I * (double)t / (double)n);
+	}
+	d = -carg(acc) * (double)n / (2.0 * M_PI);
+	return d < 0 ? d + (double)n : d;
+}
+
+double parabolic_peak(double ym1, double y0, double yp1)
+{
+	double den = ym1 - 2.0 * y0 + yp1;
+	double d;
+
+	if (den == 0.0)
+		return 0.0;
+	d = 0.5 * (ym1 - yp1) / den;
+	if (d > 0.5)  d = 0.5;
+	if (d < -0.5) d = -0.5;
+	return d;
+}
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * dsp.h - signal processing helpers for the AD9361 loopback tests
+ *
+ * Everything works on single precision complex samples.  The int16
+ * samples coming out of rxbuf are converted once per block and then
+ * handed to these routines.
+ **/
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <complex.h>
+
+#define FFT_FORWARD (-1)
+#define FFT_INVERSE (+1)
+
+/*
+ * radix-2 complex FFT plan, n must be a power of two, at least 4.
+ *
+ * Plans are cached: fft_plan_create hands out the plan it already made for
+ * the same size and direction, and fft_plan_destroy drops a reference.
+ * The first time a size is planned both twiddle layouts are timed on a
+ * batch of transforms and the faster one is kept, unless the wisdom
+ * (below) already says which it is.  Plans are read only once made, so
+ * several threads can run the same one.
+ */
+enum fft_impl {
+	FFT_STRIDED,         // one table of n/2 twiddles, the early stages gather every stride-th
+	FFT_STAGED,          // every stage but the last reads its own contiguous table
+	FFT_IMPLS
+};
+
+struct fft_plan {
+	size_t n;
+	int dir;             // FFT_FORWARD or FFT_INVERSE (unscaled)
+	enum fft_impl impl;
+	float complex *tw;   // n/2 twiddle factors
+	float complex *stw;  // FFT_STAGED: the half twiddles of stage len at half - 2
+	uint32_t *rev;       // bit reversal permutation
+	unsigned refs;       // users of a cached plan, 0 for one of its own
+	struct fft_plan *next;
+};
+
+struct fft_plan *fft_plan_create(size_t n, int dir);
+/* a plan of its own with the given layout, neither cached nor tuned */
+struct fft_plan *fft_plan_create_impl(size_t n, int dir, enum fft_impl impl);
+void fft_plan_destroy(struct fft_plan *p);
+const char *fft_impl_name(enum fft_impl impl);
+
+/*
+ * FFT wisdom, the layout picked for every size and direction tuned so far
+ * and its time per transform.  fft_wisdom_load takes the entries of a file
+ * written by fft_wisdom_save of the same SIMD flavour, a missing file or
+ * one of another flavour gives none.  fft_wisdom_save only writes when
+ * something was tuned since (through a temporary file renamed over it).
+ * Both return 0 or -errno.
+ */
+int fft_wisdom_load(const char *path);
+int fft_wisdom_save(const char *path);
+
+struct fft_cache_stats {
+	unsigned hits;       // plans handed out again
+	unsigned made;       // plans made
+	unsigned tuned;      // sizes timed, the others came from the wisdom
+	double tune_sec;     // spent timing
+};
+
+void fft_cache_stats(struct fft_cache_stats *s);
+/* in place transform of n samples */
+void fft_execute(const struct fft_plan *p, float complex *x);
+/* count transforms of n contiguous samples each, in one pass per stage */
+void fft_execute_batch(const struct fft_plan *p, float complex *x, size_t count);
+
+/* linear chirp from f0 to f1 (Hz) over n samples at sample rate fs, unit amplitude */
+void chirp_generate(float complex *out, size_t n, double f0, double f1, double fs);
+
+/*
+ * m unit amplitude tones on the given bins (cycles per n samples, negative
+ * below DC, in order of frequency) with Schroeder phases, which keep the
+ * crest factor of a flat comb low.  n must be a power of two.  0 or -1.
+ */
+int multitone_generate(float complex *out, size_t n, const int *bins, size_t m);
+
+/* overlap-save fast convolution with a fixed FIR filter of m taps */
+struct ols_filter {
+	size_t nfft;          // transform size
+	size_t m;             // filter length
+	size_t step;          // new samples per transform, nfft - m + 1
+	size_t fill;          // samples currently in buf beyond the history
+	float complex *H;     // filter spectrum, scaled by 1/nfft
+	float complex *buf;   // time domain block, history first
+	float complex *work;  // transform scratch
+	struct fft_plan *fwd;
+	struct fft_plan *inv;
+};
+
+struct ols_filter *ols_create(const float complex *h, size_t m, size_t nfft);
+void ols_destroy(struct ols_filter *f);
+/*
+ * feed n samples, filtered output is written to out as it becomes
+ * available; out must hold n + f->step samples.  Returns number written.
+ */
+size_t ols_process(struct ols_filter *f, const float complex *in, size_t n, float complex *out);
+
+/*
+ * FIR low pass and decimate by d in one step, only every d-th output is
+ * computed.  The filter is a Hamming windowed sinc with m taps and its
+ * cutoff at 0.8 of the new Nyquist frequency.
+ */
+struct fir_decim {
+	size_t d;             // decimation factor
+	size_t m;             // filter length
+	size_t skip;          // inputs still to go before the next output
+	float *h;
+	float complex *buf;   // m-1 samples of history, then the new block
+	size_t cap;           // samples buf can hold
+};
+
+struct fir_decim *fir_decim_create(size_t d, size_t m);
+void fir_decim_destroy(struct fir_decim *f);
+/* feed n samples, out must hold n / d + 1 samples.  Returns number written. */
+size_t fir_decim_process(struct fir_decim *f, const float complex *in, size_t n, float complex *out);
+
+/*
+ * arbitrary ratio resampler.  A windowed sinc is tabulated at
+ * RESAMP_PHASES fractional delays per input sample, every output sample
+ * is the dot product of the input history with the coefficients
+ * interpolated linearly between the two nearest phases.  The cutoff follows the lower of the two rates
+ * so it also works as the anti-alias filter when decimating.  State is
+ * carried across calls, the delay is ntap / 2 input samples.
+ */
+#define RESAMP_PHASE_BITS 7
+#define RESAMP_PHASES (1 << RESAMP_PHASE_BITS)
+#define RESAMP_TAPS 24     // taps per phase when not decimating
+#define RESAMP_MAX_RATIO 64   // either way, the filter grows with the decimation
+
+struct resampler {
+	double ratio;         // output rate / input rate
+	uint64_t step;        // input samples per output sample, 32.32 fixed point
+	uint64_t t;           // position of the next output in re/im, 32.32
+	size_t ntap;          // multiple of 4
+	float *bank;          // RESAMP_PHASES + 1 rows of ntap coefficients, oldest sample first
+	float *delta;         // RESAMP_PHASES rows, bank row ph + 1 minus row ph
+	float *re, *im;       // ntap - 1 samples of history, then the new input
+	size_t cap;
+	bool fma;             // x86 CPU with AVX and FMA, use that dot product
+};
+
+/* NULL when out of memory or the ratio is outside 1 / RESAMP_MAX_RATIO .. RESAMP_MAX_RATIO */
+struct resampler *resampler_create(double ratio);
+void resampler_destroy(struct resampler *r);
+/* largest number of outputs n inputs can give */
+size_t resampler_max_out(const struct resampler *r, size_t n);
+/* 0 when out of memory, n >= RESAMP_MAX_RATIO inputs always give an output otherwise */
+size_t resampler_process(struct resampler *r, const float complex *in, size_t n, float complex *out);
+
+/*
+ * group delay (in samples, from the start of h) of an impulse response,
+ * taken from the phase slope of its spectrum over the whole band
+ */
+double group_delay(const float complex *h, size_t n);
+
+/* 3 point parabolic peak interpolation, returns offset in [-0.5, 0.5] */
+double parabolic_peak(double ym1, double y0, double yp1);
+
+#endif
@@ -0,0 +1,376 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * iio-replay - run a trace of libiio calls (iio-trace.c) again and sum it up
+ *
+ * Every call of the trace is made again, in order, against the simulated
+ * context (iio-sim.c, the only backend iio-replay is linked with; -u takes
+ * its "sim:..." options, slow=, attrp= and so on), and timed.  Objects
+ * are looked up by the names in the trace.  The summary lists every call,
+ * and for attribute calls every channel and attribute, with the number of
+ * calls and the time they took when recorded and when replayed, the
+ * largest recorded total first, so the attribute writes that make the
+ * startup slow against a remote context come out on top.  The setup line
+ * covers the calls before the first refill.
+ *
+ * usage:
+ *  iio-replay [-n] [-r repeat] [-u sim:options] trace
+ *
+ *  -n   only sum up the recorded times, call nothing
+ *  -r   replay the trace that many times, the replayed times are averaged
+ *  -u   sim:... options of the simulated context, no other URIs
+ **/
+
+#include <errno.h>
+#include <iio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iio-trace.h"
+
+#define MAX_ARGS  8
+#define MAX_OBJS  64
+#define MAX_KEYS  256
+
+/* devices, channels and buffers of the replay by the name in the trace */
+struct obj {
+	char name[128];
+	void *p;
+};
+
+static struct obj devs[MAX_OBJS], chans[MAX_OBJS], bufs[MAX_OBJS];
+static size_t ndevs, nchans, nbufs;
+static struct iio_context *ctx;
+
+/* what the summary is kept by */
+struct key {
+	char name[160];
+	unsigned long n;
+	double rec, rec_max;   // recorded, s
+	double rep, rep_max;   // replayed, s
+};
+
+static struct key keys[MAX_KEYS];
+static size_t nkeys;
+
+static struct {
+	bool setup;            // no refill yet in this pass
+	unsigned long calls, setup_calls, differ, failed;
+	double first, last;    // start of the first and the last call
+	double rec, setup_rec, setup_rep;
+	char uri[128];
+} tr;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void **obj_find(struct obj *t, size_t *n, const char *name, bool add)
+{
+	size_t k;
+
+	for (k = 0; k < *n; k++)
+		if (!strcmp(t[k].name, name))
+			return &t[k].p;
+	if (!add || *n == MAX_OBJS)
+		return NULL;
+	snprintf(t[*n].name, sizeof(t[*n].name), "%s", name);
+	t[*n].p = NULL;
+	return &t[(*n)++].p;
+}
+
+static void objs_clear(void)
+{
+	ndevs = nchans = 0;
+	nbufs = 0;
+}
+
+static struct iio_device *dev_get(const char *name)
+{
+	void **d = obj_find(devs, &ndevs, name, true);
+
+	if (!d || !ctx)
+		return NULL;
+	if (!*d)
+		*d = iio_context_find_device(ctx, name);
+	return *d;
+}
+
+/* channel by device, id and direction, found when the trace did not look it up itself */
+static struct iio_channel *chan_get(char **a)
+{
+	struct iio_device *dev = dev_get(a[0]);
+	char name[128];
+	void **c;
+
+	snprintf(name, sizeof(name), "%s %s %s", a[0], a[1], a[2]);
+	c = obj_find(chans, &nchans, name, true);
+	if (!c || !dev)
+		return NULL;
+	if (!*c)
+		*c = iio_device_find_channel(dev, a[1], !strcmp(a[2], "out"));
+	return *c;
+}
+
+static struct key *key_get(const char *name)
+{
+	size_t k;
+
+	for (k = 0; k < nkeys; k++)
+		if (!strcmp(keys[k].name, name))
+			return &keys[k];
+	if (nkeys == MAX_KEYS)
+		return NULL;
+	snprintf(keys[nkeys].name, sizeof(keys[nkeys].name), "%s", name);
+	return &keys[nkeys++];
+}
+
+/* make the call again, returns what it returned, *ok is false when it could not be made */
+static long long replay(const char *call, char **a, int na, bool *ok)
+{
+	struct iio_channel *chn = NULL;
+	struct iio_device *dev = NULL;
+	char buf[1024];
+	long long v;
+	void **b;
+
+	*ok = true;
+	if (!strcmp(call, "context") && na >= 1) {
+		if (ctx)
+			iio_context_destroy(ctx);
+		objs_clear();
+		ctx = iio_create_context_from_uri(tr.uri);
+		return ctx ? 0 : -errno;
+	}
+	if (!ctx) {
+		*ok = false;
+		return 0;
+	}
+	if (!strcmp(call, "context_destroy")) {
+		iio_context_destroy(ctx);
+		ctx = NULL;
+		objs_clear();
+		return 0;
+	}
+	if (!strcmp(call, "devices_count"))
+		return iio_context_get_devices_count(ctx);
+	if (!strcmp(call, "find_device") && na >= 1) {
+		void **d = obj_find(devs, &ndevs, a[0], true);
+		if (d)
+			*d = iio_context_find_device(ctx, a[0]);
+		return d && *d ? 0 : -ENODEV;
+	}
+	if (na >= 3 && (!strcmp(call, "find_channel") || !strcmp(call, "enable") || !strcmp(call, "disable") ||
+			!strncmp(call, "attr_", 5))) {
+		chn = chan_get(a);
+		if (!strcmp(call, "find_channel"))
+			return chn ? 0 : -ENOENT;
+		if (!chn) {
+			*ok = false;
+			return 0;
+		}
+	}
+	if (chn && !strcmp(call, "enable")) {
+		iio_channel_enable(chn);
+		return 0;
+	}
+	if (chn && !strcmp(call, "disable")) {
+		iio_channel_disable(chn);
+		return 0;
+	}
+	if (chn && !strcmp(call, "attr_write") && na >= 5)
+		return iio_channel_attr_write(chn, a[3], a[4]);
+	if (chn && !strcmp(call, "attr_read") && na >= 4)
+		return iio_channel_attr_read(chn, a[3], buf, sizeof(buf));
+	if (chn && !strcmp(call, "attr_write_ll") && na >= 5)
+		return iio_channel_attr_write_longlong(chn, a[3], atoll(a[4]));
+	if (chn && !strcmp(call, "attr_read_ll") && na >= 4)
+		return iio_channel_attr_read_longlong(chn, a[3], &v);
+	if (na >= 1 && (dev = dev_get(a[0])) && (b = obj_find(bufs, &nbufs, a[0], true))) {
+		if (!strcmp(call, "create_buffer") && na >= 3) {
+			if (*b)
+				iio_buffer_destroy(*b);
+			*b = iio_device_create_buffer(dev, strtoull(a[1], NULL, 0), atoi(a[2]));
+			return *b ? 0 : -errno;
+		}
+		if (*b && !strcmp(call, "buffer_destroy")) {
+			iio_buffer_destroy(*b);
+			*b = NULL;
+			return 0;
+		}
+		if (*b && !strcmp(call, "push"))
+			return iio_buffer_push(*b);
+		if (*b && !strcmp(call, "refill"))
+			return iio_buffer_refill(*b);
+	}
+	*ok = false;
+	return 0;
+}
+
+/* one line of the trace, false if it was not understood */
+static bool line(char *s, unsigned lineno, bool run, bool first_pass)
+{
+	char *tok[MAX_ARGS + 6], *save = NULL, *t, *a[MAX_ARGS], name[160];
+	int ntok = 0, na, k, eq = -1;
+	double start, lat, t0, dt = 0;
+	long long ret, got = 0;
+	bool ok = false;
+	struct key *kk;
+
+	for (t = strtok_r(s, " \t\n", &save); t && ntok < MAX_ARGS + 6; t = strtok_r(NULL, " \t\n", &save)) {
+		if (!strcmp(t, "=") && eq < 0)
+			eq = ntok;
+		tok[ntok++] = t;
+	}
+	if (ntok < 5 || eq < 3 || eq + 1 >= ntok)
+		return false;
+	start = atof(tok[0]);
+	lat = atof(tok[1]) * 1e-6;
+	ret = atoll(tok[eq + 1]);
+	na = eq - 3;
+	for (k = 0; k < na && k < MAX_ARGS; k++)
+		a[k] = iio_trace_unescape(tok[3 + k]);
+	if (na > MAX_ARGS)
+		na = MAX_ARGS;
+
+	if (!strcmp(tok[2], "refill"))
+		tr.setup = false;
+	if (run) {
+		t0 = now_sec();
+		got = replay(tok[2], a, na, &ok);
+		dt = now_sec() - t0;
+		if (!first_pass) {
+			// counted and reported once
+		} else if (!ok) {
+			tr.failed++;
+			if (tr.failed <= 10)
+				fprintf(stderr, "line %u: %s could not be made again\n", lineno, tok[2]);
+		} else if ((got < 0) != (ret < 0)) {
+			tr.differ++;
+			if (tr.differ <= 10)
+				fprintf(stderr, "line %u: %s returned %lld, recorded %lld\n", lineno, tok[2], got, ret);
+		}
+		if (tr.setup)
+			tr.setup_rep += dt;
+	}
+
+	// attribute calls are kept by channel and attribute, the others by call
+	if (!strncmp(tok[2], "attr_", 5) && na >= 4)
+		snprintf(name, sizeof(name), "%s %s %s %s %s", tok[2], a[0], a[1], a[2], a[3]);
+	else
+		snprintf(name, sizeof(name), "%s", tok[2]);
+	kk = key_get(name);
+	if (kk) {
+		if (first_pass) {
+			kk->n++;
+			kk->rec += lat;
+			if (lat > kk->rec_max)
+				kk->rec_max = lat;
+		}
+		kk->rep += dt;
+		if (dt > kk->rep_max)
+			kk->rep_max = dt;
+	}
+	if (first_pass) {
+		if (!tr.calls)
+			tr.first = start;
+		tr.last = start + lat;
+		tr.calls++;
+		tr.rec += lat;
+		if (tr.setup) {
+			tr.setup_calls++;
+			tr.setup_rec += lat;
+		}
+	}
+	return true;
+}
+
+static int by_recorded(const void *a, const void *b)
+{
+	const struct key *x = a, *y = b;
+	return x->rec < y->rec ? 1 : x->rec > y->rec ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path;
+	unsigned lineno, pass, repeat = 1;
+	bool run = true;
+	char s[4096];
+	size_t k;
+	FILE *f;
+	int opt;
+
+	snprintf(tr.uri, sizeof(tr.uri), "sim:");
+	while ((opt = getopt(argc, argv, "nr:u:")) != -1) {
+		switch (opt) {
+		case 'n': run = false; break;
+		case 'r': repeat = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+		case 'u':
+			// linked with iio-sim.c only, a real URI would fail on the first call
+			if (strncmp(optarg, "sim:", 4)) {
+				fprintf(stderr, "%s: only the simulated context, -u sim:options\n", optarg);
+				return 1;
+			}
+			snprintf(tr.uri, sizeof(tr.uri), "%s", optarg);
+			break;
+		default: optind = argc + 1; break;
+		}
+	}
+	if (optind + 1 != argc) {
+		fprintf(stderr, "usage: %s [-n] [-r repeat] [-u sim:options] trace\n", argv[0]);
+		return 1;
+	}
+	path = argv[optind];
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	if (!fgets(s, sizeof(s), f) || strncmp(s, IIO_TRACE_MAGIC, strlen(IIO_TRACE_MAGIC))) {
+		fprintf(stderr, "%s: not an iio trace\n", path);
+		return 1;
+	}
+
+	for (pass = 0; pass < (run ? repeat : 1); pass++) {
+		rewind(f);
+		tr.setup = true;
+		for (lineno = 1; fgets(s, sizeof(s), f); lineno++) {
+			if (s[0] == '#' || s[0] == '\n')
+				continue;
+			if (!line(s, lineno, run, !pass) && !pass)
+				fprintf(stderr, "%s:%u: skipped\n", path, lineno);
+		}
+		// a trace cut short leaves the context open
+		if (ctx) {
+			iio_context_destroy(ctx);
+			ctx = NULL;
+			objs_clear();
+		}
+	}
+	fclose(f);
+
+	printf("%s: %lu calls over %.3f s, %.3f s in the calls\n", path, tr.calls, tr.last - tr.first, tr.rec);
+	printf("setup (to the first refill): %lu calls, %.3f ms", tr.setup_calls, tr.setup_rec * 1e3);
+	if (run)
+		printf(", replayed on %s %.3f ms", tr.uri, tr.setup_rep * 1e3 / repeat);
+	printf("\n");
+	if (run && (tr.differ || tr.failed))
+		printf("%lu calls returned otherwise than recorded, %lu could not be made\n", tr.differ, tr.failed);
+
+	qsort(keys, nkeys, sizeof(keys[0]), by_recorded);
+	printf("%-60s %6s %10s %10s %10s %10s\n", "call", "n", "rec ms", "rec max", "rep ms", "rep max");
+	for (k = 0; k < nkeys; k++) {
+		const struct key *kk = &keys[k];
+		printf("%-60s %6lu %10.3f %10.3f", kk->name, kk->n, kk->rec * 1e3, kk->rec_max * 1e3);
+		if (run)
+			printf(" %10.3f %10.3f", kk->rep * 1e3 / repeat, kk->rep_max * 1e3);
+		printf("\n");
+	}
+	return 0;
+}
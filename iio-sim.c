@@ -0,0 +1,671 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * iio-sim.c - simulated AD9361 for the loopback tests
+ *
+ * Implements the part of the libiio API that ad9361-iiostream uses, for
+ * the three devices it looks for (ad9361-phy, cf-ad9361-lpc and
+ * cf-ad9361-dds-core-lpc), with the TX buffer looped back into RX as if
+ * a coax was connected.  Link it instead of libiio:
+ *
+ *   gcc -o ad9361-sim ad9361-iiostream.c ... iio-sim.c -lm
+ *
+ * The loopback and faults are configured with a comma separated list,
+ * either as the context URI ("sim:drop=0.01,short=0.05") or in the
+ * IIO_SIM environment variable for the default context:
+ *
+ *   lag=N          loopback delay in samples (37)
+ *   noise=X        RX noise, LSB rms (2)
+ *   cfo=HZ         frequency offset between TX and RX LO (0)
+ *   iqgain=X       RX Q amplitude relative to I (1.03)
+ *   iqphase=DEG    RX quadrature phase error (2)
+ *   rate=1         pace refills at the configured sample rate
+ *   seed=N         random seed for noise and faults
+ *
+ *   slow=P:US      a refill takes US microseconds longer with probability P
+ *   timeout=P      a refill fails with -ETIMEDOUT with probability P
+ *   drop=P         a block of samples is lost before a refill with probability P
+ *   short=P        a refill returns fewer samples with probability P
+ *   attr=NAME      every write to attribute NAME fails with -EINVAL
+ *   attrp=P        any attribute write fails with -EIO with probability P
+ *   disconnect=N   the context goes away after N refills, everything returns -EPIPE
+ *
+ * What was injected is printed to stderr when the context is destroyed.
+ *
+ * Pushed TX buffers play back to back from a queue of SIM_TX_QUEUE, like
+ * the kernel's.  When the queue runs dry the last buffer plays again,
+ * which is what the hardware was seen doing, so a buffer pushed once
+ * repeats forever.
+ **/
+
+#include <errno.h>
+#include <iio.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_MAX_CHANNELS 8
+#define SIM_MAX_ATTRS    16
+#define SIM_TX_QUEUE     4
+
+struct sim_attr {
+	char name[32];
+	char value[64];
+};
+
+struct iio_channel {
+	struct iio_device *dev;
+	char id[16];
+	bool output;
+	bool enabled;
+	int index;       // scan index for buffer layout, -1 for none
+	struct sim_attr attrs[SIM_MAX_ATTRS];
+	int nattrs;
+};
+
+struct iio_device {
+	struct iio_context *ctx;
+	const char *id;
+	const char *name;
+	struct iio_channel ch[SIM_MAX_CHANNELS];
+	int nch;
+};
+
+struct iio_buffer {
+	struct iio_device *dev;
+	char *data;
+	size_t samples;
+	size_t valid;    // samples filled by the last refill
+	ptrdiff_t step;
+	bool cyclic;
+};
+
+struct sim_faults {
+	double slow_p;
+	unsigned slow_us;
+	double timeout_p;
+	double drop_p;
+	double short_p;
+	char attr[32];
+	double attr_p;
+	long disconnect;     // refills before disconnecting, -1 for never
+};
+
+struct sim_stats {
+	unsigned long refills, slow, timeouts, drops, shorts, attr_errors;
+	unsigned long long samples, lost;
+	unsigned long pushes, tx_dry, tx_full;
+	bool disconnected;
+};
+
+struct iio_context {
+	struct iio_device dev[3];
+	// loopback state
+	int16_t *tx;         // TX0 I/Q playing
+	size_t ntx;
+	size_t tx_rd;        // next sample of tx
+	int16_t *txq[SIM_TX_QUEUE];   // pushed and waiting
+	size_t txq_n[SIM_TX_QUEUE];
+	unsigned txq_head, txq_len;
+	unsigned long long tx_time;   // RX sample time the next TX sample goes out
+	int16_t tx_cur[2];   // TX sample on air
+	unsigned long long pos;  // RX sample counter
+	unsigned lag;
+	double noise;
+	double cfo;
+	double iq_gain;      // RX IQ imbalance
+	double iq_phase;     // radians
+	bool paced;
+	double next_time;
+	uint64_t rng;
+	struct sim_faults faults;
+	struct sim_stats stats;
+};
+
+static uint64_t sim_rand(struct iio_context *ctx)
+{
+	// xorshift64*
+	ctx->rng ^= ctx->rng >> 12;
+	ctx->rng ^= ctx->rng << 25;
+	ctx->rng ^= ctx->rng >> 27;
+	return ctx->rng * 2685821657736338717ULL;
+}
+
+static double sim_uniform(struct iio_context *ctx)
+{
+	return (sim_rand(ctx) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool sim_chance(struct iio_context *ctx, double p)
+{
+	return p > 0 && sim_uniform(ctx) < p;
+}
+
+static double sim_gauss(struct iio_context *ctx)
+{
+	double u = sim_uniform(ctx) + 1e-300, v = sim_uniform(ctx);
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static double sim_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static struct iio_channel *add_ch(struct iio_device *dev, const char *id, bool output, int index)
+{
+	struct iio_channel *ch = &dev->ch[dev->nch++];
+
+	ch->dev = dev;
+	snprintf(ch->id, sizeof(ch->id), "%s", id);
+	ch->output = output;
+	ch->index = index;
+	return ch;
+}
+
+static struct sim_attr *find_attr(const struct iio_channel *chn, const char *name, bool create)
+{
+	struct iio_channel *ch = (struct iio_channel *)chn;
+	int k;
+
+	for (k = 0; k < ch->nattrs; k++)
+		if (!strcmp(ch->attrs[k].name, name))
+			return &ch->attrs[k];
+	if (!create || ch->nattrs == SIM_MAX_ATTRS)
+		return NULL;
+	snprintf(ch->attrs[ch->nattrs].name, sizeof(ch->attrs[0].name), "%s", name);
+	return &ch->attrs[ch->nattrs++];
+}
+
+static void set_attr(struct iio_channel *ch, const char *name, const char *value)
+{
+	struct sim_attr *a = find_attr(ch, name, true);
+	if (a)
+		snprintf(a->value, sizeof(a->value), "%s", value);
+}
+
+static long long attr_ll(const struct iio_channel *ch, const char *name, long long def)
+{
+	struct sim_attr *a = find_attr(ch, name, false);
+	return a ? atoll(a->value) : def;
+}
+
+static void parse_params(struct iio_context *ctx, const char *params)
+{
+	char buf[256], *tok, *save = NULL;
+
+	snprintf(buf, sizeof(buf), "%s", params ? params : "");
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		char *val = strchr(tok, '=');
+		if (!val) {
+			fprintf(stderr, "iio-sim: ignoring \"%s\"\n", tok);
+			continue;
+		}
+		*val++ = '\0';
+		if (!strcmp(tok, "lag"))            ctx->lag = atoi(val);
+		else if (!strcmp(tok, "noise"))     ctx->noise = atof(val);
+		else if (!strcmp(tok, "cfo"))       ctx->cfo = atof(val);
+		else if (!strcmp(tok, "iqgain"))    ctx->iq_gain = atof(val);
+		else if (!strcmp(tok, "iqphase"))   ctx->iq_phase = atof(val) * M_PI / 180.0;
+		else if (!strcmp(tok, "rate"))      ctx->paced = atoi(val) != 0;
+		else if (!strcmp(tok, "seed"))      ctx->rng = strtoull(val, NULL, 0) | 1;
+		else if (!strcmp(tok, "slow"))      sscanf(val, "%lf:%u", &ctx->faults.slow_p, &ctx->faults.slow_us);
+		else if (!strcmp(tok, "timeout"))   ctx->faults.timeout_p = atof(val);
+		else if (!strcmp(tok, "drop"))      ctx->faults.drop_p = atof(val);
+		else if (!strcmp(tok, "short"))     ctx->faults.short_p = atof(val);
+		else if (!strcmp(tok, "attr"))      snprintf(ctx->faults.attr, sizeof(ctx->faults.attr), "%s", val);
+		else if (!strcmp(tok, "attrp"))     ctx->faults.attr_p = atof(val);
+		else if (!strcmp(tok, "disconnect")) ctx->faults.disconnect = atol(val);
+		else fprintf(stderr, "iio-sim: unknown parameter \"%s\"\n", tok);
+	}
+}
+
+static struct iio_context *sim_create(const char *params)
+{
+	struct iio_context *ctx = calloc(1, sizeof(*ctx));
+	struct iio_device *phy, *rx, *tx;
+	char id[16];
+	int k;
+
+	if (!ctx)
+		return NULL;
+	ctx->lag = 37;
+	ctx->noise = 2.0;
+	ctx->iq_gain = 1.03;
+	ctx->iq_phase = 2.0 * M_PI / 180.0;
+	ctx->rng = 0x9e3779b97f4a7c15ULL;
+	ctx->faults.disconnect = -1;
+	parse_params(ctx, params);
+
+	phy = &ctx->dev[0];
+	phy->id = "iio:device0";
+	phy->name = "ad9361-phy";
+	for (k = 0; k < 2; k++) {
+		snprintf(id, sizeof(id), "voltage%d", k);
+		set_attr(add_ch(phy, id, false, -1), "hardwaregain", "0");
+		set_attr(add_ch(phy, id, true, -1), "hardwaregain", "-10");
+	}
+	add_ch(phy, "altvoltage0", true, -1);  // RX LO
+	add_ch(phy, "altvoltage1", true, -1);  // TX LO
+
+	rx = &ctx->dev[1];
+	rx->id = "iio:device3";
+	rx->name = "cf-ad9361-lpc";
+	tx = &ctx->dev[2];
+	tx->id = "iio:device2";
+	tx->name = "cf-ad9361-dds-core-lpc";
+	for (k = 0; k < 4; k++) {
+		snprintf(id, sizeof(id), "voltage%d", k);
+		add_ch(rx, id, false, k);
+		add_ch(tx, id, true, k);
+	}
+
+	for (k = 0; k < 3; k++)
+		ctx->dev[k].ctx = ctx;
+	return ctx;
+}
+
+struct iio_context *iio_create_default_context(void)
+{
+	return sim_create(getenv("IIO_SIM"));
+}
+
+struct iio_context *iio_create_context_from_uri(const char *uri)
+{
+	if (strncmp(uri, "sim:", 4) && strcmp(uri, "sim")) {
+		errno = ENOENT;
+		return NULL;
+	}
+	return sim_create(uri[3] ? uri + 4 : NULL);
+}
+
+void iio_context_destroy(struct iio_context *ctx)
+{
+	struct sim_stats *st = &ctx->stats;
+
+	fprintf(stderr, "iio-sim: %lu refills, %llu samples; injected %lu slow, %lu timeouts, "
+		"%lu dropped blocks (%llu samples), %lu short reads, %lu attribute errors%s\n",
+		st->refills, st->samples, st->slow, st->timeouts, st->drops, st->lost,
+		st->shorts, st->attr_errors, st->disconnected ? ", disconnected" : "");
+	if (st->pushes > 1 && (st->tx_dry || st->tx_full))
+		fprintf(stderr, "iio-sim: %lu TX buffers pushed, the queue ran dry %lu times and was full %lu times\n",
+			st->pushes, st->tx_dry, st->tx_full);
+	free(ctx->tx);
+	while (ctx->txq_len--)
+		free(ctx->txq[(ctx->txq_head + ctx->txq_len) % SIM_TX_QUEUE]);
+	free(ctx);
+}
+
+unsigned int iio_context_get_devices_count(const struct iio_context *ctx)
+{
+	return 3;
+}
+
+struct iio_device *iio_context_find_device(const struct iio_context *ctx, const char *name)
+{
+	int k;
+
+	for (k = 0; k < 3; k++)
+		if (!strcmp(ctx->dev[k].name, name) || !strcmp(ctx->dev[k].id, name))
+			return (struct iio_device *)&ctx->dev[k];
+	return NULL;
+}
+
+const char *iio_device_get_name(const struct iio_device *dev)
+{
+	return dev->name;
+}
+
+const char *iio_device_get_id(const struct iio_device *dev)
+{
+	return dev->id;
+}
+
+struct iio_channel *iio_device_find_channel(const struct iio_device *dev, const char *name, bool output)
+{
+	int k;
+
+	for (k = 0; k < dev->nch; k++)
+		if (dev->ch[k].output == output && !strcmp(dev->ch[k].id, name))
+			return (struct iio_channel *)&dev->ch[k];
+	return NULL;
+}
+
+const struct iio_device *iio_channel_get_device(const struct iio_channel *chn)
+{
+	return chn->dev;
+}
+
+const char *iio_channel_get_id(const struct iio_channel *chn)
+{
+	return chn->id;
+}
+
+bool iio_channel_is_output(const struct iio_channel *chn)
+{
+	return chn->output;
+}
+
+bool iio_channel_is_enabled(const struct iio_channel *chn)
+{
+	return chn->enabled;
+}
+
+void iio_channel_enable(struct iio_channel *chn)
+{
+	chn->enabled = chn->index >= 0;
+}
+
+void iio_channel_disable(struct iio_channel *chn)
+{
+	chn->enabled = false;
+}
+
+static bool sim_gone(const struct iio_context *ctx)
+{
+	return ctx->stats.disconnected;
+}
+
+ssize_t iio_channel_attr_write(const struct iio_channel *chn, const char *attr, const char *src)
+{
+	struct iio_context *ctx = chn->dev->ctx;
+	struct sim_attr *a;
+
+	if (sim_gone(ctx))
+		return -EPIPE;
+	if (!strcmp(ctx->faults.attr, attr)) {
+		ctx->stats.attr_errors++;
+		return -EINVAL;
+	}
+	if (sim_chance(ctx, ctx->faults.attr_p)) {
+		ctx->stats.attr_errors++;
+		return -EIO;
+	}
+	a = find_attr(chn, attr, true);
+	if (!a)
+		return -ENOSPC;
+	snprintf(a->value, sizeof(a->value), "%s", src);
+	return strlen(src) + 1;
+}
+
+ssize_t iio_channel_attr_read(const struct iio_channel *chn, const char *attr, char *dst, size_t len)
+{
+	struct sim_attr *a;
+
+	if (sim_gone(chn->dev->ctx))
+		return -EPIPE;
+	a = find_attr(chn, attr, false);
+	if (!a)
+		return -ENOENT;
+	snprintf(dst, len, "%s", a->value);
+	return strlen(dst) + 1;
+}
+
+int iio_channel_attr_write_longlong(const struct iio_channel *chn, const char *attr, long long val)
+{
+	char buf[32];
+	ssize_t ret;
+
+	snprintf(buf, sizeof(buf), "%lld", val);
+	ret = iio_channel_attr_write(chn, attr, buf);
+	return ret < 0 ? (int)ret : 0;
+}
+
+int iio_channel_attr_read_longlong(const struct iio_channel *chn, const char *attr, long long *val)
+{
+	char buf[64];
+	ssize_t ret = iio_channel_attr_read(chn, attr, buf, sizeof(buf));
+
+	if (ret < 0)
+		return (int)ret;
+	*val = atoll(buf);
+	return 0;
+}
+
+struct iio_buffer *iio_device_create_buffer(const struct iio_device *dev, size_t samples_count, bool cyclic)
+{
+	struct iio_buffer *buf;
+	int k, nen = 0;
+
+	if (sim_gone(dev->ctx)) {
+		errno = EPIPE;
+		return NULL;
+	}
+	for (k = 0; k < dev->nch; k++)
+		nen += dev->ch[k].enabled;
+	if (!nen || !samples_count) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return NULL;
+	buf->dev = (struct iio_device *)dev;
+	buf->samples = samples_count;
+	buf->step = nen * sizeof(int16_t);
+	buf->cyclic = cyclic;
+	buf->data = calloc(samples_count, buf->step);
+	if (!buf->data) {
+		free(buf);
+		return NULL;
+	}
+	buf->valid = dev->ch[0].output ? samples_count : 0;
+	return buf;
+}
+
+void iio_buffer_destroy(struct iio_buffer *buf)
+{
+	free(buf->data);
+	free(buf);
+}
+
+const struct iio_device *iio_buffer_get_device(const struct iio_buffer *buf)
+{
+	return buf->dev;
+}
+
+ptrdiff_t iio_buffer_step(const struct iio_buffer *buf)
+{
+	return buf->step;
+}
+
+void *iio_buffer_start(const struct iio_buffer *buf)
+{
+	return buf->data;
+}
+
+void *iio_buffer_end(const struct iio_buffer *buf)
+{
+	return buf->data + buf->valid * buf->step;
+}
+
+void *iio_buffer_first(const struct iio_buffer *buf, const struct iio_channel *chn)
+{
+	const struct iio_device *dev = buf->dev;
+	size_t off = 0;
+	int k;
+
+	// enabled channels are interleaved in scan index order
+	for (k = 0; k < dev->nch; k++)
+		if (dev->ch[k].enabled && dev->ch[k].index < chn->index)
+			off += sizeof(int16_t);
+	return buf->data + off;
+}
+
+ssize_t iio_buffer_push(struct iio_buffer *buf)
+{
+	struct iio_context *ctx = buf->dev->ctx;
+	const char *p = iio_buffer_first(buf, &buf->dev->ch[0]);
+	int16_t *tx;
+	size_t s;
+
+	if (sim_gone(ctx))
+		return -EPIPE;
+	tx = malloc(buf->samples * 2 * sizeof(*tx));
+	if (!tx)
+		return -ENOMEM;
+	for (s = 0; s < buf->samples; s++, p += buf->step) {
+		tx[2*s]   = ((const int16_t *)p)[0];
+		tx[2*s+1] = ((const int16_t *)p)[1];
+	}
+	ctx->stats.pushes++;
+	if (!ctx->tx) {
+		// the first buffer goes out right away
+		ctx->tx = tx;
+		ctx->ntx = buf->samples;
+		ctx->tx_time = ctx->pos;
+		return buf->samples * buf->step;
+	}
+	if (ctx->txq_len == SIM_TX_QUEUE) {
+		// the real push would block, make room by losing the oldest
+		ctx->stats.tx_full++;
+		free(ctx->txq[ctx->txq_head]);
+		ctx->txq_head = (ctx->txq_head + 1) % SIM_TX_QUEUE;
+		ctx->txq_len--;
+	}
+	s = (ctx->txq_head + ctx->txq_len++) % SIM_TX_QUEUE;
+	ctx->txq[s] = tx;
+	ctx->txq_n[s] = buf->samples;
+	return buf->samples * buf->step;
+}
+
+/* move the TX stream on by one sample */
+static void sim_tx_next(struct iio_context *ctx)
+{
+	if (ctx->tx_rd == ctx->ntx) {
+		if (ctx->txq_len) {
+			free(ctx->tx);
+			ctx->tx = ctx->txq[ctx->txq_head];
+			ctx->ntx = ctx->txq_n[ctx->txq_head];
+			ctx->txq_head = (ctx->txq_head + 1) % SIM_TX_QUEUE;
+			ctx->txq_len--;
+		} else {
+			ctx->stats.tx_dry++;
+		}
+		ctx->tx_rd = 0;
+	}
+	ctx->tx_cur[0] = ctx->tx[2 * ctx->tx_rd];
+	ctx->tx_cur[1] = ctx->tx[2 * ctx->tx_rd + 1];
+	ctx->tx_rd++;
+	ctx->tx_time++;
+}
+
+static int16_t sim_adc(double v)
+{
+	long r = lround(v);
+	// 12 bit converter, sign extended
+	if (r > 2047)  r = 2047;
+	if (r < -2048) r = -2048;
+	return (int16_t)r;
+}
+
+/* one received sample of the loopback with gain g, before noise */
+static void sim_loopback(struct iio_context *ctx, unsigned long long n, double fs, double g,
+			 double *re, double *im)
+{
+	double ti, tq, ph, mag2;
+
+	if (!ctx->tx || n < ctx->tx_time + ctx->lag) {
+		// nothing transmitted yet, just mains hum getting in
+		*re = 100.0 * sin(2.0 * M_PI * 60.0 * (double)n / fs);
+		*im = 0;
+		return;
+	}
+
+	// RX sample n sees what went out lag samples earlier
+	while (ctx->tx_time + ctx->lag <= n)
+		sim_tx_next(ctx);
+	// TX is MSB aligned, RX LSB aligned
+	ti = ctx->tx_cur[0] / 16.0 * g;
+	tq = ctx->tx_cur[1] / 16.0 * g;
+
+	// a touch of third order compression, 1 dB at about full scale
+	mag2 = (ti * ti + tq * tq) / (2048.0 * 2048.0);
+	ti *= 1.0 - 0.11 * mag2;
+	tq *= 1.0 - 0.11 * mag2;
+
+	if (ctx->cfo != 0.0) {
+		ph = 2.0 * M_PI * ctx->cfo * (double)n / fs;
+		*re = ti * cos(ph) - tq * sin(ph);
+		*im = ti * sin(ph) + tq * cos(ph);
+	} else {
+		*re = ti;
+		*im = tq;
+	}
+}
+
+ssize_t iio_buffer_refill(struct iio_buffer *buf)
+{
+	struct iio_context *ctx = buf->dev->ctx;
+	struct sim_faults *f = &ctx->faults;
+	size_t s, n = buf->samples;
+	int nch = (int)(buf->step / sizeof(int16_t));
+	double fs, g;
+
+	if (sim_gone(ctx))
+		return -EPIPE;
+	if (f->disconnect >= 0 && ctx->stats.refills >= (unsigned long)f->disconnect) {
+		ctx->stats.disconnected = true;
+		return -EPIPE;
+	}
+	ctx->stats.refills++;
+
+	if (sim_chance(ctx, f->timeout_p)) {
+		ctx->stats.timeouts++;
+		return -ETIMEDOUT;
+	}
+	if (sim_chance(ctx, f->slow_p)) {
+		ctx->stats.slow++;
+		usleep(f->slow_us);
+	}
+	if (sim_chance(ctx, f->drop_p)) {
+		// the samples of one buffer went by while nobody was listening
+		ctx->stats.drops++;
+		ctx->stats.lost += n;
+		ctx->pos += n;
+	}
+	if (sim_chance(ctx, f->short_p)) {
+		ctx->stats.shorts++;
+		n = 1 + sim_rand(ctx) % (n - 1 ? n - 1 : 1);
+	}
+
+	fs = (double)attr_ll(&ctx->dev[0].ch[0], "sampling_frequency", 3000000);
+	// rx hardwaregain is gain, tx hardwaregain is (negative) attenuation, 0 dB at 50/-30
+	g = pow(10.0, (attr_ll(&ctx->dev[0].ch[0], "hardwaregain", 0) +
+		       attr_ll(&ctx->dev[0].ch[1], "hardwaregain", -10) - 20) / 20.0);
+
+	for (s = 0; s < n; s++) {
+		int16_t *p = (int16_t *)(buf->data + s * buf->step);
+		double re, im;
+		int c;
+
+		sim_loopback(ctx, ctx->pos + s, fs, g, &re, &im);
+		// RX IQ imbalance, DC offset and noise, the second RX channel sees the signal 30 degrees later
+		for (c = 0; c + 1 < nch; c += 2) {
+			double r = c ? 0.9 * (re * cos(M_PI / 6) - im * sin(M_PI / 6)) : re;
+			double i = c ? 0.9 * (re * sin(M_PI / 6) + im * cos(M_PI / 6)) : im;
+			i = ctx->iq_gain * (i * cos(ctx->iq_phase) + r * sin(ctx->iq_phase));
+			p[c]   = sim_adc(r + 12.0 + ctx->noise * sim_gauss(ctx));
+			p[c+1] = sim_adc(i - 7.0 + ctx->noise * sim_gauss(ctx));
+		}
+	}
+	ctx->pos += n;
+	ctx->stats.samples += n;
+	buf->valid = n;
+
+	if (ctx->paced) {
+		// hand out samples no faster than the radio would
+		double now = sim_now();
+		if (ctx->next_time < now)
+			ctx->next_time = now;
+		ctx->next_time += n / fs;
+		if (ctx->next_time > now)
+			usleep((useconds_t)((ctx->next_time - now) * 1e6));
+	}
+	return n * buf->step;
+}
@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * iio-trace.c - record the libiio calls of a run with their latency
+ *
+ * Linked in with the linker's --wrap for every traced call (see
+ * TRACE_WRAP in the Makefile), so the program calls __wrap_iio_x, which
+ * calls the real iio_x of libiio or iio-sim.c and, when the IIO_TRACE
+ * environment variable names a file, writes the call, its arguments, what
+ * it returned and how long it took there (format in iio-trace.h):
+ *
+ *   IIO_TRACE=startup.trace ./ad9361-iiostream -n 100 ip:192.168.2.1
+ *
+ * Without IIO_TRACE a call costs one test more, the clock is only read
+ * when tracing.  The per sample buffer accessors (first, end, step) are
+ * not traced, refill and push are.  The program makes its libiio calls
+ * from one thread, so neither is this locked.  iio-replay runs a trace
+ * again and sums it up.
+ **/
+
+#include <errno.h>
+#include <iio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iio-trace.h"
+
+struct iio_context *__real_iio_create_default_context(void);
+struct iio_context *__real_iio_create_context_from_uri(const char *uri);
+void __real_iio_context_destroy(struct iio_context *ctx);
+unsigned int __real_iio_context_get_devices_count(const struct iio_context *ctx);
+struct iio_device *__real_iio_context_find_device(const struct iio_context *ctx, const char *name);
+struct iio_channel *__real_iio_device_find_channel(const struct iio_device *dev, const char *name, bool output);
+void __real_iio_channel_enable(struct iio_channel *chn);
+void __real_iio_channel_disable(struct iio_channel *chn);
+ssize_t __real_iio_channel_attr_write(const struct iio_channel *chn, const char *attr, const char *src);
+ssize_t __real_iio_channel_attr_read(const struct iio_channel *chn, const char *attr, char *dst, size_t len);
+int __real_iio_channel_attr_write_longlong(const struct iio_channel *chn, const char *attr, long long val);
+int __real_iio_channel_attr_read_longlong(const struct iio_channel *chn, const char *attr, long long *val);
+struct iio_buffer *__real_iio_device_create_buffer(const struct iio_device *dev, size_t samples_count, bool cyclic);
+void __real_iio_buffer_destroy(struct iio_buffer *buf);
+ssize_t __real_iio_buffer_push(struct iio_buffer *buf);
+ssize_t __real_iio_buffer_refill(struct iio_buffer *buf);
+
+static FILE *trace;
+static int trace_state;   // 0 not looked at IIO_TRACE yet, 1 tracing, -1 not
+static double trace_t0;      // start of the first call
+
+static double trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void trace_close(void)
+{
+	fclose(trace);
+}
+
+static bool tracing(void)
+{
+	const char *path;
+
+	if (trace_state)
+		return trace_state > 0;
+	trace_state = -1;
+	path = getenv("IIO_TRACE");
+	if (!path || !*path)
+		return false;
+	trace = fopen(path, "w");
+	if (!trace) {
+		perror(path);
+		return false;
+	}
+	fprintf(trace, "%s\n# start_s latency_us call arguments = return [value]\n", IIO_TRACE_MAGIC);
+	trace_state = 1;
+	atexit(trace_close);
+	return true;
+}
+
+/* start of a line, t0 is when the call started and t1 when it returned */
+static void begin(double t0, double t1, const char *call)
+{
+	if (!trace_t0)
+		trace_t0 = t0;
+	fprintf(trace, "%.6f %.1f %s", t0 - trace_t0, (t1 - t0) * 1e6, call);
+}
+
+static void arg(const char *s)
+{
+	fputc(' ', trace);
+	iio_trace_put(trace, s);
+}
+
+static void dev_arg(const struct iio_device *dev)
+{
+	const char *name = dev ? iio_device_get_name(dev) : NULL;
+	arg(name ? name : dev ? iio_device_get_id(dev) : NULL);
+}
+
+static void chan_arg(const struct iio_channel *chn)
+{
+	dev_arg(iio_channel_get_device(chn));
+	arg(iio_channel_get_id(chn));
+	arg(iio_channel_is_output(chn) ? "out" : "in");
+}
+
+static void end(long long ret)
+{
+	fprintf(trace, " = %lld\n", ret);
+}
+
+struct iio_context *__wrap_iio_create_default_context(void)
+{
+	double t0;
+	struct iio_context *ctx;
+	int err;
+
+	if (!tracing())
+		return __real_iio_create_default_context();
+	t0 = trace_now();
+	ctx = __real_iio_create_default_context();
+	err = errno;
+	begin(t0, trace_now(), "context");
+	arg(NULL);
+	end(ctx ? 0 : -err);
+	errno = err;
+	return ctx;
+}
+
+struct iio_context *__wrap_iio_create_context_from_uri(const char *uri)
+{
+	double t0;
+	struct iio_context *ctx;
+	int err;
+
+	if (!tracing())
+		return __real_iio_create_context_from_uri(uri);
+	t0 = trace_now();
+	ctx = __real_iio_create_context_from_uri(uri);
+	err = errno;
+	begin(t0, trace_now(), "context");
+	arg(uri);
+	end(ctx ? 0 : -err);
+	errno = err;
+	return ctx;
+}
+
+void __wrap_iio_context_destroy(struct iio_context *ctx)
+{
+	double t0;
+
+	if (!tracing()) {
+		__real_iio_context_destroy(ctx);
+		return;
+	}
+	t0 = trace_now();
+	__real_iio_context_destroy(ctx);
+	begin(t0, trace_now(), "context_destroy");
+	end(0);
+	fflush(trace);
+}
+
+unsigned int __wrap_iio_context_get_devices_count(const struct iio_context *ctx)
+{
+	double t0;
+	unsigned int n;
+
+	if (!tracing())
+		return __real_iio_context_get_devices_count(ctx);
+	t0 = trace_now();
+	n = __real_iio_context_get_devices_count(ctx);
+	begin(t0, trace_now(), "devices_count");
+	end(n);
+	return n;
+}
+
+struct iio_device *__wrap_iio_context_find_device(const struct iio_context *ctx, const char *name)
+{
+	double t0;
+	struct iio_device *dev;
+
+	if (!tracing())
+		return __real_iio_context_find_device(ctx, name);
+	t0 = trace_now();
+	dev = __real_iio_context_find_device(ctx, name);
+	begin(t0, trace_now(), "find_device");
+	arg(name);
+	end(dev ? 0 : -ENODEV);
+	return dev;
+}
+
+struct iio_channel *__wrap_iio_device_find_channel(const struct iio_device *dev, const char *name, bool output)
+{
+	double t0;
+	struct iio_channel *chn;
+
+	if (!tracing())
+		return __real_iio_device_find_channel(dev, name, output);
+	t0 = trace_now();
+	chn = __real_iio_device_find_channel(dev, name, output);
+	begin(t0, trace_now(), "find_channel");
+	dev_arg(dev);
+	arg(name);
+	arg(output ? "out" : "in");
+	end(chn ? 0 : -ENOENT);
+	return chn;
+}
+
+void __wrap_iio_channel_enable(struct iio_channel *chn)
+{
+	double t0;
+
+	if (!tracing()) {
+		__real_iio_channel_enable(chn);
+		return;
+	}
+	t0 = trace_now();
+	__real_iio_channel_enable(chn);
+	begin(t0, trace_now(), "enable");
+	chan_arg(chn);
+	end(0);
+}
+
+void __wrap_iio_channel_disable(struct iio_channel *chn)
+{
+	double t0;
+
+	if (!tracing()) {
+		__real_iio_channel_disable(chn);
+		return;
+	}
+	t0 = trace_now();
+	__real_iio_channel_disable(chn);
+	begin(t0, trace_now(), "disable");
+	chan_arg(chn);
+	end(0);
+}
+
+ssize_t __wrap_iio_channel_attr_write(const struct iio_channel *chn, const char *attr, const char *src)
+{
+	double t0;
+	ssize_t ret;
+
+	if (!tracing())
+		return __real_iio_channel_attr_write(chn, attr, src);
+	t0 = trace_now();
+	ret = __real_iio_channel_attr_write(chn, attr, src);
+	begin(t0, trace_now(), "attr_write");
+	chan_arg(chn);
+	arg(attr);
+	arg(src);
+	end(ret);
+	return ret;
+}
+
+ssize_t __wrap_iio_channel_attr_read(const struct iio_channel *chn, const char *attr, char *dst, size_t len)
+{
+	double t0;
+	ssize_t ret;
+
+	if (!tracing())
+		return __real_iio_channel_attr_read(chn, attr, dst, len);
+	t0 = trace_now();
+	ret = __real_iio_channel_attr_read(chn, attr, dst, len);
+	begin(t0, trace_now(), "attr_read");
+	chan_arg(chn);
+	arg(attr);
+	fprintf(trace, " = %lld", (long long)ret);
+	arg(ret >= 0 ? dst : NULL);
+	fputc('\n', trace);
+	return ret;
+}
+
+int __wrap_iio_channel_attr_write_longlong(const struct iio_channel *chn, const char *attr, long long val)
+{
+	double t0;
+	int ret;
+
+	if (!tracing())
+		return __real_iio_channel_attr_write_longlong(chn, attr, val);
+	t0 = trace_now();
+	ret = __real_iio_channel_attr_write_longlong(chn, attr, val);
+	begin(t0, trace_now(), "attr_write_ll");
+	chan_arg(chn);
+	arg(attr);
+	fprintf(trace, " %lld", val);
+	end(ret);
+	return ret;
+}
+
+int __wrap_iio_channel_attr_read_longlong(const struct iio_channel *chn, const char *attr, long long *val)
+{
+	double t0;
+	int ret;
+
+	if (!tracing())
+		return __real_iio_channel_attr_read_longlong(chn, attr, val);
+	t0 = trace_now();
+	ret = __real_iio_channel_attr_read_longlong(chn, attr, val);
+	begin(t0, trace_now(), "attr_read_ll");
+	chan_arg(chn);
+	arg(attr);
+	fprintf(trace, " = %d %lld\n", ret, ret ? 0 : *val);
+	return ret;
+}
+
+struct iio_buffer *__wrap_iio_device_create_buffer(const struct iio_device *dev, size_t samples_count, bool cyclic)
+{
+	double t0;
+	struct iio_buffer *buf;
+	int err;
+
+	if (!tracing())
+		return __real_iio_device_create_buffer(dev, samples_count, cyclic);
+	t0 = trace_now();
+	buf = __real_iio_device_create_buffer(dev, samples_count, cyclic);
+	err = errno;
+	begin(t0, trace_now(), "create_buffer");
+	dev_arg(dev);
+	fprintf(trace, " %zu %d", samples_count, cyclic);
+	end(buf ? 0 : -err);
+	errno = err;
+	return buf;
+}
+
+void __wrap_iio_buffer_destroy(struct iio_buffer *buf)
+{
+	const struct iio_device *dev = iio_buffer_get_device(buf);
+	double t0;
+
+	if (!tracing()) {
+		__real_iio_buffer_destroy(buf);
+		return;
+	}
+	t0 = trace_now();
+	__real_iio_buffer_destroy(buf);
+	begin(t0, trace_now(), "buffer_destroy");
+	dev_arg(dev);
+	end(0);
+}
+
+ssize_t __wrap_iio_buffer_push(struct iio_buffer *buf)
+{
+	double t0;
+	ssize_t ret;
+
+	if (!tracing())
+		return __real_iio_buffer_push(buf);
+	t0 = trace_now();
+	ret = __real_iio_buffer_push(buf);
+	begin(t0, trace_now(), "push");
+	dev_arg(iio_buffer_get_device(buf));
+	end(ret);
+	return ret;
+}
+
+ssize_t __wrap_iio_buffer_refill(struct iio_buffer *buf)
+{
+	double t0;
+	ssize_t ret;
+
+	if (!tracing())
+		return __real_iio_buffer_refill(buf);
+	t0 = trace_now();
+	ret = __real_iio_buffer_refill(buf);
+	begin(t0, trace_now(), "refill");
+	dev_arg(iio_buffer_get_device(buf));
+	end(ret);
+	return ret;
+}
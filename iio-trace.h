@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * iio-trace.h - trace file of the libiio calls, written by iio-trace.c and
+ * read back by iio-replay.c
+ *
+ * One line per call:
+ *
+ *   <start s> <latency us> <call> <arguments> = <return> [<value read>]
+ *
+ * with the start relative to the first call.  Objects are named rather
+ * than given as pointers, a device by its name (or id), a channel by its
+ * device, id and "in" or "out", a buffer by its device.  The calls and
+ * their arguments:
+ *
+ *   context <uri or ->                       0 or -errno
+ *   context_destroy                          0
+ *   devices_count                            count
+ *   find_device <dev>                        0 or -ENODEV
+ *   find_channel <dev> <chan> <dir>          0 or -ENOENT
+ *   enable <dev> <chan> <dir>                0
+ *   disable <dev> <chan> <dir>               0
+ *   attr_write <dev> <chan> <dir> <attr> <value>    bytes or -errno
+ *   attr_read <dev> <chan> <dir> <attr>             bytes or -errno, value
+ *   attr_write_ll <dev> <chan> <dir> <attr> <value> 0 or -errno
+ *   attr_read_ll <dev> <chan> <dir> <attr>          0 or -errno, value
+ *   create_buffer <dev> <samples> <cyclic>   0 or -errno
+ *   buffer_destroy <dev>                     0
+ *   push <dev>                               bytes or -errno
+ *   refill <dev>                             bytes or -errno
+ *
+ * Strings have white space, % and non printing characters written as %xx,
+ * a missing or empty one is -.
+ * The first line is IIO_TRACE_MAGIC, lines starting with # are comments.
+ **/
+
+#ifndef IIO_TRACE_H
+#define IIO_TRACE_H
+
+#include <stdio.h>
+#include <string.h>
+
+#define IIO_TRACE_MAGIC "# iio trace 1"
+
+/* s with white space, % and control characters as %xx */
+static inline void iio_trace_put(FILE *f, const char *s)
+{
+	if (!s || !*s) {
+		fputc('-', f);
+		return;
+	}
+	if (!strcmp(s, "-")) {
+		fputs("%2d", f);
+		return;
+	}
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c <= ' ' || c == '%' || c >= 0x7f)
+			fprintf(f, "%%%02x", c);
+		else
+			fputc(c, f);
+	}
+}
+
+/* undo iio_trace_put in place */
+static inline char *iio_trace_unescape(char *s)
+{
+	char *d = s, *r = s;
+	unsigned c;
+
+	if (!strcmp(s, "-")) {
+		*s = 0;
+		return s;
+	}
+	while (*r) {
+		if (r[0] == '%' && r[1] && r[2] && sscanf(r + 1, "%2x", &c) == 1) {
+			*d++ = (char)c;
+			r += 3;
+		} else {
+			*d++ = *r++;
+		}
+	}
+	*d = 0;
+	return s;
+}
+
+#endif
@@ -0,0 +1,1020 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * iqconv.c - sample format conversion kernels
+ **/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__F16C__) || (defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__))
+#include <immintrin.h>   // also for the F16C chosen at run time
+#endif
+#if defined(__SSE4_2__) || (defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)))
+#include <nmmintrin.h>   // also for the CRC32C chosen at run time
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "iqconv.h"
+
+void iq_extract_ref(const void *first, ptrdiff_t step, size_t n, int16_t *iq)
+{
+	const char *p = first;
+	size_t s;
+
+	for (s = 0; s < n; s++, p += step) {
+		iq[2*s]   = ((const int16_t *)p)[0];
+		iq[2*s+1] = ((const int16_t *)p)[1];
+	}
+}
+
+void iq_magnitude_ref(const int16_t *iq, size_t n, float *mag)
+{
+	size_t s;
+
+	for (s = 0; s < n; s++) {
+		int32_t i = iq[2*s], q = iq[2*s+1];
+		mag[s] = sqrtf((float)(i * i + q * q));
+	}
+}
+
+void iq_phase_ref(const int16_t *iq, size_t n, float *rad)
+{
+	size_t s;
+
+	for (s = 0; s < n; s++)
+		rad[s] = atan2f(iq[2*s+1], iq[2*s]);
+}
+
+/* atan(a) for a in [0, 1], max error about 1e-5 rad */
+#define ATAN_C1  0.99986600f
+#define ATAN_C3 -0.33029950f
+#define ATAN_C5  0.18014100f
+#define ATAN_C7 -0.08513300f
+#define ATAN_C9  0.02083510f
+
+#if defined(__SSE2__)
+
+void iq_extract(const void *first, ptrdiff_t step, size_t n, int16_t *iq)
+{
+	const char *p = first;
+	size_t s, nvec = n & ~(size_t)3;
+
+	if (step == 2 * sizeof(int16_t)) {
+		// one channel: already interleaved I/Q
+		memcpy(iq, first, n * step);
+		return;
+	}
+	if (step == 4 * sizeof(int16_t)) {
+		// two channels: I0 Q0 I1 Q1, keep every other 32 bit pair
+		for (s = 0; s < nvec; s += 4, p += 4 * step) {
+			__m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)p), _MM_SHUFFLE(3, 1, 2, 0));
+			__m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(p + 16)), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storeu_si128((__m128i *)(iq + 2 * s), _mm_unpacklo_epi64(a, b));
+		}
+		iq_extract_ref(p, step, n - nvec, iq + 2 * nvec);
+		return;
+	}
+	iq_extract_ref(first, step, n, iq);
+}
+
+void iq_magnitude(const int16_t *iq, size_t n, float *mag)
+{
+	size_t s, nvec = n & ~(size_t)3;
+
+	for (s = 0; s < nvec; s += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(iq + 2 * s));
+		// I*I + Q*Q of each pair in one multiply-add
+		__m128 p = _mm_cvtepi32_ps(_mm_madd_epi16(v, v));
+		_mm_storeu_ps(mag + s, _mm_sqrt_ps(p));
+	}
+	iq_magnitude_ref(iq + 2 * nvec, n - nvec, mag + nvec);
+}
+
+void iq_phase(const int16_t *iq, size_t n, float *rad)
+{
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 signmask = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000));
+	const __m128 pi = _mm_set1_ps((float)M_PI), pi2 = _mm_set1_ps((float)M_PI_2);
+	const __m128 tiny = _mm_set1_ps(1e-30f);
+	size_t s, nvec = n & ~(size_t)3;
+
+	for (s = 0; s < nvec; s += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(iq + 2 * s));
+		// sign extend: I in the low half of every 32 bit pair, Q in the high half
+		__m128 x = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16));
+		__m128 y = _mm_cvtepi32_ps(_mm_srai_epi32(v, 16));
+		__m128 ax = _mm_and_ps(x, absmask), ay = _mm_and_ps(y, absmask);
+		__m128 mx = _mm_max_ps(_mm_max_ps(ax, ay), tiny), mn = _mm_min_ps(ax, ay);
+		__m128 a = _mm_div_ps(mn, mx), a2 = _mm_mul_ps(a, a), r, m;
+
+		r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ATAN_C9), a2), _mm_set1_ps(ATAN_C7));
+		r = _mm_add_ps(_mm_mul_ps(r, a2), _mm_set1_ps(ATAN_C5));
+		r = _mm_add_ps(_mm_mul_ps(r, a2), _mm_set1_ps(ATAN_C3));
+		r = _mm_add_ps(_mm_mul_ps(r, a2), _mm_set1_ps(ATAN_C1));
+		r = _mm_mul_ps(r, a);
+
+		// fold back into the right octant and quadrant
+		m = _mm_cmpgt_ps(ay, ax);
+		r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(pi2, r)), _mm_andnot_ps(m, r));
+		m = _mm_cmplt_ps(x, _mm_setzero_ps());
+		r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(pi, r)), _mm_andnot_ps(m, r));
+		r = _mm_or_ps(r, _mm_and_ps(y, signmask));
+		_mm_storeu_ps(rad + s, r);
+	}
+	iq_phase_ref(iq + 2 * nvec, n - nvec, rad + nvec);
+}
+
+#elif defined(__ARM_NEON)
+
+void iq_extract(const void *first, ptrdiff_t step, size_t n, int16_t *iq)
+{
+	const char *p = first;
+	size_t s, nvec = n & ~(size_t)3;
+
+	if (step == 2 * sizeof(int16_t)) {
+		memcpy(iq, first, n * step);
+		return;
+	}
+	if (step == 4 * sizeof(int16_t)) {
+		// two channels: de-interleave 32 bit pairs and keep channel 0
+		for (s = 0; s < nvec; s += 4, p += 4 * step) {
+			int32x4x2_t v = vld2q_s32((const int32_t *)p);
+			vst1q_s32((int32_t *)(iq + 2 * s), v.val[0]);
+		}
+		iq_extract_ref(p, step, n - nvec, iq + 2 * nvec);
+		return;
+	}
+	iq_extract_ref(first, step, n, iq);
+}
+
+void iq_magnitude(const int16_t *iq, size_t n, float *mag)
+{
+	size_t s, nvec = n & ~(size_t)3;
+
+	for (s = 0; s < nvec; s += 4) {
+		int16x4x2_t v = vld2_s16(iq + 2 * s);
+		int32x4_t p = vmlal_s16(vmull_s16(v.val[0], v.val[0]), v.val[1], v.val[1]);
+		float32x4_t f = vcvtq_f32_s32(p);
+#if defined(__aarch64__)
+		vst1q_f32(mag + s, vsqrtq_f32(f));
+#else
+		// ARMv7 has no vector square root: x * rsqrt(x) with two Newton steps
+		float32x4_t r = vrsqrteq_f32(vmaxq_f32(f, vdupq_n_f32(1e-30f)));
+		r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(f, r), r));
+		r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(f, r), r));
+		vst1q_f32(mag + s, vmulq_f32(f, r));
+#endif
+	}
+	iq_magnitude_ref(iq + 2 * nvec, n - nvec, mag + nvec);
+}
+
+void iq_phase(const int16_t *iq, size_t n, float *rad)
+{
+	const float32x4_t pi = vdupq_n_f32((float)M_PI), pi2 = vdupq_n_f32((float)M_PI_2);
+	size_t s, nvec = n & ~(size_t)3;
+
+	for (s = 0; s < nvec; s += 4) {
+		int16x4x2_t v = vld2_s16(iq + 2 * s);
+		float32x4_t x = vcvtq_f32_s32(vmovl_s16(v.val[0]));
+		float32x4_t y = vcvtq_f32_s32(vmovl_s16(v.val[1]));
+		float32x4_t ax = vabsq_f32(x), ay = vabsq_f32(y);
+		float32x4_t mx = vmaxq_f32(vmaxq_f32(ax, ay), vdupq_n_f32(1e-30f)), mn = vminq_f32(ax, ay);
+		float32x4_t inv = vrecpeq_f32(mx), a, a2, r;
+		uint32x4_t m;
+
+		inv = vmulq_f32(inv, vrecpsq_f32(mx, inv));
+		inv = vmulq_f32(inv, vrecpsq_f32(mx, inv));
+		a = vmulq_f32(mn, inv);
+		a2 = vmulq_f32(a, a);
+		r = vmlaq_f32(vdupq_n_f32(ATAN_C7), vdupq_n_f32(ATAN_C9), a2);
+		r = vmlaq_f32(vdupq_n_f32(ATAN_C5), r, a2);
+		r = vmlaq_f32(vdupq_n_f32(ATAN_C3), r, a2);
+		r = vmlaq_f32(vdupq_n_f32(ATAN_C1), r, a2);
+		r = vmulq_f32(r, a);
+
+		m = vcgtq_f32(ay, ax);
+		r = vbslq_f32(m, vsubq_f32(pi2, r), r);
+		m = vcltq_f32(x, vdupq_n_f32(0));
+		r = vbslq_f32(m, vsubq_f32(pi, r), r);
+		m = vcltq_f32(y, vdupq_n_f32(0));
+		r = vbslq_f32(m, vnegq_f32(r), r);
+		vst1q_f32(rad + s, r);
+	}
+	iq_phase_ref(iq + 2 * nvec, n - nvec, rad + nvec);
+}
+
+#else
+
+void iq_extract(const void *first, ptrdiff_t step, size_t n, int16_t *iq)
+{
+	iq_extract_ref(first, step, n, iq);
+}
+
+void iq_magnitude(const int16_t *iq, size_t n, float *mag)
+{
+	iq_magnitude_ref(iq, n, mag);
+}
+
+void iq_phase(const int16_t *iq, size_t n, float *rad)
+{
+	iq_phase_ref(iq, n, rad);
+}
+
+#endif
+
+void iq_extract2_ref(const void *first, ptrdiff_t step, size_t n, int16_t *iq0, int16_t *iq1)
+{
+	const char *p = first;
+	size_t s;
+
+	for (s = 0; s < n; s++, p += step) {
+		iq0[2*s]   = ((const int16_t *)p)[0];
+		iq0[2*s+1] = ((const int16_t *)p)[1];
+		iq1[2*s]   = ((const int16_t *)p)[2];
+		iq1[2*s+1] = ((const int16_t *)p)[3];
+	}
+}
+
+/* the correlation takes 12 bit samples, anything outside is clipped */
+#define CORR_MIN (-2048)
+#define CORR_MAX 2047
+
+static inline int32_t corr_clip(int16_t v)
+{
+	return v < CORR_MIN ? CORR_MIN : v > CORR_MAX ? CORR_MAX : v;
+}
+
+void iq_corr_ref(const int16_t *a, const int16_t *b, size_t n, struct iq_corr *c)
+{
+	size_t s;
+
+	for (s = 0; s < n; s++) {
+		int32_t ai = corr_clip(a[2*s]), aq = corr_clip(a[2*s+1]);
+		int32_t bi = corr_clip(b[2*s]), bq = corr_clip(b[2*s+1]);
+		c->sum_a[0] += ai;
+		c->sum_a[1] += aq;
+		c->sum_b[0] += bi;
+		c->sum_b[1] += bq;
+		c->aa += ai * ai + aq * aq;
+		c->bb += bi * bi + bq * bq;
+		c->ab[0] += bi * ai + bq * aq;
+		c->ab[1] += bq * ai - bi * aq;
+	}
+}
+
+/*
+ * the SIMD correlation sums products of 12 bit samples in 32 bit lanes
+ * for IQ_CORR_CHUNK samples at a time before widening: at most 64 samples
+ * of 2 * 2048^2 = 2^23 per lane, which cannot overflow.  Clipping the
+ * inputs to 12 bit first keeps that true whatever is passed in.
+ */
+#define IQ_CORR_CHUNK 256
+
+#if defined(__SSE2__)
+
+/* the four 32 bit lanes of v added up */
+static inline int64_t hsum_epi32(__m128i v)
+{
+	int32_t t[4];
+	_mm_storeu_si128((__m128i *)t, v);
+	return (int64_t)t[0] + t[1] + t[2] + t[3];
+}
+
+void iq_extract2(const void *first, ptrdiff_t step, size_t n, int16_t *iq0, int16_t *iq1)
+{
+	const char *p = first;
+	size_t s, nvec = n & ~(size_t)1;
+
+	if (step != 4 * sizeof(int16_t)) {
+		iq_extract2_ref(first, step, n, iq0, iq1);
+		return;
+	}
+	// I0 Q0 I1 Q1 of two samples: gather the 32 bit pairs of each channel
+	for (s = 0; s < nvec; s += 2, p += 2 * step) {
+		__m128i v = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)p), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm_storel_epi64((__m128i *)(iq0 + 2 * s), v);
+		_mm_storel_epi64((__m128i *)(iq1 + 2 * s), _mm_unpackhi_epi64(v, v));
+	}
+	iq_extract2_ref(p, step, n - nvec, iq0 + 2 * nvec, iq1 + 2 * nvec);
+}
+
+void iq_corr(const int16_t *a, const int16_t *b, size_t n, struct iq_corr *c)
+{
+	const __m128i mi = _mm_set1_epi32(1), mq = _mm_set1_epi32(1 << 16);
+	const __m128i neg = _mm_set1_epi32((int)0xffff0001);   // +1 on I, -1 on Q
+	const __m128i lo = _mm_set1_epi16(CORR_MIN), hi = _mm_set1_epi16(CORR_MAX);
+	size_t s = 0, nvec = n & ~(size_t)3;
+
+	while (s < nvec) {
+		size_t end = s + IQ_CORR_CHUNK < nvec ? s + IQ_CORR_CHUNK : nvec;
+		__m128i sai = _mm_setzero_si128(), saq = sai, sbi = sai, sbq = sai;
+		__m128i aa = sai, bb = sai, re = sai, im = sai;
+
+		for (; s < end; s += 4) {
+			__m128i va = _mm_min_epi16(_mm_max_epi16(_mm_loadu_si128((const __m128i *)(a + 2 * s)), lo), hi);
+			__m128i vb = _mm_min_epi16(_mm_max_epi16(_mm_loadu_si128((const __m128i *)(b + 2 * s)), lo), hi);
+			// Q, -I of b, so that a multiply-add with a gives bq ai - bi aq
+			__m128i vbs = _mm_mullo_epi16(_mm_shufflehi_epi16(_mm_shufflelo_epi16(vb, _MM_SHUFFLE(2, 3, 0, 1)),
+									  _MM_SHUFFLE(2, 3, 0, 1)), neg);
+
+			sai = _mm_add_epi32(sai, _mm_madd_epi16(va, mi));
+			saq = _mm_add_epi32(saq, _mm_madd_epi16(va, mq));
+			sbi = _mm_add_epi32(sbi, _mm_madd_epi16(vb, mi));
+			sbq = _mm_add_epi32(sbq, _mm_madd_epi16(vb, mq));
+			aa = _mm_add_epi32(aa, _mm_madd_epi16(va, va));
+			bb = _mm_add_epi32(bb, _mm_madd_epi16(vb, vb));
+			re = _mm_add_epi32(re, _mm_madd_epi16(va, vb));
+			im = _mm_add_epi32(im, _mm_madd_epi16(va, vbs));
+		}
+		c->sum_a[0] += hsum_epi32(sai);
+		c->sum_a[1] += hsum_epi32(saq);
+		c->sum_b[0] += hsum_epi32(sbi);
+		c->sum_b[1] += hsum_epi32(sbq);
+		c->aa += hsum_epi32(aa);
+		c->bb += hsum_epi32(bb);
+		c->ab[0] += hsum_epi32(re);
+		c->ab[1] += hsum_epi32(im);
+	}
+	iq_corr_ref(a + 2 * nvec, b + 2 * nvec, n - nvec, c);
+}
+
+#elif defined(__ARM_NEON)
+
+static inline int64_t hsum_s32(int32x4_t v)
+{
+	int64x2_t w = vpaddlq_s32(v);
+	return vgetq_lane_s64(w, 0) + vgetq_lane_s64(w, 1);
+}
+
+void iq_extract2(const void *first, ptrdiff_t step, size_t n, int16_t *iq0, int16_t *iq1)
+{
+	const char *p = first;
+	size_t s, nvec = n & ~(size_t)3;
+
+	if (step != 4 * sizeof(int16_t)) {
+		iq_extract2_ref(first, step, n, iq0, iq1);
+		return;
+	}
+	for (s = 0; s < nvec; s += 4, p += 4 * step) {
+		int32x4x2_t v = vld2q_s32((const int32_t *)p);
+		vst1q_s32((int32_t *)(iq0 + 2 * s), v.val[0]);
+		vst1q_s32((int32_t *)(iq1 + 2 * s), v.val[1]);
+	}
+	iq_extract2_ref(p, step, n - nvec, iq0 + 2 * nvec, iq1 + 2 * nvec);
+}
+
+void iq_corr(const int16_t *a, const int16_t *b, size_t n, struct iq_corr *c)
+{
+	const int16x4_t lo = vdup_n_s16(CORR_MIN), hi = vdup_n_s16(CORR_MAX);
+	size_t s = 0, nvec = n & ~(size_t)3;
+
+	while (s < nvec) {
+		size_t end = s + IQ_CORR_CHUNK < nvec ? s + IQ_CORR_CHUNK : nvec;
+		int32x4_t sai = vdupq_n_s32(0), saq = sai, sbi = sai, sbq = sai;
+		int32x4_t aa = sai, bb = sai, re = sai, im = sai;
+
+		for (; s < end; s += 4) {
+			int16x4x2_t va = vld2_s16(a + 2 * s), vb = vld2_s16(b + 2 * s);
+			int k;
+
+			for (k = 0; k < 2; k++) {
+				va.val[k] = vmin_s16(vmax_s16(va.val[k], lo), hi);
+				vb.val[k] = vmin_s16(vmax_s16(vb.val[k], lo), hi);
+			}
+
+			sai = vaddw_s16(sai, va.val[0]);
+			saq = vaddw_s16(saq, va.val[1]);
+			sbi = vaddw_s16(sbi, vb.val[0]);
+			sbq = vaddw_s16(sbq, vb.val[1]);
+			aa = vmlal_s16(vmlal_s16(aa, va.val[0], va.val[0]), va.val[1], va.val[1]);
+			bb = vmlal_s16(vmlal_s16(bb, vb.val[0], vb.val[0]), vb.val[1], vb.val[1]);
+			re = vmlal_s16(vmlal_s16(re, vb.val[0], va.val[0]), vb.val[1], va.val[1]);
+			im = vmlsl_s16(vmlal_s16(im, vb.val[1], va.val[0]), vb.val[0], va.val[1]);
+		}
+		c->sum_a[0] += hsum_s32(sai);
+		c->sum_a[1] += hsum_s32(saq);
+		c->sum_b[0] += hsum_s32(sbi);
+		c->sum_b[1] += hsum_s32(sbq);
+		c->aa += hsum_s32(aa);
+		c->bb += hsum_s32(bb);
+		c->ab[0] += hsum_s32(re);
+		c->ab[1] += hsum_s32(im);
+	}
+	iq_corr_ref(a + 2 * nvec, b + 2 * nvec, n - nvec, c);
+}
+
+#else
+
+void iq_extract2(const void *first, ptrdiff_t step, size_t n, int16_t *iq0, int16_t *iq1)
+{
+	iq_extract2_ref(first, step, n, iq0, iq1);
+}
+
+void iq_corr(const int16_t *a, const int16_t *b, size_t n, struct iq_corr *c)
+{
+	iq_corr_ref(a, b, n, c);
+}
+
+#endif
+
+/* bits needed for the magnitude m, 0 for 0 */
+static unsigned bit_length(unsigned m)
+{
+	unsigned b = 0;
+	while (m >> b)
+		b++;
+	return b;
+}
+
+/* smallest exponent that fits the largest magnitude into a signed mantissa */
+static unsigned bfp_exponent(unsigned maxabs)
+{
+	unsigned b = bit_length(maxabs);
+	return b > BFP_MANT_BITS - 1 ? b - (BFP_MANT_BITS - 1) : 0;
+}
+
+static int8_t bfp_quantize(int16_t v, unsigned exp)
+{
+	int32_t r = exp ? ((int32_t)v + (1 << (exp - 1))) >> exp : v;
+	if (r > INT8_MAX) r = INT8_MAX;
+	if (r < INT8_MIN) r = INT8_MIN;
+	return (int8_t)r;
+}
+
+unsigned bfp_encode_ref(const int16_t *x, size_t nval, int8_t *mant)
+{
+	unsigned maxabs = 0, exp;
+	size_t k;
+
+	for (k = 0; k < nval; k++) {
+		unsigned a = abs(x[k]);
+		if (a > INT16_MAX) a = INT16_MAX;
+		if (a > maxabs) maxabs = a;
+	}
+	exp = bfp_exponent(maxabs);
+	for (k = 0; k < nval; k++)
+		mant[k] = bfp_quantize(x[k], exp);
+	return exp;
+}
+
+void bfp_decode_ref(const int8_t *mant, size_t nval, unsigned exp, int16_t *x)
+{
+	size_t k;
+
+	for (k = 0; k < nval; k++)
+		x[k] = (int16_t)(mant[k] * (1 << exp));
+}
+
+#if defined(__SSE2__)
+
+unsigned bfp_encode(const int16_t *x, size_t nval, int8_t *mant)
+{
+	__m128i vmax = _mm_setzero_si128(), rnd, cnt;
+	int16_t lanes[8];
+	unsigned maxabs = 0, exp;
+	size_t k, nvec = nval & ~(size_t)15;
+
+	for (k = 0; k < nvec; k += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(x + k));
+		// |v| saturating, -32768 becomes 32767
+		__m128i a = _mm_max_epi16(v, _mm_subs_epi16(_mm_setzero_si128(), v));
+		vmax = _mm_max_epi16(vmax, a);
+	}
+	_mm_storeu_si128((__m128i *)lanes, vmax);
+	for (k = 0; k < 8; k++)
+		if ((unsigned)lanes[k] > maxabs) maxabs = lanes[k];
+	for (k = nvec; k < nval; k++) {
+		unsigned a = abs(x[k]);
+		if (a > INT16_MAX) a = INT16_MAX;
+		if (a > maxabs) maxabs = a;
+	}
+
+	exp = bfp_exponent(maxabs);
+	rnd = _mm_set1_epi16(exp ? (int16_t)(1 << (exp - 1)) : 0);
+	cnt = _mm_cvtsi32_si128((int)exp);
+	for (k = 0; k < nvec; k += 16) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)(x + k));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(x + k + 8));
+		lo = _mm_sra_epi16(_mm_adds_epi16(lo, rnd), cnt);
+		hi = _mm_sra_epi16(_mm_adds_epi16(hi, rnd), cnt);
+		_mm_storeu_si128((__m128i *)(mant + k), _mm_packs_epi16(lo, hi));
+	}
+	for (k = nvec; k < nval; k++)
+		mant[k] = bfp_quantize(x[k], exp);
+	return exp;
+}
+
+void bfp_decode(const int8_t *mant, size_t nval, unsigned exp, int16_t *x)
+{
+	__m128i cnt = _mm_cvtsi32_si128((int)exp);
+	size_t k, nvec = nval & ~(size_t)15;
+
+	for (k = 0; k < nvec; k += 16) {
+		__m128i m = _mm_loadu_si128((const __m128i *)(mant + k));
+		// sign extend by placing the bytes in the high half and shifting back down
+		__m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(m, m), 8);
+		__m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(m, m), 8);
+		_mm_storeu_si128((__m128i *)(x + k), _mm_sll_epi16(lo, cnt));
+		_mm_storeu_si128((__m128i *)(x + k + 8), _mm_sll_epi16(hi, cnt));
+	}
+	bfp_decode_ref(mant + nvec, nval - nvec, exp, x + nvec);
+}
+
+#elif defined(__ARM_NEON)
+
+unsigned bfp_encode(const int16_t *x, size_t nval, int8_t *mant)
+{
+	int16x8_t vmax = vdupq_n_s16(0), sh;
+	int16x4_t m4;
+	unsigned maxabs = 0, exp;
+	size_t k, nvec = nval & ~(size_t)15;
+
+	for (k = 0; k < nvec; k += 8)
+		vmax = vmaxq_s16(vmax, vqabsq_s16(vld1q_s16(x + k)));
+	m4 = vpmax_s16(vget_low_s16(vmax), vget_high_s16(vmax));
+	m4 = vpmax_s16(m4, m4);
+	m4 = vpmax_s16(m4, m4);
+	maxabs = (unsigned)vget_lane_s16(m4, 0);
+	for (k = nvec; k < nval; k++) {
+		unsigned a = abs(x[k]);
+		if (a > INT16_MAX) a = INT16_MAX;
+		if (a > maxabs) maxabs = a;
+	}
+
+	exp = bfp_exponent(maxabs);
+	sh = vdupq_n_s16(-(int16_t)exp);
+	for (k = 0; k < nvec; k += 16) {
+		// rounding shift right, then saturating narrow to 8 bits
+		int16x8_t lo = vqrshlq_s16(vld1q_s16(x + k), sh);
+		int16x8_t hi = vqrshlq_s16(vld1q_s16(x + k + 8), sh);
+		vst1q_s8(mant + k, vcombine_s8(vqmovn_s16(lo), vqmovn_s16(hi)));
+	}
+	for (k = nvec; k < nval; k++)
+		mant[k] = bfp_quantize(x[k], exp);
+	return exp;
+}
+
+void bfp_decode(const int8_t *mant, size_t nval, unsigned exp, int16_t *x)
+{
+	int16x8_t sh = vdupq_n_s16((int16_t)exp);
+	size_t k, nvec = nval & ~(size_t)15;
+
+	for (k = 0; k < nvec; k += 16) {
+		int8x16_t m = vld1q_s8(mant + k);
+		vst1q_s16(x + k, vshlq_s16(vmovl_s8(vget_low_s8(m)), sh));
+		vst1q_s16(x + k + 8, vshlq_s16(vmovl_s8(vget_high_s8(m)), sh));
+	}
+	bfp_decode_ref(mant + nvec, nval - nvec, exp, x + nvec);
+}
+
+#else
+
+unsigned bfp_encode(const int16_t *x, size_t nval, int8_t *mant)
+{
+	return bfp_encode_ref(x, nval, mant);
+}
+
+void bfp_decode(const int8_t *mant, size_t nval, unsigned exp, int16_t *x)
+{
+	bfp_decode_ref(mant, nval, exp, x);
+}
+
+#endif
+
+/* IEEE 754 binary32 to binary16, round to nearest even */
+static uint16_t f32_to_half(float v)
+{
+	uint32_t b, sign, exp, mant;
+	memcpy(&b, &v, sizeof(b));
+
+	sign = (b >> 16) & 0x8000;
+	exp = (b >> 23) & 0xff;
+	mant = b & 0x7fffff;
+
+	if (exp == 0xff)                        // inf and nan
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	if (exp > 127 + 15)                     // too large, inf
+		return sign | 0x7c00;
+	if (exp >= 127 - 14) {                  // normal
+		uint32_t h = ((exp - 127 + 15) << 10) | (mant >> 13);
+		uint32_t rest = mant & 0x1fff;
+		if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+			h++;                            // may carry into the exponent, which is right
+		return sign | h;
+	}
+	if (exp >= 127 - 25) {                  // subnormal
+		uint32_t m = mant | 0x800000;
+		unsigned shift = 126 - exp;         // half subnormals are h * 2^-24
+		uint32_t h = m >> shift;
+		uint32_t rest = m & ((1u << shift) - 1), half = 1u << (shift - 1);
+		if (rest > half || (rest == half && (h & 1)))
+			h++;
+		return sign | h;
+	}
+	return sign;
+}
+
+static float half_to_f32(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f, mant = h & 0x3ff, b;
+	float v;
+
+	if (exp == 0x1f) {
+		b = sign | 0x7f800000 | (mant << 13);
+	} else if (exp) {
+		b = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+	} else {
+		// zero or subnormal, exact in single precision
+		v = ldexpf((float)mant, -24);
+		return sign ? -v : v;
+	}
+	memcpy(&v, &b, sizeof(v));
+	return v;
+}
+
+void s16_to_f16_ref(const int16_t *x, size_t nval, uint16_t *h)
+{
+	size_t k;
+
+	for (k = 0; k < nval; k++)
+		h[k] = f32_to_half(x[k] / IQ_FULL_SCALE);
+}
+
+void f16_to_f32_ref(const uint16_t *h, size_t nval, float *f)
+{
+	size_t k;
+
+	for (k = 0; k < nval; k++)
+		f[k] = half_to_f32(h[k]);
+}
+
+/*
+ * x86 builds carry the F16C conversions whatever the compiler targets, the
+ * same way as the CRC32C below; they are used when the CPU has F16C
+ */
+#if !defined(__F16C__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HALF_F16C 1
+#else
+#define HALF_F16C 0
+#endif
+
+#if defined(__F16C__) || HALF_F16C
+
+#if HALF_F16C
+__attribute__((target("f16c")))
+#endif
+static void s16_to_f16_f16c(const int16_t *x, size_t nval, uint16_t *h)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / IQ_FULL_SCALE);
+	size_t k, nvec = nval & ~(size_t)7;
+
+	for (k = 0; k < nvec; k += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(x + k));
+		// sign extend int16 to int32
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		__m128i hlo = _mm_cvtps_ph(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale), _MM_FROUND_TO_NEAREST_INT);
+		__m128i hhi = _mm_cvtps_ph(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i *)(h + k), _mm_unpacklo_epi64(hlo, hhi));
+	}
+	s16_to_f16_ref(x + nvec, nval - nvec, h + nvec);
+}
+
+#if HALF_F16C
+__attribute__((target("f16c")))
+#endif
+static void f16_to_f32_f16c(const uint16_t *h, size_t nval, float *f)
+{
+	size_t k, nvec = nval & ~(size_t)3;
+
+	for (k = 0; k < nvec; k += 4)
+		_mm_storeu_ps(f + k, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(h + k))));
+	f16_to_f32_ref(h + nvec, nval - nvec, f + nvec);
+}
+
+#endif
+
+#if defined(__F16C__)
+
+void s16_to_f16(const int16_t *x, size_t nval, uint16_t *h)
+{
+	s16_to_f16_f16c(x, nval, h);
+}
+
+void f16_to_f32(const uint16_t *h, size_t nval, float *f)
+{
+	f16_to_f32_f16c(h, nval, f);
+}
+
+#elif HALF_F16C
+
+static bool half_f16c;
+
+__attribute__((constructor)) static void half_init(void)
+{
+	__builtin_cpu_init();
+	half_f16c = __builtin_cpu_supports("f16c");
+}
+
+void s16_to_f16(const int16_t *x, size_t nval, uint16_t *h)
+{
+	if (half_f16c)
+		s16_to_f16_f16c(x, nval, h);
+	else
+		s16_to_f16_ref(x, nval, h);
+}
+
+void f16_to_f32(const uint16_t *h, size_t nval, float *f)
+{
+	if (half_f16c)
+		f16_to_f32_f16c(h, nval, f);
+	else
+		f16_to_f32_ref(h, nval, f);
+}
+
+#elif defined(__ARM_NEON) && defined(__ARM_FP) && (__ARM_FP & 2)
+
+void s16_to_f16(const int16_t *x, size_t nval, uint16_t *h)
+{
+	size_t k, nvec = nval & ~(size_t)7;
+
+	for (k = 0; k < nvec; k += 8) {
+		int16x8_t v = vld1q_s16(x + k);
+		float32x4_t lo = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), 1.0f / IQ_FULL_SCALE);
+		float32x4_t hi = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), 1.0f / IQ_FULL_SCALE);
+		vst1_u16(h + k, vreinterpret_u16_f16(vcvt_f16_f32(lo)));
+		vst1_u16(h + k + 4, vreinterpret_u16_f16(vcvt_f16_f32(hi)));
+	}
+	s16_to_f16_ref(x + nvec, nval - nvec, h + nvec);
+}
+
+void f16_to_f32(const uint16_t *h, size_t nval, float *f)
+{
+	size_t k, nvec = nval & ~(size_t)3;
+
+	for (k = 0; k < nvec; k += 4)
+		vst1q_f32(f + k, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(h + k))));
+	f16_to_f32_ref(h + nvec, nval - nvec, f + nvec);
+}
+
+#else
+
+void s16_to_f16(const int16_t *x, size_t nval, uint16_t *h)
+{
+	s16_to_f16_ref(x, nval, h);
+}
+
+void f16_to_f32(const uint16_t *h, size_t nval, float *f)
+{
+	f16_to_f32_ref(h, nval, f);
+}
+
+#endif
+
+/* adding and removing 1.5 * 2^23 rounds to nearest even without touching the FPU mode */
+#define ROUND_MAGIC 12582912.0f
+
+static int16_t tx_sample(float v)
+{
+	float r = v * IQ_FULL_SCALE;
+	if (r > IQ_FULL_SCALE - 1) r = IQ_FULL_SCALE - 1;
+	if (r < -IQ_FULL_SCALE)    r = -IQ_FULL_SCALE;
+	r = (r + ROUND_MAGIC) - ROUND_MAGIC;
+	// 12-bit sample needs to be MSB aligned so shift by 4
+	return (int16_t)((int32_t)r * 16);
+}
+
+void tx_pack_ref(const float *iq, size_t n, void *dst, ptrdiff_t step)
+{
+	char *p = dst;
+	size_t s;
+
+	for (s = 0; s < n; s++, p += step) {
+		((int16_t *)p)[0] = tx_sample(iq[2*s]);
+		((int16_t *)p)[1] = tx_sample(iq[2*s+1]);
+	}
+}
+
+#if defined(__SSE2__)
+
+/* 4 I/Q pairs to 8 packed int16 */
+static inline __m128i tx_pack4(const float *iq)
+{
+	const __m128 scale = _mm_set1_ps(IQ_FULL_SCALE);
+	const __m128 hi = _mm_set1_ps(IQ_FULL_SCALE - 1), lo = _mm_set1_ps(-IQ_FULL_SCALE);
+	const __m128 magic = _mm_set1_ps(ROUND_MAGIC);
+	__m128 a = _mm_mul_ps(_mm_loadu_ps(iq), scale);
+	__m128 b = _mm_mul_ps(_mm_loadu_ps(iq + 4), scale);
+
+	a = _mm_sub_ps(_mm_add_ps(_mm_max_ps(_mm_min_ps(a, hi), lo), magic), magic);
+	b = _mm_sub_ps(_mm_add_ps(_mm_max_ps(_mm_min_ps(b, hi), lo), magic), magic);
+	return _mm_slli_epi16(_mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)), 4);
+}
+
+void tx_pack(const float *iq, size_t n, void *dst, ptrdiff_t step)
+{
+	char *p = dst;
+	size_t s, nvec = n & ~(size_t)3;
+
+	if (step == 2 * sizeof(int16_t)) {
+		// only I and Q of one channel enabled, the buffer is contiguous
+		for (s = 0; s < nvec; s += 4, p += 4 * step)
+			_mm_storeu_si128((__m128i *)p, tx_pack4(iq + 2 * s));
+	} else {
+		int16_t tmp[8];
+		int k;
+		for (s = 0; s < nvec; s += 4) {
+			_mm_storeu_si128((__m128i *)tmp, tx_pack4(iq + 2 * s));
+			for (k = 0; k < 4; k++, p += step)
+				memcpy(p, tmp + 2 * k, 2 * sizeof(int16_t));
+		}
+	}
+	tx_pack_ref(iq + 2 * nvec, n - nvec, p, step);
+}
+
+#elif defined(__ARM_NEON)
+
+static inline int16x8_t tx_pack4(const float *iq)
+{
+	const float32x4_t hi = vdupq_n_f32(IQ_FULL_SCALE - 1), lo = vdupq_n_f32(-IQ_FULL_SCALE);
+	const float32x4_t magic = vdupq_n_f32(ROUND_MAGIC);
+	float32x4_t a = vmulq_n_f32(vld1q_f32(iq), IQ_FULL_SCALE);
+	float32x4_t b = vmulq_n_f32(vld1q_f32(iq + 4), IQ_FULL_SCALE);
+
+	// ARMv7 NEON only converts with truncation, round with the magic constant first
+	a = vsubq_f32(vaddq_f32(vmaxq_f32(vminq_f32(a, hi), lo), magic), magic);
+	b = vsubq_f32(vaddq_f32(vmaxq_f32(vminq_f32(b, hi), lo), magic), magic);
+	return vshlq_n_s16(vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)), vqmovn_s32(vcvtq_s32_f32(b))), 4);
+}
+
+void tx_pack(const float *iq, size_t n, void *dst, ptrdiff_t step)
+{
+	char *p = dst;
+	size_t s, nvec = n & ~(size_t)3;
+
+	if (step == 2 * sizeof(int16_t)) {
+		for (s = 0; s < nvec; s += 4, p += 4 * step)
+			vst1q_s16((int16_t *)p, tx_pack4(iq + 2 * s));
+	} else {
+		int16_t tmp[8];
+		int k;
+		for (s = 0; s < nvec; s += 4) {
+			vst1q_s16(tmp, tx_pack4(iq + 2 * s));
+			for (k = 0; k < 4; k++, p += step)
+				memcpy(p, tmp + 2 * k, 2 * sizeof(int16_t));
+		}
+	}
+	tx_pack_ref(iq + 2 * nvec, n - nvec, p, step);
+}
+
+#else
+
+void tx_pack(const float *iq, size_t n, void *dst, ptrdiff_t step)
+{
+	tx_pack_ref(iq, n, dst, step);
+}
+
+#endif
+
+/* reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78u
+
+uint32_t crc32c_ref(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	int b;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *p++;
+		for (b = 0; b < 8; b++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+	}
+	return ~crc;
+}
+
+/*
+ * x86 builds carry the SSE4.2 CRC32C next to the table driven one whatever
+ * the compiler targets, crc32c picks it when the CPU has SSE4.2
+ */
+#if !defined(__SSE4_2__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRC_SSE42 1
+#else
+#define CRC_SSE42 0
+#endif
+
+#if defined(__SSE4_2__) || defined(__ARM_FEATURE_CRC32) || CRC_SSE42
+
+#if defined(__ARM_FEATURE_CRC32)
+#define crc32c_u8(c, v)  __crc32cb(c, v)
+#define crc32c_u64(c, v) __crc32cd(c, v)
+#else
+#define crc32c_u8(c, v)  _mm_crc32_u8(c, v)
+#if defined(__x86_64__)
+#define crc32c_u64(c, v) _mm_crc32_u64(c, v)
+#else
+#define crc32c_u64(c, v) _mm_crc32_u32(_mm_crc32_u32(c, (uint32_t)(v)), (uint32_t)((v) >> 32))
+#endif
+#endif
+
+#if CRC_SSE42
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t c = ~crc;
+
+	for (; len && ((uintptr_t)p & 7); len--)
+		c = crc32c_u8((uint32_t)c, *p++);
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		c = crc32c_u64(c, v);
+	}
+	for (; len; len--)
+		c = crc32c_u8((uint32_t)c, *p++);
+	return ~(uint32_t)c;
+}
+
+#endif
+
+#if !defined(__SSE4_2__) && !defined(__ARM_FEATURE_CRC32)
+
+/* slicing by 8: tab[k][b] is the CRC of byte b followed by k zero bytes */
+static uint32_t crc32c_tab[8][256];
+static bool crc32c_sse42;
+
+__attribute__((constructor)) static void crc32c_init(void)
+{
+	unsigned b, k;
+
+	for (b = 0; b < 256; b++) {
+		uint32_t c = b;
+		for (k = 0; k < 8; k++)
+			c = (c >> 1) ^ (CRC32C_POLY & -(c & 1));
+		crc32c_tab[0][b] = c;
+	}
+	for (b = 0; b < 256; b++)
+		for (k = 1; k < 8; k++)
+			crc32c_tab[k][b] = (crc32c_tab[k-1][b] >> 8) ^ crc32c_tab[0][crc32c_tab[k-1][b] & 0xff];
+#if CRC_SSE42
+	__builtin_cpu_init();
+	crc32c_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+		crc = crc32c_tab[7][lo & 0xff] ^ crc32c_tab[6][(lo >> 8) & 0xff] ^
+		      crc32c_tab[5][(lo >> 16) & 0xff] ^ crc32c_tab[4][lo >> 24] ^
+		      crc32c_tab[3][p[4]] ^ crc32c_tab[2][p[5]] ^
+		      crc32c_tab[1][p[6]] ^ crc32c_tab[0][p[7]];
+	}
+	while (len--)
+		crc = (crc >> 8) ^ crc32c_tab[0][(crc ^ *p++) & 0xff];
+	return ~crc;
+}
+
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+#if defined(__SSE4_2__) || defined(__ARM_FEATURE_CRC32)
+	return crc32c_hw(crc, buf, len);
+#elif CRC_SSE42
+	return crc32c_sse42 ? crc32c_hw(crc, buf, len) : crc32c_sw(crc, buf, len);
+#else
+	return crc32c_sw(crc, buf, len);
+#endif
+}
+
+double sqnr_db(const int16_t *x, const int16_t *y, size_t nval)
+{
+	int64_t sig = 0, err = 0;
+	size_t k;
+
+	for (k = 0; k < nval; k++) {
+		int32_t e = (int32_t)x[k] - y[k];
+		sig += (int32_t)x[k] * x[k];
+		err += e * e;
+	}
+	if (!err)
+		return sig ? 200.0 : 0.0;
+	return 10.0 * log10((double)sig / (double)err);
+}
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * iqconv.h - sample format conversion kernels
+ *
+ * Each kernel has a plain C reference version (_ref) and a default version
+ * that uses SSE2 on x86 or NEON on ARM when the compiler targets them and
+ * falls back to the reference otherwise.  Both give identical results
+ * unless noted otherwise.
+ **/
+
+#ifndef IQCONV_H
+#define IQCONV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * copy n I/Q pairs that are step bytes apart (iio_buffer_first and
+ * iio_buffer_step of the RX buffer) into a contiguous interleaved array
+ */
+void iq_extract(const void *first, ptrdiff_t step, size_t n, int16_t *iq);
+void iq_extract_ref(const void *first, ptrdiff_t step, size_t n, int16_t *iq);
+
+/*
+ * the same for the first two channel pairs of every sample, RX0 and RX1
+ * when both are enabled, into one array each
+ */
+void iq_extract2(const void *first, ptrdiff_t step, size_t n, int16_t *iq0, int16_t *iq1);
+void iq_extract2_ref(const void *first, ptrdiff_t step, size_t n, int16_t *iq0, int16_t *iq1);
+
+/*
+ * correlation sums of two channels of n interleaved I/Q pairs, added to
+ * c.  Integer, so the SIMD versions give exactly the reference results.
+ * The samples are 12 bit as they come from the AD9361, values outside
+ * -2048..2047 are clipped so the 32 bit partial sums cannot overflow.
+ */
+struct iq_corr {
+	int64_t sum_a[2], sum_b[2];   // I and Q
+	int64_t aa, bb;               // sum |a|^2 and |b|^2
+	int64_t ab[2];                // sum b conj(a), real and imaginary
+};
+
+void iq_corr(const int16_t *a, const int16_t *b, size_t n, struct iq_corr *c);
+void iq_corr_ref(const int16_t *a, const int16_t *b, size_t n, struct iq_corr *c);
+
+/* sqrt(I^2 + Q^2) of n interleaved I/Q pairs, ARMv7 NEON is within 1e-5 relative */
+void iq_magnitude(const int16_t *iq, size_t n, float *mag);
+void iq_magnitude_ref(const int16_t *iq, size_t n, float *mag);
+
+/*
+ * atan2(Q, I) in radians of n interleaved I/Q pairs.  The SIMD version
+ * uses a polynomial, within 2e-5 rad of the reference.
+ */
+void iq_phase(const int16_t *iq, size_t n, float *rad);
+void iq_phase_ref(const int16_t *iq, size_t n, float *rad);
+
+/*
+ * block floating point: nval int16 values share one exponent and are
+ * stored as 8 bit mantissas, x ~= mant << exp.  Returns the exponent.
+ */
+#define BFP_MANT_BITS 8
+
+unsigned bfp_encode(const int16_t *x, size_t nval, int8_t *mant);
+unsigned bfp_encode_ref(const int16_t *x, size_t nval, int8_t *mant);
+void bfp_decode(const int8_t *mant, size_t nval, unsigned exp, int16_t *x);
+void bfp_decode_ref(const int8_t *mant, size_t nval, unsigned exp, int16_t *x);
+
+/*
+ * half precision floats.  RX samples are 12 bit integers, they are scaled
+ * by 1/IQ_FULL_SCALE to [-1, 1) which half precision holds exactly.
+ * Uses F16C on x86 and the NEON fp16 conversions on ARM when available.
+ */
+#define IQ_FULL_SCALE 2048.0f
+
+void s16_to_f16(const int16_t *x, size_t nval, uint16_t *h);
+void s16_to_f16_ref(const int16_t *x, size_t nval, uint16_t *h);
+void f16_to_f32(const uint16_t *h, size_t nval, float *f);
+void f16_to_f32_ref(const uint16_t *h, size_t nval, float *f);
+
+/*
+ * TX packing: n float I/Q pairs, full scale +-1.0, are rounded to 12 bit,
+ * saturated and MSB aligned into the int16 I/Q pairs of a TX buffer whose
+ * samples are step bytes apart (iio_buffer_step).
+ */
+void tx_pack(const float *iq, size_t n, void *dst, ptrdiff_t step);
+void tx_pack_ref(const float *iq, size_t n, void *dst, ptrdiff_t step);
+
+/*
+ * CRC32C (Castagnoli) of len bytes, continuing from crc (0 to start):
+ * crc32c(crc32c(0, a), b) is the CRC of a followed by b.  Uses the SSE4.2
+ * or ARMv8 CRC instructions when available (-msse4.2, -march=armv8-a+crc),
+ * table driven otherwise.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32c_ref(uint32_t crc, const void *buf, size_t len);
+
+/* signal to quantization noise ratio in dB of y against the original x */
+double sqnr_db(const int16_t *x, const int16_t *y, size_t nval);
+
+#endif
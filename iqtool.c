@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * iqtool - look at captures written by ad9361-iiostream without loading them
+ *
+ * usage:
+ *  iqtool overview <capture> <first sample> <count> <width>
+ *      prints width rows of min/max/mean I and Q read from the overview
+ *      pyramid (capture written with -p)
+ *  iqtool chunks <capture> [peak N] [rms X] [clips N]
+ *      lists the chunks of a chunk format capture whose peak, rms and clip
+ *      count are above the given values, reading only the chunk headers
+ *  iqtool decode <capture> [out]
+ *      decodes a bfp capture to raw int16 I/Q (when out is given) and
+ *      prints the SQNR of its blocks
+ *  iqtool tofloat <capture> <out>
+ *      converts an f16 capture to interleaved float32 I/Q
+ *  iqtool verify <capture> [threads]
+ *      checks the capture against its CRC32C index (<capture>.crc),
+ *      reading the blocks on several threads
+ *  iqtool listen <port> [out]
+ *      receives what remote mode sends: decimated or bfp samples are
+ *      written to out as raw int16 I/Q, summaries as csv lines
+ *  iqtool zsub <host:port> [out] [messages]
+ *      subscribes to what -z publishes (or any ZeroMQ PUB socket), writes
+ *      the messages to out back to back and stops after the given number
+ **/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "iqconv.h"
+#include "net.h"
+#include "zmtp.h"
+
+static int cmd_overview(int argc, char **argv)
+{
+	struct pyr_entry *bins;
+	unsigned long long first, count;
+	size_t width;
+	int n, b;
+
+	if (argc != 5)
+		return -EINVAL;
+	first = strtoull(argv[2], NULL, 0);
+	count = strtoull(argv[3], NULL, 0);
+	width = strtoul(argv[4], NULL, 0);
+
+	bins = calloc(width, sizeof(*bins));
+	if (!bins)
+		return -ENOMEM;
+	n = capture_overview(argv[1], first, count, bins, width);
+	for (b = 0; b < n; b++)
+		printf("%d, %d, %d, %d, %d, %d, %d\n", b,
+		       bins[b].min[0], bins[b].max[0], bins[b].mean[0],
+		       bins[b].min[1], bins[b].max[1], bins[b].mean[1]);
+	free(bins);
+	return n < 0 ? n : 0;
+}
+
+static void print_chunk(const struct chunk_header *h, void *arg)
+{
+	printf("%llu, %u, %.2f, %d, %.2f, %.2f, %u\n", (unsigned long long)h->first, h->nsamp,
+	       h->rms, h->peak, h->dc[0], h->dc[1], h->clips);
+}
+
+static int cmd_chunks(int argc, char **argv)
+{
+	struct chunk_filter filter = { -1, -1.0, 0 };
+	int a, n;
+
+	if (argc < 2 || argc % 2)
+		return -EINVAL;
+	for (a = 2; a < argc; a += 2) {
+		if (!strcmp(argv[a], "peak"))
+			filter.peak_above = atoi(argv[a + 1]);
+		else if (!strcmp(argv[a], "rms"))
+			filter.rms_above = atof(argv[a + 1]);
+		else if (!strcmp(argv[a], "clips"))
+			filter.min_clips = strtoul(argv[a + 1], NULL, 0);
+		else
+			return -EINVAL;
+	}
+
+	printf("# first, samples, rms, peak, dc I, dc Q, clips\n");
+	n = capture_chunk_query(argv[1], &filter, print_chunk, NULL);
+	if (n >= 0)
+		fprintf(stderr, "%d matching chunks\n", n);
+	return n < 0 ? n : 0;
+}
+
+static int cmd_decode(int argc, char **argv)
+{
+	struct bfp_stats st;
+	FILE *out = NULL;
+	int ret;
+
+	if (argc != 2 && argc != 3)
+		return -EINVAL;
+	if (argc == 3 && !(out = fopen(argv[2], "wb")))
+		return -errno;
+	ret = capture_bfp_decode(argv[1], out, &st);
+	if (out)
+		fclose(out);
+	if (ret < 0)
+		return ret;
+	printf("%llu blocks, SQNR min %.2f dB, mean %.2f dB\n", (unsigned long long)st.nblocks,
+	       st.sqnr_min, st.nblocks ? st.sqnr_sum / st.nblocks : 0.0);
+	return 0;
+}
+
+static int cmd_tofloat(int argc, char **argv)
+{
+	float iq[2 * 4096];
+	FILE *in, *out;
+	size_t n;
+	int ret = 0;
+
+	if (argc != 3)
+		return -EINVAL;
+	if (!(in = fopen(argv[1], "rb")))
+		return -errno;
+	if (!(out = fopen(argv[2], "wb"))) {
+		fclose(in);
+		return -errno;
+	}
+	while ((n = capture_f16_read(in, iq, 4096)) > 0) {
+		if (fwrite(iq, 2 * sizeof(*iq), n, out) != n) {
+			ret = -errno;
+			break;
+		}
+	}
+	fclose(in);
+	fclose(out);
+	return ret;
+}
+
+static void print_bad(uint64_t block, uint64_t offset, uint32_t len, void *arg)
+{
+	printf("bad block %llu: bytes %llu-%llu\n", (unsigned long long)block,
+	       (unsigned long long)offset, (unsigned long long)(offset + len - 1));
+}
+
+static int cmd_verify(int argc, char **argv)
+{
+	struct crc_header h;
+	struct timespec t0, t1;
+	struct stat st;
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	double dt;
+	int nbad;
+
+	if (argc != 2 && argc != 3)
+		return -EINVAL;
+	if (argc == 3)
+		nthreads = atol(argv[2]);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	nbad = capture_verify(argv[1], nthreads > 0 ? nthreads : 1, print_bad, NULL, &h);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (nbad < 0)
+		return nbad;
+	dt = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+	printf("%s: %llu bytes, %s, %d bad blocks (%.0f MB/s)\n", argv[1], (unsigned long long)h.length,
+	       nbad ? "CORRUPT" : "ok", nbad, dt > 0 ? h.length / dt * 1e-6 : 0.0);
+	if (!nbad && !stat(argv[1], &st) && (uint64_t)st.st_size > h.length)
+		printf("%s: the last %llu bytes are not in the index, the capture was not closed\n", argv[1],
+		       (unsigned long long)(st.st_size - h.length));
+	return nbad ? -EIO : 0;
+}
+
+static int recv_payload(int fd, const struct net_header *h, char *buf, FILE *out, struct bfp_stats *st)
+{
+	const struct pyr_entry *e = (const struct pyr_entry *)buf;
+	int16_t iq[2 * BFP_BLOCK];
+	size_t k, off;
+	int ret;
+
+	if ((ret = net_recv(fd, buf, h->len)) < 0)
+		return ret;
+	switch (h->kind) {
+	case NET_IQ16:
+		if (out && fwrite(buf, 1, h->len, out) != h->len)
+			return -errno;
+		break;
+	case NET_SUMMARY:
+		for (k = 0; out && k < h->len / sizeof(*e); k++)
+			fprintf(out, "%llu, %d, %d, %d, %d, %d, %d\n",
+			        (unsigned long long)h->first + k * h->ratio,
+			        e[k].min[0], e[k].max[0], e[k].mean[0],
+			        e[k].min[1], e[k].max[1], e[k].mean[1]);
+		break;
+	case NET_BFP:
+		for (off = 0; off + sizeof(struct bfp_block_header) <= h->len; ) {
+			struct bfp_block_header bh;
+			size_t nval;
+
+			memcpy(&bh, buf + off, sizeof(bh));
+			nval = 2 * (size_t)bh.nsamp;
+			off += sizeof(bh);
+			if (bh.nsamp > BFP_BLOCK || off + nval > h->len)
+				return -EINVAL;
+			bfp_decode((const int8_t *)(buf + off), nval, bh.exp, iq);
+			off += nval;
+			st->sqnr_sum += bh.sqnr_cdb / 100.0;
+			if (!st->nblocks || bh.sqnr_cdb / 100.0 < st->sqnr_min)
+				st->sqnr_min = bh.sqnr_cdb / 100.0;
+			st->nblocks++;
+			if (out && fwrite(iq, sizeof(int16_t), nval, out) != nval)
+				return -errno;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int cmd_listen(int argc, char **argv)
+{
+	struct net_header h;
+	struct bfp_stats st = { 0 };
+	unsigned long long nmsg = 0, nsamp = 0, bytes = 0;
+	char *buf = NULL;
+	size_t cap = 0;
+	FILE *out = NULL;
+	int fd, ret;
+
+	if (argc != 2 && argc != 3)
+		return -EINVAL;
+	fprintf(stderr, "waiting on port %s\n", argv[1]);
+	fd = net_accept(argv[1]);
+	if (fd < 0)
+		return fd;
+	if (argc == 3 && !(out = fopen(argv[2], "wb"))) {
+		ret = -errno;
+		net_close(fd);
+		return ret;
+	}
+
+	while (!(ret = net_recv(fd, &h, sizeof(h)))) {
+		if (memcmp(h.magic, "IQNT", 4) || h.kind >= NET_NKIND) {
+			ret = -EINVAL;
+			break;
+		}
+		if (h.len > NET_MAX_PAYLOAD) {
+			ret = -EMSGSIZE;
+			break;
+		}
+		if (h.len > cap) {
+			char *b = realloc(buf, h.len);
+			if (!b) {
+				ret = -ENOMEM;
+				break;
+			}
+			buf = b;
+			cap = h.len;
+		}
+		if ((ret = recv_payload(fd, &h, buf, out, &st)) < 0)
+			break;
+		if (!nmsg)
+			fprintf(stderr, "receiving %s 1:%u\n", net_kind_name(h.kind), h.ratio);
+		nmsg++;
+		nsamp += h.nsamp;
+		bytes += sizeof(h) + h.len;
+	}
+	// the sender closing the connection is the normal end
+	if (ret == -EPIPE)
+		ret = 0;
+
+	printf("%llu messages, %llu samples in %llu bytes (%.1fx less than raw)\n",
+	       nmsg, nsamp, bytes, bytes ? nsamp * 4.0 / bytes : 0.0);
+	if (st.nblocks)
+		printf("%llu bfp blocks, SQNR min %.2f dB, mean %.2f dB\n", (unsigned long long)st.nblocks,
+		       st.sqnr_min, st.sqnr_sum / st.nblocks);
+	free(buf);
+	if (out)
+		fclose(out);
+	net_close(fd);
+	return ret;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmd_zsub(int argc, char **argv)
+{
+	unsigned long long nmsg = 0, bytes = 0, want = 0;
+	void *buf = NULL;
+	size_t cap = 0;
+	FILE *out = NULL;
+	double t0 = 0;
+	ssize_t len;
+	int fd, ret = 0;
+
+	if (argc < 2 || argc > 4)
+		return -EINVAL;
+	if (argc == 4)
+		want = strtoull(argv[3], NULL, 0);
+	// the publisher may not be up yet, a SUB socket keeps trying as well
+	fd = zsub_connect(argv[1], "", 10000);
+	if (fd < 0)
+		return fd;
+	if (argc >= 3 && *argv[2] && !(out = fopen(argv[2], "wb"))) {
+		ret = -errno;
+		net_close(fd);
+		return ret;
+	}
+	fprintf(stderr, "subscribed to %s\n", argv[1]);
+
+	while (!want || nmsg < want) {
+		if ((len = zsub_recv(fd, &buf, &cap)) < 0) {
+			ret = len;
+			break;
+		}
+		if (!nmsg)
+			t0 = now_sec();
+		if (out && fwrite(buf, 1, len, out) != (size_t)len) {
+			ret = -errno;
+			break;
+		}
+		nmsg++;
+		bytes += len;
+	}
+	// the publisher closing the connection is the normal end
+	if (ret == -EPIPE)
+		ret = 0;
+
+	t0 = now_sec() - t0;
+	printf("%llu messages, %llu bytes", nmsg, bytes);
+	if (nmsg > 1 && t0 > 0)
+		printf(", %.2f MB/s", bytes / t0 * 1e-6);
+	printf("\n");
+	free(buf);
+	if (out)
+		fclose(out);
+	net_close(fd);
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	const char *args;
+	int (*fn)(int argc, char **argv);
+} cmds[] = {
+	{ "overview", "<capture> <first> <count> <width>", cmd_overview },
+	{ "chunks",   "<capture> [peak N] [rms X] [clips N]", cmd_chunks },
+	{ "decode",   "<capture> [out]", cmd_decode },
+	{ "tofloat",  "<capture> <out>", cmd_tofloat },
+	{ "verify",   "<capture> [threads]", cmd_verify },
+	{ "listen",   "<port> [out]", cmd_listen },
+	{ "zsub",     "<host:port> [out] [messages]", cmd_zsub },
+};
+
+static void usage(const char *prog)
+{
+	size_t k;
+	fprintf(stderr, "usage:\n");
+	for (k = 0; k < sizeof(cmds) / sizeof(cmds[0]); k++)
+		fprintf(stderr, "  %s %s %s\n", prog, cmds[k].name, cmds[k].args);
+}
+
+int main(int argc, char **argv)
+{
+	size_t k;
+	int ret;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (k = 0; k < sizeof(cmds) / sizeof(cmds[0]); k++) {
+		if (strcmp(cmds[k].name, argv[1]))
+			continue;
+		ret = cmds[k].fn(argc - 1, argv + 1);
+		if (ret == -EINVAL)
+			usage(argv[0]);
+		else if (ret < 0)
+			fprintf(stderr, "%s: %s\n", argv[1], strerror(-ret));
+		return ret < 0;
+	}
+	usage(argv[0]);
+	return 1;
+}
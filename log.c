@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * log.c - logging from the streaming path
+ *
+ * The ring is a bounded multi producer queue with a sequence number per
+ * slot (the one described by Dmitry Vyukov): a producer claims a slot by
+ * advancing head with a compare and swap and publishes it by storing the
+ * slot's sequence number; the formatting thread is the only consumer.
+ **/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+#define LOG_RING  4096   // events, power of two
+#define LOG_LINE  512
+#define LOG_IDLE_NS 1000000  // formatting thread poll interval when idle
+
+struct log_slot {
+	atomic_size_t seq;
+	enum log_level level;
+	unsigned nargs;
+	uint64_t buf;
+	uint64_t sample;
+	uint64_t t_ns;
+	const char *fmt;
+	struct log_arg args[LOG_MAX_ARGS];
+};
+
+enum log_level log_level = LOG_INFO;
+
+static struct log_slot ring[LOG_RING];
+static atomic_size_t head;
+static atomic_size_t tail;
+static atomic_ulong dropped;
+static atomic_bool running;
+static bool started;
+static pthread_t thread;
+static FILE *out;
+static uint64_t t0;
+
+static const char *const level_names[] = { "ERR", "WARN", "INFO", "DEBUG" };
+
+const char *log_level_name(enum log_level level)
+{
+	return level <= LOG_DEBUG ? level_names[level] : "?";
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	// served from the vDSO, no system call
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void log_event(enum log_level level, uint64_t buf, uint64_t sample, const char *fmt,
+	       unsigned nargs, const struct log_arg *args)
+{
+	size_t pos = atomic_load_explicit(&head, memory_order_relaxed);
+	struct log_slot *s;
+
+	for (;;) {
+		size_t seq;
+		intptr_t dif;
+
+		s = &ring[pos & (LOG_RING - 1)];
+		seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1,
+								  memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			// full, the formatting thread is behind
+			atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&head, memory_order_relaxed);
+		}
+	}
+
+	s->level = level;
+	s->buf = buf;
+	s->sample = sample;
+	s->t_ns = now_ns();
+	s->fmt = fmt;
+	s->nargs = nargs < LOG_MAX_ARGS ? nargs : LOG_MAX_ARGS;
+	memcpy(s->args, args, s->nargs * sizeof(*args));
+	atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+}
+
+/* format one conversion spec (without length modifiers) with an argument of any type */
+static int format_arg(char *dst, size_t len, const char *spec, size_t speclen, char conv,
+		      const struct log_arg *a)
+{
+	char f[32];
+	size_t k, n = 0;
+	bool is_int = strchr("diouxXc", conv) != NULL;
+	bool is_flt = strchr("eEfFgGaA", conv) != NULL;
+
+	for (k = 0; k < speclen && n < sizeof(f) - 4; k++)
+		if (!strchr("hlLqjzt", spec[k]))
+			f[n++] = spec[k];
+
+	if (a->type == 'i' && is_int && conv != 'c') {
+		f[n++] = 'l'; f[n++] = 'l'; f[n++] = conv; f[n] = 0;
+		return snprintf(dst, len, f, a->i);
+	}
+	if (a->type == 'i' && conv == 'c') {
+		f[n++] = conv; f[n] = 0;
+		return snprintf(dst, len, f, (int)a->i);
+	}
+	if (a->type == 'd' && is_flt) {
+		f[n++] = conv; f[n] = 0;
+		return snprintf(dst, len, f, a->d);
+	}
+	if (a->type == 's' && conv == 's') {
+		f[n++] = conv; f[n] = 0;
+		return snprintf(dst, len, f, a->s ? a->s : "(null)");
+	}
+	// conversion and argument don't match, print the argument plainly
+	switch (a->type) {
+	case 'i': return snprintf(dst, len, "%lld", a->i);
+	case 'd': return snprintf(dst, len, "%g", a->d);
+	default:  return snprintf(dst, len, "%s", a->s ? a->s : "(null)");
+	}
+}
+
+static void format_event(const struct log_slot *s)
+{
+	char line[LOG_LINE];
+	const char *p = s->fmt;
+	size_t n = 0;
+	unsigned arg = 0;
+	int w;
+
+	w = snprintf(line, sizeof(line), "* %10.6f %-5s", (double)(int64_t)(s->t_ns - t0) * 1e-9,
+		     log_level_name(s->level));
+	n = w > 0 ? (size_t)w : 0;
+	if (s->buf != LOG_NONE && n < sizeof(line))
+		n += snprintf(line + n, sizeof(line) - n, " buf=%llu", (unsigned long long)s->buf);
+	if (s->sample != LOG_NONE && n < sizeof(line))
+		n += snprintf(line + n, sizeof(line) - n, " sample=%llu", (unsigned long long)s->sample);
+	if (n < sizeof(line) - 1)
+		line[n++] = ' ';
+
+	while (*p && n < sizeof(line) - 1) {
+		const char *spec;
+
+		if (*p != '%') {
+			line[n++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			line[n++] = '%';
+			p += 2;
+			continue;
+		}
+		spec = p++;
+		while (*p && !strchr("diouxXceEfFgGaAsp", *p))
+			p++;
+		if (!*p)
+			break;
+		if (arg < s->nargs) {
+			w = format_arg(line + n, sizeof(line) - n, spec, p - spec, *p, &s->args[arg++]);
+			if (w > 0)
+				n += (size_t)w;
+		}
+		p++;
+	}
+	if (n > sizeof(line) - 2)
+		n = sizeof(line) - 2;
+	line[n++] = '\n';
+	fwrite(line, 1, n, out);
+	if (s->level <= LOG_WARN)
+		fflush(out);
+}
+
+/* format what is in the ring, returns the number of events */
+static size_t log_drain(void)
+{
+	size_t count = 0;
+
+	for (;;) {
+		size_t pos = atomic_load_explicit(&tail, memory_order_relaxed);
+		struct log_slot *s = &ring[pos & (LOG_RING - 1)];
+
+		if (atomic_load_explicit(&s->seq, memory_order_acquire) != pos + 1)
+			break;
+		format_event(s);
+		atomic_store_explicit(&s->seq, pos + LOG_RING, memory_order_release);
+		atomic_store_explicit(&tail, pos + 1, memory_order_release);
+		count++;
+	}
+	return count;
+}
+
+static void *log_thread(void *arg)
+{
+	const struct timespec idle = { 0, LOG_IDLE_NS };
+
+	while (atomic_load(&running)) {
+		if (!log_drain()) {
+			fflush(out);
+			nanosleep(&idle, NULL);
+		}
+	}
+	log_drain();
+	fflush(out);
+	return NULL;
+}
+
+int log_start(FILE *f, enum log_level level)
+{
+	size_t k;
+
+	if (started)
+		return 0;
+	for (k = 0; k < LOG_RING; k++)
+		atomic_init(&ring[k].seq, k);
+	out = f;
+	log_level = level;
+	t0 = now_ns();
+	atomic_store(&running, true);
+	if (pthread_create(&thread, NULL, log_thread, NULL)) {
+		atomic_store(&running, false);
+		return -1;
+	}
+	started = true;
+	return 0;
+}
+
+void log_flush(void)
+{
+	const struct timespec idle = { 0, LOG_IDLE_NS / 10 };
+	size_t end = atomic_load(&head);
+
+	if (!started)
+		return;
+	while (atomic_load(&tail) < end)
+		nanosleep(&idle, NULL);
+	fflush(out);
+}
+
+void log_stop(void)
+{
+	unsigned long n;
+
+	if (!started)
+		return;
+	atomic_store(&running, false);
+	pthread_join(thread, NULL);
+	started = false;
+	n = atomic_load(&dropped);
+	if (n)
+		fprintf(out, "* %lu log events dropped, the ring was full\n", n);
+}
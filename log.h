@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * log.h - logging from the streaming path
+ *
+ * log_ev() copies the format pointer, up to LOG_MAX_ARGS arguments and
+ * the structured fields (buffer number, sample index) into a fixed size
+ * event in a lock-free ring and returns; a background thread formats
+ * and writes the events.  Nothing on the logging side takes a lock or
+ * makes a system call, so it can be used in the RX loop, the sink
+ * threads and signal handlers.  When the ring is full the event is
+ * dropped and counted instead of waiting.
+ *
+ * The format must be a string literal and string arguments must outlive
+ * the event (literals, argv, static buffers).  Arguments are passed as
+ * long long, double or const char * depending on their type, so the
+ * conversions have to match: %lld/%llu/%llx, %f/%g/%e, %s.
+ *
+ *   log_ev(LOG_INFO, rx_loop, nrx, "burst %u, peak %.1f dB", nburst, db);
+ *
+ * LOG_NONE for the buffer number or sample index leaves the field out.
+ **/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum log_level {
+	LOG_ERR,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG,
+};
+
+#define LOG_MAX_ARGS 6
+#define LOG_NONE     UINT64_MAX
+
+struct log_arg {
+	char type;              // 'i', 'd' or 's'
+	union {
+		long long i;
+		double d;
+		const char *s;
+	};
+};
+
+extern enum log_level log_level;
+
+/* start the formatting thread writing to out */
+int log_start(FILE *out, enum log_level level);
+/* wait until the events logged so far are written */
+void log_flush(void);
+/* flush, stop the thread and report dropped events */
+void log_stop(void);
+const char *log_level_name(enum log_level level);
+
+void log_event(enum log_level level, uint64_t buf, uint64_t sample, const char *fmt,
+	       unsigned nargs, const struct log_arg *args);
+
+static inline struct log_arg log_arg_i(long long v) { struct log_arg a = { 'i', { .i = v } }; return a; }
+static inline struct log_arg log_arg_d(double v) { struct log_arg a = { 'd', { .d = v } }; return a; }
+static inline struct log_arg log_arg_s(const char *v) { struct log_arg a = { 's', { .s = v } }; return a; }
+
+#define LOG_ARG(x) _Generic((x), \
+	float: log_arg_d, double: log_arg_d, \
+	char *: log_arg_s, const char *: log_arg_s, \
+	default: log_arg_i)(x)
+
+/* number of arguments after the format, and each of them as a struct log_arg */
+#define LOG_N(...) LOG_N_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_N_(f, a, b, c, d, e, g, n, ...) n
+#define LOG_MAP0(f)
+#define LOG_MAP1(f, a) , LOG_ARG(a)
+#define LOG_MAP2(f, a, ...) , LOG_ARG(a) LOG_MAP1(f, __VA_ARGS__)
+#define LOG_MAP3(f, a, ...) , LOG_ARG(a) LOG_MAP2(f, __VA_ARGS__)
+#define LOG_MAP4(f, a, ...) , LOG_ARG(a) LOG_MAP3(f, __VA_ARGS__)
+#define LOG_MAP5(f, a, ...) , LOG_ARG(a) LOG_MAP4(f, __VA_ARGS__)
+#define LOG_MAP6(f, a, ...) , LOG_ARG(a) LOG_MAP5(f, __VA_ARGS__)
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+#define LOG_FMT(f, ...) f
+
+#define log_ev(level, buf, sample, ...) do { \
+	if ((level) <= log_level) \
+		log_event(level, buf, sample, LOG_FMT(__VA_ARGS__, 0), LOG_N(__VA_ARGS__), \
+			  (const struct log_arg[]){ { 0 } LOG_CAT(LOG_MAP, LOG_N(__VA_ARGS__))(__VA_ARGS__) } + 1); \
+} while (0)
+
+#endif
@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * net.c - sending reduced sample streams off the board over TCP
+ *
+ * Kept apart from the streaming example, which has its own shutdown().
+ **/
+
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "net.h"
+
+static const char *const kind_names[NET_NKIND] = { "dec", "sum", "bfp" };
+
+const char *net_kind_name(enum net_kind k)
+{
+	return k < NET_NKIND ? kind_names[k] : "?";
+}
+
+int net_kind_parse(const char *name, enum net_kind *k)
+{
+	unsigned i;
+	for (i = 0; i < NET_NKIND; i++) {
+		if (!strcmp(name, kind_names[i])) {
+			*k = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int resolve(const char *host, const char *port, int passive, struct addrinfo **res)
+{
+	struct addrinfo hints;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	ret = getaddrinfo(host, port, &hints, res);
+	if (ret)
+		return ret == EAI_SYSTEM ? -errno : -EHOSTUNREACH;
+	return 0;
+}
+
+int net_connect(const char *hostport)
+{
+	char host[256];
+	const char *colon = strrchr(hostport, ':');
+	struct addrinfo *res, *ai;
+	int fd = -ENOTCONN, one = 1, ret;
+
+	if (!colon || colon == hostport || (size_t)(colon - hostport) >= sizeof(host))
+		return -EINVAL;
+	memcpy(host, hostport, colon - hostport);
+	host[colon - hostport] = 0;
+
+	ret = resolve(host, colon + 1, 0, &res);
+	if (ret)
+		return ret;
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			fd = -errno;
+			continue;
+		}
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		ret = -errno;
+		close(fd);
+		fd = ret;
+	}
+	freeaddrinfo(res);
+	// messages are batched by the caller, don't hold back the last one
+	if (fd >= 0)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+int net_listen(const char *port, int backlog)
+{
+	struct addrinfo *res;
+	int lfd, one = 1, ret;
+
+	ret = resolve(NULL, port, 1, &res);
+	if (ret)
+		return ret;
+	lfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (lfd < 0) {
+		ret = -errno;
+		freeaddrinfo(res);
+		return ret;
+	}
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(lfd, res->ai_addr, res->ai_addrlen) || listen(lfd, backlog)) {
+		ret = -errno;
+		freeaddrinfo(res);
+		close(lfd);
+		return ret;
+	}
+	freeaddrinfo(res);
+	return lfd;
+}
+
+int net_accept(const char *port)
+{
+	int lfd = net_listen(port, 1), fd, ret;
+
+	if (lfd < 0)
+		return lfd;
+	fd = accept(lfd, NULL, NULL);
+	ret = fd < 0 ? -errno : fd;
+	close(lfd);
+	return ret;
+}
+
+int net_send(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int net_recv(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len) {
+		ssize_t n = recv(fd, p, len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (n == 0)
+			return -EPIPE;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+void net_close(int fd)
+{
+	if (fd >= 0)
+		close(fd);
+}
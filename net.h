@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * net.h - sending reduced sample streams off the board over TCP
+ *
+ * When the program runs on the Pluto itself the samples are reduced
+ * there and the result goes out as a stream of messages, each a
+ * net_header followed by len bytes of payload:
+ *
+ *  NET_IQ16     decimated interleaved int16 I/Q, ratio input samples per
+ *               output sample
+ *  NET_SUMMARY  struct pyr_entry (min/max/mean of I and Q), each one
+ *               summarizing ratio input samples
+ *  NET_BFP      bfp blocks as in the bfp capture format, a
+ *               bfp_block_header followed by 2 * nsamp mantissas
+ *
+ * All fields are little endian (both ends are ARM or x86).
+ **/
+
+#ifndef NET_H
+#define NET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum net_kind {
+	NET_IQ16,
+	NET_SUMMARY,
+	NET_BFP,
+	NET_NKIND
+};
+
+struct net_header {
+	char magic[4];          // "IQNT"
+	uint16_t kind;          // enum net_kind
+	uint16_t ratio;         // input samples per output sample or entry
+	uint32_t nsamp;         // input samples covered by this message
+	uint32_t len;           // payload bytes
+	uint64_t first;         // index of the first input sample
+};
+
+const char *net_kind_name(enum net_kind k);
+int net_kind_parse(const char *name, enum net_kind *k);
+
+#define NET_MAX_PAYLOAD (16 << 20)  // larger messages are refused by the receiver
+
+/* connect to "host:port", returns the socket or -errno */
+int net_connect(const char *hostport);
+/* listening socket on port, all addresses, returns it or -errno */
+int net_listen(const char *port, int backlog);
+/* listen on port and accept one connection, returns the socket or -errno */
+int net_accept(const char *port);
+/* send or receive exactly len bytes, 0 or -errno (-EPIPE when the peer closed) */
+int net_send(int fd, const void *buf, size_t len);
+int net_recv(int fd, void *buf, size_t len);
+void net_close(int fd);
+
+#endif
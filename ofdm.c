@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ofdm.c - OFDM loopback modem
+ **/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ofdm.h"
+
+#define SC_THRESHOLD  0.5   // Schmidl-Cox metric of the preamble plateau
+#define LTS_THRESHOLD 0.5   // normalized correlation with the long training symbol
+
+/* PRBS15, x^15 + x^14 + 1 */
+static unsigned prbs(uint16_t *s)
+{
+	unsigned b = ((*s >> 14) ^ (*s >> 13)) & 1;
+	*s = (uint16_t)(((*s << 1) | b) & 0x7fff);
+	return b;
+}
+
+int ofdm_cfg_parse(const char *spec, struct ofdm_cfg *cfg)
+{
+	unsigned long v[4] = { 256, 32, 8, 16 };
+	char *end;
+	int k;
+
+	for (k = 0; k < 4 && *spec; k++) {
+		v[k] = strtoul(spec, &end, 0);
+		if (end == spec || (*end && *end != ':'))
+			return -1;
+		spec = *end ? end + 1 : end;
+	}
+	if (v[0] < 64 || v[0] > 4096 || (v[0] & (v[0] - 1)) || !v[1] || v[1] > v[0] / 2 || v[2] < 2 || !v[3])
+		return -1;
+	cfg->nfft = v[0];
+	cfg->ncp = v[1];
+	cfg->pilot = v[2];
+	cfg->nsym = v[3];
+	return 0;
+}
+
+int ofdm_carrier(const struct ofdm *o, size_t i)
+{
+	return o->bin[i] < o->cfg.nfft / 2 ? (int)o->bin[i] : (int)o->bin[i] - (int)o->cfg.nfft;
+}
+
+size_t ofdm_frame_bits(const struct ofdm *o)
+{
+	return 2 * o->ndata * o->cfg.nsym;
+}
+
+/* inverse transform of one symbol given per used carrier, scaled to unit RMS, with its prefix */
+static void ofdm_symbol(struct ofdm *o, const float complex *val, float complex *out)
+{
+	size_t nfft = o->cfg.nfft, ncp = o->cfg.ncp, i, nz = 0;
+	float complex *t = out + ncp;
+	float scale;
+
+	memset(t, 0, nfft * sizeof(*t));
+	for (i = 0; i < o->nused; i++) {
+		t[o->bin[i]] = val[i];
+		nz += val[i] != 0;
+	}
+	fft_execute(o->inv, t);
+	scale = 1.0f / sqrtf((float)nz);
+	for (i = 0; i < nfft; i++)
+		t[i] *= scale;
+	memcpy(out, t + nfft - ncp, ncp * sizeof(*out));
+}
+
+struct ofdm *ofdm_create(const struct ofdm_cfg *cfg)
+{
+	size_t nfft = cfg->nfft, half = nfft * 3 / 8, i, k, nd;
+	uint16_t seed = 0x7fff;
+	float complex *val;
+	struct ofdm *o;
+
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		return NULL;
+	o->cfg = *cfg;
+	o->nused = 2 * half;
+	o->symlen = nfft + cfg->ncp;
+	o->frame_len = (2 + cfg->nsym) * o->symlen;
+	o->bin = malloc(o->nused * sizeof(*o->bin));
+	o->pilot = malloc(o->nused);
+	o->lts = malloc(o->nused * sizeof(*o->lts));
+	o->lts_t = malloc(nfft * sizeof(*o->lts_t));
+	o->ref = malloc(cfg->nsym * o->nused * sizeof(*o->ref));
+	o->bits = malloc(2 * cfg->nsym * o->nused);
+	o->frame = malloc(o->frame_len * sizeof(*o->frame));
+	o->work = malloc((o->frame_len + 2 * cfg->ncp) * sizeof(*o->work));
+	o->sym = malloc((1 + cfg->nsym) * nfft * sizeof(*o->sym));
+	o->h = malloc(o->nused * sizeof(*o->h));
+	o->sig = calloc(o->nused, sizeof(*o->sig));
+	o->err = calloc(o->nused, sizeof(*o->err));
+	o->fwd = fft_plan_create(nfft, FFT_FORWARD);
+	o->inv = fft_plan_create(nfft, FFT_INVERSE);
+	val = malloc(o->nused * sizeof(*val));
+	if (!o->bin || !o->pilot || !o->lts || !o->lts_t || !o->ref || !o->bits || !o->frame ||
+	    !o->work || !o->sym || !o->h || !o->sig || !o->err || !o->fwd || !o->inv || !val) {
+		free(val);
+		ofdm_destroy(o);
+		return NULL;
+	}
+
+	for (i = 0; i < half; i++) {
+		o->bin[i] = i + 1;
+		o->bin[half + i] = nfft - half + i;
+	}
+	for (i = 0; i < o->nused; i++)
+		o->pilot[i] = i % cfg->pilot == 0;
+
+	// preamble: BPSK on the even carriers only
+	for (i = 0; i < o->nused; i++)
+		val[i] = o->bin[i] % 2 ? 0 : (prbs(&seed) ? -1.0f : 1.0f);
+	ofdm_symbol(o, val, o->frame);
+
+	// long training symbol: BPSK everywhere
+	for (i = 0; i < o->nused; i++)
+		o->lts[i] = prbs(&seed) ? -1.0f : 1.0f;
+	ofdm_symbol(o, o->lts, o->frame + o->symlen);
+	memcpy(o->lts_t, o->frame + o->symlen + cfg->ncp, nfft * sizeof(*o->lts_t));
+
+	// data: QPSK, bit 1 is negative, pilots BPSK
+	for (k = 0, nd = 0; k < cfg->nsym; k++) {
+		float complex *ref = o->ref + k * o->nused;
+		for (i = 0; i < o->nused; i++) {
+			if (o->pilot[i]) {
+				ref[i] = prbs(&seed) ? -1.0f : 1.0f;
+			} else {
+				uint8_t b0 = prbs(&seed), b1 = prbs(&seed);
+				o->bits[nd++] = b0;
+				o->bits[nd++] = b1;
+				ref[i] = ((b0 ? -1.0f : 1.0f) + I * (b1 ? -1.0f : 1.0f)) * (float)M_SQRT1_2;
+			}
+		}
+		ofdm_symbol(o, ref, o->frame + (2 + k) * o->symlen);
+	}
+	o->ndata = nd / 2 / cfg->nsym;
+	free(val);
+	return o;
+}
+
+void ofdm_destroy(struct ofdm *o)
+{
+	if (!o)
+		return;
+	free(o->bin);
+	free(o->pilot);
+	free(o->lts);
+	free(o->lts_t);
+	free(o->ref);
+	free(o->bits);
+	free(o->frame);
+	free(o->work);
+	free(o->sym);
+	free(o->h);
+	free(o->sig);
+	free(o->err);
+	free(o->buf);
+	fft_plan_destroy(o->fwd);
+	fft_plan_destroy(o->inv);
+	free(o);
+}
+
+void ofdm_tx(struct ofdm *o, float complex *out, size_t n)
+{
+	while (n) {
+		size_t m = o->frame_len - o->tx_pos;
+		if (m > n)
+			m = n;
+		memcpy(out, o->frame + o->tx_pos, m * sizeof(*out));
+		out += m;
+		n -= m;
+		o->tx_pos = (o->tx_pos + m) % o->frame_len;
+	}
+}
+
+/*
+ * demodulate the frame whose preamble starts near o->start.  Returns where
+ * the next one should start, or 0 when the training symbol is not there.
+ */
+static size_t ofdm_frame(struct ofdm *o)
+{
+	size_t nfft = o->cfg.nfft, ncp = o->cfg.ncp, nsym = o->cfg.nsym;
+	size_t len = o->frame_len + 2 * ncp, expect = o->symlen + ncp, lo, hi, off, best_off = 0, i, k, nd;
+	double best = 0, e_lts = 0;
+	double complex rot, p = 0;
+
+	// frequency offset from the phase between the preamble halves, then out of
+	// the frame with the phase running from the preamble start
+	for (i = 0; i < nfft / 2; i++) {
+		const float complex *r = o->buf + o->start + ncp / 2 + i;
+		p += conjf(r[0]) * r[nfft / 2];
+	}
+	o->cfo = carg(p) / (M_PI * nfft);
+	rot = cexp(-2.0 * M_PI * I * o->cfo);
+	{
+		double complex ph = 1;
+		for (i = 0; i < len; i++) {
+			o->work[i] = o->buf[o->start + i] * (float complex)ph;
+			ph *= rot;
+			if ((i & 1023) == 1023)
+				ph /= cabs(ph);
+		}
+	}
+
+	// fine timing: correlate with the long training symbol within half a prefix either way
+	for (i = 0; i < nfft; i++)
+		e_lts += crealf(o->lts_t[i] * conjf(o->lts_t[i]));
+	lo = expect > ncp / 2 ? expect - ncp / 2 : 0;
+	hi = expect + ncp / 2;
+	for (off = lo; off <= hi; off++) {
+		float complex c = 0;
+		float e = 0;
+		for (i = 0; i < nfft; i++) {
+			c += o->work[off + i] * conjf(o->lts_t[i]);
+			e += crealf(o->work[off + i] * conjf(o->work[off + i]));
+		}
+		if (e > 0 && cabsf(c) / sqrt(e * e_lts) > best) {
+			best = cabsf(c) / sqrt(e * e_lts);
+			best_off = off;
+		}
+	}
+	if (best < LTS_THRESHOLD)
+		return 0;
+
+	// every window starts a quarter prefix early, the channel estimate takes up the phase slope
+	off = best_off - ncp / 4;
+	for (k = 0; k <= nsym; k++)
+		memcpy(o->sym + k * nfft, o->work + off + k * o->symlen, nfft * sizeof(*o->sym));
+	fft_execute_batch(o->fwd, o->sym, nsym + 1);
+
+	// the training symbol is +-1, keep the inverse of the channel to equalize with multiplies
+	for (i = 0; i < o->nused; i++) {
+		float complex h = o->sym[o->bin[i]] * o->lts[i];
+		float p = crealf(h * conjf(h));
+		o->h[i] = p > 0 ? conjf(h) / p : 0;
+	}
+
+	for (k = 0, nd = 0; k < nsym; k++) {
+		const float complex *y = o->sym + (k + 1) * nfft, *ref = o->ref + k * o->nused;
+		float complex z, acc = 0, cp;
+
+		// common phase from the pilots
+		for (i = 0; i < o->nused; i++)
+			if (o->pilot[i])
+				acc += y[o->bin[i]] * o->h[i] * conjf(ref[i]);
+		cp = acc != 0 ? conjf(acc) / cabsf(acc) : 1;
+
+		for (i = 0; i < o->nused; i++) {
+			float complex d;
+			if (o->pilot[i])
+				continue;
+			z = y[o->bin[i]] * o->h[i] * cp;
+			o->bit_errors += (crealf(z) < 0) != o->bits[nd];
+			o->bit_errors += (cimagf(z) < 0) != o->bits[nd + 1];
+			nd += 2;
+			d = z - ref[i];
+			o->sig[i] += 1;
+			o->err[i] += crealf(d * conjf(d));
+		}
+	}
+	o->nbits += nd;
+	o->frames++;
+	o->cfo_sum += o->cfo;
+	return o->start + best_off - expect + o->frame_len;
+}
+
+/* Schmidl-Cox sums for the window at o->scan */
+static void sc_sums(struct ofdm *o)
+{
+	size_t half = o->cfg.nfft / 2, m;
+	const float complex *r = o->buf + o->scan;
+
+	o->p = 0;
+	o->r = 0;
+	for (m = 0; m < half; m++) {
+		o->p += conjf(r[m]) * r[m + half];
+		o->r += crealf(r[m + half] * conjf(r[m + half]));
+	}
+	o->sums = true;
+}
+
+/* drop the samples before pos */
+static void ofdm_consume(struct ofdm *o, size_t pos)
+{
+	if (pos > o->len)
+		pos = o->len;
+	memmove(o->buf, o->buf + pos, (o->len - pos) * sizeof(*o->buf));
+	o->len -= pos;
+	o->scan -= pos;
+	o->first -= o->plateau ? pos : 0;
+	o->start -= o->found ? pos : 0;
+	o->resume -= o->found ? pos : 0;
+}
+
+int ofdm_rx(struct ofdm *o, const float complex *in, size_t n)
+{
+	size_t half = o->cfg.nfft / 2, ncp = o->cfg.ncp;
+
+	if (o->len + n > o->cap) {
+		size_t cap = 2 * (o->len + n) + 2 * o->frame_len;
+		float complex *b = realloc(o->buf, cap * sizeof(*b));
+		if (!b)
+			return -ENOMEM;
+		o->buf = b;
+		o->cap = cap;
+	}
+	memcpy(o->buf + o->len, in, n * sizeof(*in));
+	o->len += n;
+
+	for (;;) {
+		if (o->found) {
+			size_t next;
+			if (o->start + o->frame_len + 2 * o->cfg.ncp > o->len)
+				break;
+			next = ofdm_frame(o);
+			o->found = false;
+			o->plateau = false;
+			o->sums = false;
+			if (!next) {
+				o->rejected++;
+				if (o->retry) {
+					// nor its later part: go on behind the plateau and take no other
+					// candidate for a frame, noise on a tone gives one after another
+					o->scan = o->resume;
+					o->holdoff = o->frame_len;
+					o->retry = false;
+				} else {
+					// the plateau often runs early into the symbol before, once more from its later part
+					o->scan = o->start + ncp;
+					o->retry = o->scan < o->resume;
+				}
+			} else {
+				// locked: the next frame follows, only its training symbol is checked
+				o->start = next;
+				o->found = true;
+				o->scan = next;
+				o->resume = next + ncp;
+				o->retry = false;
+			}
+			if (o->scan > o->len)
+				o->scan = o->len;
+			ofdm_consume(o, o->scan);
+			continue;
+		}
+
+		// look for the plateau of the preamble, at least half a prefix long
+		while (o->scan + 2 * half < o->len) {
+			const float complex *r = o->buf + o->scan;
+			double m;
+
+			if (!o->sums)
+				sc_sums(o);
+			m = o->r > 0 ? creal(o->p * conj(o->p)) / (o->r * o->r) : 0;
+			if (m > SC_THRESHOLD) {
+				if (!o->plateau) {
+					o->plateau = true;
+					o->first = o->scan;
+				}
+				if (o->scan - o->first > 4 * ncp + half)
+					o->plateau = false;   // too long for a preamble, hum or a tone
+			} else if (o->plateau) {
+				size_t width = o->scan - o->first;
+				o->plateau = false;
+				if (width >= ncp / 2 + 1 && !o->holdoff) {
+					size_t mid = o->first + width / 2;
+					o->start = mid > ncp / 2 ? mid - ncp / 2 : 0;
+					o->found = true;
+				}
+			}
+			// slide the window by one
+			o->p += conjf(r[half]) * r[2 * half] - conjf(r[0]) * r[half];
+			o->r += crealf(r[2 * half] * conjf(r[2 * half])) - crealf(r[half] * conjf(r[half]));
+			o->scan++;
+			if (o->holdoff)
+				o->holdoff--;
+			if (o->found) {
+				o->resume = o->scan;
+				break;
+			}
+		}
+		if (o->found)
+			continue;
+		// keep what a plateau in progress and the next window need
+		if (!o->plateau && o->scan > o->frame_len)
+			ofdm_consume(o, o->scan);
+		break;
+	}
+	return 0;
+}
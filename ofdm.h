@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ofdm.h - OFDM loopback modem
+ *
+ * A frame is a Schmidl-Cox preamble (only even carriers used, so its two
+ * halves repeat), a long training symbol on every used carrier for the
+ * channel estimate and nsym QPSK data symbols, each with a cyclic prefix.
+ * Every pilot-th used carrier of a data symbol is a known BPSK pilot for
+ * tracking the common phase.  3/8 of the carriers on either side of DC
+ * are used, DC itself is not.  Payload, pilots and training are fixed
+ * pseudo random sequences the receiver knows, so it counts bit errors and
+ * measures the SNR of every carrier from the error vectors.
+ *
+ * The transmitter repeats one frame.  The receiver finds the preamble
+ * plateau, takes the frequency offset from its phase, refines the timing
+ * by correlating with the long training symbol, then transforms all
+ * symbols of the frame in one batch, equalizes and demaps.  Once a frame
+ * was received the next one is expected right after it and the preamble
+ * search only runs again when its training symbol is missing.
+ **/
+
+#ifndef OFDM_H
+#define OFDM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <complex.h>
+
+#include "dsp.h"
+
+struct ofdm_cfg {
+	size_t nfft;      // power of two, 64 to 4096
+	size_t ncp;       // cyclic prefix, at most nfft / 2
+	size_t pilot;     // every pilot-th used carrier is a pilot, 2 or more
+	size_t nsym;      // data symbols per frame
+};
+
+/* "nfft[:cp[:pilot[:nsym]]]", 0 or -1 */
+int ofdm_cfg_parse(const char *spec, struct ofdm_cfg *cfg);
+
+struct ofdm {
+	struct ofdm_cfg cfg;
+	size_t nused;           // used carriers
+	size_t ndata;           // data carriers per symbol
+	size_t symlen;          // nfft + ncp
+	size_t frame_len;       // (2 + nsym) * symlen
+	uint32_t *bin;          // FFT bin of each used carrier, positive ones first
+	uint8_t *pilot;         // 1 for the pilot carriers
+	float complex *lts;     // long training symbol, per used carrier
+	float complex *lts_t;   // and in time, nfft samples
+	float complex *ref;     // transmitted value of every carrier of every data symbol
+	uint8_t *bits;          // 2 per data carrier
+	float complex *frame;   // frame_len samples, unit RMS
+	size_t tx_pos;
+	struct fft_plan *fwd, *inv;
+
+	// receiver
+	float complex *buf;     // samples not consumed yet
+	size_t len, cap;
+	size_t scan;            // next preamble position to test
+	bool sums;              // P and R hold the sums at scan
+	double complex p;       // Schmidl-Cox correlation of the two halves
+	double r;               // and the energy of the second half
+	bool plateau;
+	size_t first;           // start of the plateau
+	bool found;             // a frame starts at start, by the plateau or following the last one
+	size_t start;
+	size_t resume;          // end of the plateau that gave the frame at start
+	bool retry;             // the frame at start is the second try of that plateau
+	size_t holdoff;         // samples to scan before the next candidate
+	double cfo;             // cycles per sample
+	float complex *work;    // frame with the frequency offset taken out
+	float complex *sym;     // 1 + nsym transforms
+	float complex *h;       // inverse of the channel estimate
+
+	// statistics
+	unsigned long long frames, rejected, nbits, bit_errors;
+	double *sig, *err;      // per used carrier, data symbols only
+	double cfo_sum;
+};
+
+struct ofdm *ofdm_create(const struct ofdm_cfg *cfg);
+void ofdm_destroy(struct ofdm *o);
+/* the next n samples of the TX stream, unit RMS */
+void ofdm_tx(struct ofdm *o, float complex *out, size_t n);
+/* receive n samples, frames are demodulated as soon as they are complete. 0 or -ENOMEM */
+int ofdm_rx(struct ofdm *o, const float complex *in, size_t n);
+/* signed carrier number (negative below DC) of used carrier i */
+int ofdm_carrier(const struct ofdm *o, size_t i);
+/* payload bits per frame */
+size_t ofdm_frame_bits(const struct ofdm *o);
+
+#endif
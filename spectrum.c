@@ -0,0 +1,320 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * spectrum.c - averaged spectra and the measurements taken from them
+ **/
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spectrum.h"
+
+struct spectrum *spectrum_create(size_t n)
+{
+	struct spectrum *s = calloc(1, sizeof(*s));
+	double w2 = 0;
+	size_t i;
+
+	if (!s)
+		return NULL;
+	s->n = n;
+	s->fwd = fft_plan_create(n, FFT_FORWARD);
+	s->win = malloc(n * sizeof(*s->win));
+	s->buf = malloc(n * sizeof(*s->buf));
+	s->acc = calloc(n, sizeof(*s->acc));
+	if (!s->fwd || !s->win || !s->buf || !s->acc) {
+		spectrum_destroy(s);
+		return NULL;
+	}
+	// periodic, so a tone on a bin leaks into +-3 bins and no further
+	for (i = 0; i < n; i++) {
+		double a = 2 * M_PI * i / n;
+		s->win[i] = 0.35875 - 0.48829 * cos(a) + 0.14128 * cos(2 * a) - 0.01168 * cos(3 * a);
+		w2 += (double)s->win[i] * s->win[i];
+	}
+	s->scale = 1 / (n * w2);
+	return s;
+}
+
+void spectrum_destroy(struct spectrum *s)
+{
+	if (!s)
+		return;
+	fft_plan_destroy(s->fwd);
+	free(s->win);
+	free(s->buf);
+	free(s->acc);
+	free(s);
+}
+
+void spectrum_feed(struct spectrum *s, const float complex *x, size_t n)
+{
+	while (n) {
+		size_t k = s->n - s->fill < n ? s->n - s->fill : n, i;
+
+		for (i = 0; i < k; i++)
+			s->buf[s->fill + i] = x[i] * s->win[s->fill + i];
+		s->fill += k;
+		x += k;
+		n -= k;
+		if (s->fill < s->n)
+			break;
+		fft_execute(s->fwd, s->buf);
+		for (i = 0; i < s->n; i++) {
+			float re = crealf(s->buf[i]), im = cimagf(s->buf[i]);
+			s->acc[i] += re * re + im * im;
+		}
+		s->navg++;
+		s->fill = 0;
+	}
+}
+
+void spectrum_reset(struct spectrum *s)
+{
+	memset(s->acc, 0, s->n * sizeof(*s->acc));
+	s->navg = 0;
+	s->fill = 0;
+}
+
+unsigned spectrum_take(struct spectrum *s, double *p)
+{
+	unsigned navg = s->navg;
+	double g = navg ? s->scale / navg : 0;
+	size_t i;
+
+	for (i = 0; i < s->n; i++)
+		p[i] = s->acc[i] * g;
+	memset(s->acc, 0, s->n * sizeof(*s->acc));
+	s->navg = 0;
+	return navg;
+}
+
+size_t spectrum_bin(size_t n, double hz, double fs)
+{
+	long long k = llround(hz / fs * n) % (long long)n;
+	return k < 0 ? k + n : k;
+}
+
+double spectrum_lobe(const double *p, size_t n, size_t k)
+{
+	double sum = 0;
+	int d;
+
+	for (d = -SPEC_LOBE; d <= SPEC_LOBE; d++)
+		sum += p[(k + n + d) % n];
+	return sum;
+}
+
+enum { BIN_NOISE, BIN_DC, BIN_TONE, BIN_HARM, BIN_IMAGE };
+
+/* bin of signed frequency f (in bins) */
+static size_t wrap(long long f, size_t n)
+{
+	f %= (long long)n;
+	return f < 0 ? f + n : f;
+}
+
+static long long signed_bin(size_t k, size_t n)
+{
+	return k < n / 2 ? (long long)k : (long long)k - (long long)n;
+}
+
+/* claim the unclaimed bins of the lobe around k for what, returns their power */
+static double claim(const double *p, uint8_t *what, size_t n, size_t k, uint8_t w)
+{
+	double sum = 0;
+	int d;
+
+	for (d = -SPEC_LOBE; d <= SPEC_LOBE; d++) {
+		size_t b = (k + n + d) % n;
+		if (what[b] != BIN_NOISE)
+			continue;
+		what[b] = w;
+		sum += p[b];
+	}
+	return sum;
+}
+
+int tone_analyze(const double *p, size_t n, size_t k, struct tone_meas *m)
+{
+	uint8_t *what = calloc(n, 1);
+	long long f = signed_bin(k, n);
+	double tone, harm = 0, image, noise = 0, spur = 0;
+	size_t b, nnoise = 0;
+	int h;
+
+	if (!what)
+		return -ENOMEM;
+	claim(p, what, n, 0, BIN_DC);
+	tone = claim(p, what, n, k, BIN_TONE);
+	for (h = 2; h <= SPEC_HARMONICS; h++) {
+		harm += claim(p, what, n, wrap(h * f, n), BIN_HARM);
+		harm += claim(p, what, n, wrap(-h * f, n), BIN_HARM);
+	}
+	image = claim(p, what, n, wrap(-f, n), BIN_IMAGE);
+
+	m->spur = 0;
+	for (b = 0; b < n; b++) {
+		if (what[b] == BIN_NOISE) {
+			noise += p[b];
+			nnoise++;
+		}
+		if (what[b] != BIN_DC && what[b] != BIN_TONE && p[b] > spur) {
+			spur = p[b];
+			m->spur = b;
+		}
+	}
+	free(what);
+	spur = spectrum_lobe(p, n, m->spur);
+	noise = nnoise ? noise / nnoise : 0;
+
+	m->level = 10 * log10(tone);
+	m->floor = 10 * log10(noise);
+	m->snr = 10 * log10(tone / (noise * n));
+	m->sinad = 10 * log10(tone / (noise * n + harm + image));
+	m->thd = 10 * log10(harm / tone);
+	m->sfdr = 10 * log10(tone / spur);
+	m->image = 10 * log10(image / tone);
+	m->enob = (m->sinad - 1.76) / 6.02;
+	return 0;
+}
+
+int imd_analyze(const double *p, size_t n, size_t k1, size_t k2, struct imd_meas *m)
+{
+	uint8_t *what = calloc(n, 1);
+	long long f1 = signed_bin(k1, n), f2 = signed_bin(k2, n);
+	const long long prod[4] = { 2 * f1 - f2, 2 * f2 - f1, 3 * f1 - 2 * f2, 3 * f2 - 2 * f1 };
+	double tone[2], im[4], noise = 0, mean, worst;
+	size_t b, nnoise = 0;
+	int j;
+
+	if (!what)
+		return -ENOMEM;
+	claim(p, what, n, 0, BIN_DC);
+	tone[0] = claim(p, what, n, k1, BIN_TONE);
+	tone[1] = claim(p, what, n, k2, BIN_TONE);
+	for (j = 0; j < 4; j++)
+		im[j] = claim(p, what, n, wrap(prod[j], n), BIN_HARM);
+	claim(p, what, n, wrap(-f1, n), BIN_IMAGE);
+	claim(p, what, n, wrap(-f2, n), BIN_IMAGE);
+	for (b = 0; b < n; b++) {
+		if (what[b] == BIN_NOISE) {
+			noise += p[b];
+			nnoise++;
+		}
+	}
+	free(what);
+	noise = nnoise ? noise / nnoise : 0;
+
+	// take the noise out of the products, what is left of one below it reads as one bin of noise
+	for (j = 0; j < 4; j++)
+		im[j] = fmax(im[j] - noise * (2 * SPEC_LOBE + 1), noise);
+	mean = (tone[0] + tone[1]) / 2;
+	m->tone[0] = 10 * log10(tone[0]);
+	m->tone[1] = 10 * log10(tone[1]);
+	m->floor = 10 * log10(noise);
+	for (j = 0; j < 2; j++) {
+		m->im3[j] = 10 * log10(im[j] / mean);
+		m->im5[j] = 10 * log10(im[2 + j] / mean);
+	}
+	worst = fmax(m->im3[0], m->im3[1]);
+	m->oip3 = 10 * log10(mean) - worst / 2;
+	m->im3_snr = 10 * log10(fmax(im[0], im[1]) / noise);
+	return 0;
+}
+
+int mask_load(const char *path, struct spec_mask *m)
+{
+	char line[256], ref[16];
+	unsigned lineno = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return -errno;
+	memset(m, 0, sizeof(*m));
+	m->symmetric = true;
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line + strspn(line, " \t");
+		double khz, db;
+
+		lineno++;
+		p[strcspn(p, "#\n")] = 0;
+		if (!*p)
+			continue;
+		if (sscanf(p, "ref %15s", ref) == 1 && (!strcmp(ref, "peak") || !strcmp(ref, "dbfs"))) {
+			m->dbfs = !strcmp(ref, "dbfs");
+			continue;
+		}
+		if (sscanf(p, "%lf %lf", &khz, &db) != 2 || m->npt == MASK_POINTS ||
+		    (m->npt && khz < m->khz[m->npt - 1])) {
+			fprintf(stderr, "%s:%u: want \"ref peak|dbfs\" or \"khz db\" in order of frequency, at most %d\n",
+				path, lineno, MASK_POINTS);
+			fclose(f);
+			return -EINVAL;
+		}
+		if (khz < 0)
+			m->symmetric = false;
+		m->khz[m->npt] = khz;
+		m->db[m->npt++] = db;
+	}
+	fclose(f);
+	if (!m->npt) {
+		fprintf(stderr, "%s: no mask points\n", path);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+double mask_limit(const struct spec_mask *m, double khz)
+{
+	size_t k;
+
+	if (m->symmetric)
+		khz = fabs(khz);
+	if (khz <= m->khz[0])
+		return m->db[0];
+	for (k = 1; k < m->npt; k++) {
+		if (khz <= m->khz[k]) {
+			double w = m->khz[k] > m->khz[k - 1] ? (khz - m->khz[k - 1]) / (m->khz[k] - m->khz[k - 1]) : 1;
+			return m->db[k - 1] + w * (m->db[k] - m->db[k - 1]);
+		}
+	}
+	return m->db[m->npt - 1];
+}
+
+void mask_bins(const struct spec_mask *m, size_t n, double fs, double *lim)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++)
+		lim[k] = pow(10, mask_limit(m, signed_bin(k, n) * fs / n * 1e-3) / 10);
+}
+
+void mask_check(const struct spec_mask *m, const double *lim, const double *p, size_t n, struct mask_result *r)
+{
+	double ref = 1, worst = 0;
+	size_t k;
+
+	if (!m->dbfs) {
+		ref = 0;
+		for (k = 0; k < n; k++)
+			ref = fmax(ref, p[k]);
+	}
+	// largest level over limit without a logarithm per bin
+	r->worst = 0;
+	r->over = 0;
+	for (k = 0; k < n; k++) {
+		double x = p[k] / lim[k];
+		if (x > ref)
+			r->over++;
+		if (x > worst) {
+			worst = x;
+			r->worst = k;
+		}
+	}
+	r->ref = 10 * log10(ref);
+	r->margin = 10 * log10(ref / worst);
+}
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * spectrum.h - averaged spectra and the measurements taken from them
+ *
+ * The RX stream is cut into blocks of n samples, each is windowed with a
+ * 4 term Blackman-Harris window (sidelobes at -92 dB, main lobe +-4 bins)
+ * and transformed, and the power of every bin is averaged over blocks.
+ * Powers are scaled so that a complex tone of amplitude 1 (full scale)
+ * sums to 1 over its main lobe and white noise of variance s sums to s
+ * over all bins: dBFS is 10 log10 of a sum of bins.  Bin k is frequency
+ * k fs / n, the upper half are the negative frequencies.
+ **/
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <complex.h>
+
+#include "dsp.h"
+
+#define SPEC_LOBE 4   // bins either side of a tone that hold its power
+
+struct spectrum {
+	size_t n;
+	float *win;
+	double scale;         // 1 / (n sum w^2)
+	struct fft_plan *fwd;
+	float complex *buf;   // block being collected
+	size_t fill;
+	double *acc;          // sum of the powers of navg blocks
+	unsigned navg;
+};
+
+struct spectrum *spectrum_create(size_t n);
+void spectrum_destroy(struct spectrum *s);
+/* add samples (full scale 1.0), every complete block is transformed and accumulated */
+void spectrum_feed(struct spectrum *s, const float complex *x, size_t n);
+/* drop the averages and any partial block */
+void spectrum_reset(struct spectrum *s);
+/*
+ * average power per bin of the blocks so far into p (n values), then start
+ * over; the partial block is kept.  Returns the number of blocks averaged.
+ */
+unsigned spectrum_take(struct spectrum *s, double *p);
+
+/* bin of frequency hz, rounded, in 0 .. n-1 */
+size_t spectrum_bin(size_t n, double hz, double fs);
+/* sum of the bins within SPEC_LOBE of bin k, wrapping around */
+double spectrum_lobe(const double *p, size_t n, size_t k);
+
+/*
+ * single tone measurements.  The tone sits on bin k; harmonics 2 to
+ * SPEC_HARMONICS are looked for at +-h times its frequency (aliased), the
+ * image at minus the frequency.  DC is left out of everything.  Noise is
+ * what remains after taking out the tone, DC, the harmonics and the
+ * image, its mean per bin is counted for the excluded bins too.
+ */
+#define SPEC_HARMONICS 5
+
+struct tone_meas {
+	double level;     // tone power, dBFS
+	double floor;     // noise per bin, dBFS
+	double snr;       // tone over noise, dB
+	double sinad;     // tone over everything else, dB
+	double thd;       // harmonics over tone, dBc
+	double sfdr;      // tone over the largest spur, dB
+	double image;     // image over tone, dBc
+	double enob;      // (sinad - 1.76) / 6.02
+	size_t spur;      // bin of the largest spur
+};
+
+/* 0 or -ENOMEM */
+int tone_analyze(const double *p, size_t n, size_t k, struct tone_meas *m);
+
+/*
+ * two tone intermodulation, tones on bins k1 and k2.  The third order
+ * products are at 2 f1 - f2 and 2 f2 - f1, the fifth order ones at
+ * 3 f1 - 2 f2 and 3 f2 - 2 f1, index 0 below the tones and 1 above when
+ * f1 < f2.  The noise in their lobes is taken out.  The intercept is
+ * in the units of the spectrum, for the loopback dBFS at the RX.
+ */
+struct imd_meas {
+	double tone[2];   // dBFS
+	double im3[2];    // dBc, relative to the mean tone power
+	double im5[2];
+	double floor;     // noise per bin, dBFS
+	double im3_snr;   // stronger third order product over the noise per bin, dB
+	double oip3;      // output third order intercept, dBFS per tone
+};
+
+/* 0 or -ENOMEM */
+int imd_analyze(const double *p, size_t n, size_t k1, size_t k2, struct imd_meas *m);
+
+/*
+ * spectral mask: limits in dB per bin at frequency offsets from the LO,
+ * linear in between and held beyond the first and last point.  The text
+ * file has a "ref peak" (limits in dBc against the strongest bin, the
+ * default) or "ref dbfs" line and one "khz db" line per point in order of
+ * frequency, # starts a comment.  Without negative offsets the mask
+ * applies to both sides.
+ */
+#define MASK_POINTS 64
+
+struct spec_mask {
+	bool dbfs;
+	bool symmetric;
+	size_t npt;
+	double khz[MASK_POINTS], db[MASK_POINTS];
+};
+
+/* 0, -errno if the file can't be read or -EINVAL with a message on stderr */
+int mask_load(const char *path, struct spec_mask *m);
+/* limit at khz, dB */
+double mask_limit(const struct spec_mask *m, double khz);
+/* limit of every bin of an n point spectrum at sample rate fs as a power ratio */
+void mask_bins(const struct spec_mask *m, size_t n, double fs, double *lim);
+
+struct mask_result {
+	double ref;       // dBFS of the reference, the strongest bin or 0
+	double margin;    // smallest limit minus level over the bins, dB, negative when violated
+	size_t worst;     // its bin
+	size_t over;      // bins above the limit
+};
+
+void mask_check(const struct spec_mask *m, const double *lim, const double *p, size_t n, struct mask_result *r);
+
+#endif
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * tee.c - fan one RX stream out to several sinks
+ **/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "tee.h"
+
+struct tee_block {
+	atomic_uint refs;
+	size_t n;
+	struct tee_block *next;  // free list
+	int16_t *iq;
+};
+
+/* per sink queue of blocks, at most nblocks long */
+struct tee_queue {
+	struct tee *t;
+	const struct tee_sink *sink;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct tee_block **q;
+	size_t head, len;
+	bool done;
+};
+
+struct tee {
+	struct tee_sink sinks[TEE_MAX_SINKS];
+	struct tee_queue queue[TEE_MAX_SINKS];
+	size_t nsinks;
+	size_t nblocks;
+	struct tee_block *blocks;
+	int16_t *samples;
+	// free blocks
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct tee_block *free;
+	unsigned long stalls;
+};
+
+static struct tee_block *to_block(struct tee *t, int16_t *iq)
+{
+	size_t k;
+	for (k = 0; k < t->nblocks; k++)
+		if (t->blocks[k].iq == iq)
+			return &t->blocks[k];
+	return NULL;
+}
+
+static void tee_release(struct tee *t, struct tee_block *b)
+{
+	if (atomic_fetch_sub(&b->refs, 1) != 1)
+		return;
+	pthread_mutex_lock(&t->lock);
+	b->next = t->free;
+	t->free = b;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+}
+
+static void *tee_thread(void *arg)
+{
+	struct tee_queue *q = arg;
+
+	for (;;) {
+		struct tee_block *b;
+
+		pthread_mutex_lock(&q->lock);
+		while (!q->len && !q->done)
+			pthread_cond_wait(&q->cond, &q->lock);
+		if (!q->len) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		b = q->q[q->head];
+		q->head = (q->head + 1) % q->t->nblocks;
+		q->len--;
+		pthread_mutex_unlock(&q->lock);
+
+		q->sink->block(b->iq, b->n);
+		tee_release(q->t, b);
+	}
+	return NULL;
+}
+
+struct tee *tee_create(const struct tee_sink *sinks, size_t nsinks, size_t block_samples, size_t nblocks)
+{
+	struct tee *t;
+	size_t k;
+
+	if (!nsinks || nsinks > TEE_MAX_SINKS || !nblocks)
+		return NULL;
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->nsinks = nsinks;
+	t->nblocks = nblocks;
+	t->blocks = calloc(nblocks, sizeof(*t->blocks));
+	t->samples = malloc(nblocks * block_samples * 2 * sizeof(int16_t));
+	if (!t->blocks || !t->samples)
+		goto fail;
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	for (k = 0; k < nblocks; k++) {
+		t->blocks[k].iq = t->samples + k * block_samples * 2;
+		t->blocks[k].next = t->free;
+		t->free = &t->blocks[k];
+	}
+
+	for (k = 0; k < nsinks; k++) {
+		struct tee_queue *q = &t->queue[k];
+
+		t->sinks[k] = sinks[k];
+		q->t = t;
+		q->sink = &t->sinks[k];
+		q->q = calloc(nblocks, sizeof(*q->q));
+		pthread_mutex_init(&q->lock, NULL);
+		pthread_cond_init(&q->cond, NULL);
+		if (!q->q || pthread_create(&q->thread, NULL, tee_thread, q)) {
+			// tee_close unwinds the sinks before this one and the tee itself
+			pthread_mutex_destroy(&q->lock);
+			pthread_cond_destroy(&q->cond);
+			free(q->q);
+			t->nsinks = k;
+			tee_close(t);
+			return NULL;
+		}
+	}
+	return t;
+
+fail:
+	free(t->blocks);
+	free(t->samples);
+	free(t);
+	return NULL;
+}
+
+int16_t *tee_get(struct tee *t)
+{
+	struct tee_block *b;
+
+	pthread_mutex_lock(&t->lock);
+	if (!t->free)
+		t->stalls++;
+	while (!t->free)
+		pthread_cond_wait(&t->cond, &t->lock);
+	b = t->free;
+	t->free = b->next;
+	pthread_mutex_unlock(&t->lock);
+	return b->iq;
+}
+
+void tee_submit(struct tee *t, int16_t *iq, size_t n)
+{
+	struct tee_block *b = to_block(t, iq);
+	size_t k;
+
+	if (!b)
+		return;
+	b->n = n;
+	atomic_store(&b->refs, t->nsinks);
+	for (k = 0; k < t->nsinks; k++) {
+		struct tee_queue *q = &t->queue[k];
+
+		// a queue holds at most every block once, it never overflows
+		pthread_mutex_lock(&q->lock);
+		q->q[(q->head + q->len) % t->nblocks] = b;
+		q->len++;
+		pthread_cond_signal(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+void tee_close(struct tee *t)
+{
+	size_t k;
+
+	if (!t)
+		return;
+	for (k = 0; k < t->nsinks; k++) {
+		struct tee_queue *q = &t->queue[k];
+
+		pthread_mutex_lock(&q->lock);
+		q->done = true;
+		pthread_cond_signal(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+		pthread_join(q->thread, NULL);
+		pthread_mutex_destroy(&q->lock);
+		pthread_cond_destroy(&q->cond);
+		free(q->q);
+	}
+	pthread_mutex_destroy(&t->lock);
+	pthread_cond_destroy(&t->cond);
+	free(t->blocks);
+	free(t->samples);
+	free(t);
+}
+
+unsigned long tee_stalls(const struct tee *t)
+{
+	return t->stalls;
+}
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * tee.h - fan one RX stream out to several sinks
+ *
+ * The RX samples are copied out of rxbuf once, into a block from a small
+ * pool.  The block is handed to every sink, each running on its own
+ * thread, and goes back to the pool when the last sink is done with it.
+ * When a sink falls behind by the whole pool the producer waits for it;
+ * those waits are counted.
+ **/
+
+#ifndef TEE_H
+#define TEE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TEE_MAX_SINKS 8
+
+struct tee_sink {
+	const char *name;
+	// consume n interleaved I/Q samples, runs on the sink's thread
+	void (*block)(const int16_t *iq, size_t n);
+};
+
+struct tee;
+
+/* nblocks blocks of up to block_samples I/Q samples are shared by the sinks */
+struct tee *tee_create(const struct tee_sink *sinks, size_t nsinks, size_t block_samples, size_t nblocks);
+/* block to copy the next RX samples into, waits for a free one */
+int16_t *tee_get(struct tee *t);
+/* hand the block from tee_get, holding n samples, to all sinks */
+void tee_submit(struct tee *t, int16_t *iq, size_t n);
+/* let the sinks finish the queued blocks, stop the threads and free everything */
+void tee_close(struct tee *t);
+/* times tee_get had to wait for a sink */
+unsigned long tee_stalls(const struct tee *t);
+
+#endif
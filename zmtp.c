@@ -0,0 +1,521 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * zmtp.c - ZeroMQ PUB socket and SUB client speaking ZMTP 3.0 natively
+ **/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "net.h"
+#include "zmtp.h"
+
+#define ZMTP_GREETING  64
+#define ZMTP_MORE      0x01
+#define ZMTP_LONG      0x02
+#define ZMTP_COMMAND   0x04
+#define ZMTP_IN_MAX    1024         // largest frame taken from a subscriber
+#define ZMTP_TOPIC_MAX 64
+#define ZSUB_FRAME_MAX (64 << 20)
+
+/* a published message, frame header and body, shared by the queues it is on */
+struct zmsg {
+	unsigned refs;
+	size_t len;
+	uint8_t data[];
+};
+
+enum peer_state { PEER_GREETING, PEER_READY, PEER_ACTIVE };
+
+struct zpeer {
+	int fd;                          // -1 for a free slot
+	enum peer_state state;
+	uint8_t in[9 + ZMTP_IN_MAX];     // what was read and not parsed yet
+	size_t fill;
+	char topic[ZPUB_MAX_TOPICS][ZMTP_TOPIC_MAX];
+	size_t tlen[ZPUB_MAX_TOPICS];
+	unsigned ntopics;
+	struct zmsg **q;                 // hwm messages, head is being sent
+	size_t head, count, off;
+};
+
+struct zpub {
+	int lfd;
+	size_t hwm;
+	struct zpeer peer[ZPUB_MAX_PEERS];
+	struct zpub_stats st;
+};
+
+static void greeting(uint8_t *g, bool server)
+{
+	memset(g, 0, ZMTP_GREETING);
+	g[0] = 0xff;                     // signature, 8 bytes of padding, 0x7f
+	g[9] = 0x7f;
+	g[10] = 3;                       // version 3.0
+	g[11] = 0;
+	memcpy(g + 12, "NULL", 4);       // mechanism, 20 bytes
+	g[32] = server;
+}
+
+static bool greeting_ok(const uint8_t *g)
+{
+	return g[0] == 0xff && g[9] == 0x7f && g[10] >= 3 && !memcmp(g + 12, "NULL", 5);
+}
+
+/* READY command frame with the socket type, returns its length */
+static size_t ready(uint8_t *out, const char *type)
+{
+	size_t tl = strlen(type), n = 2;
+
+	out[n++] = 5;
+	memcpy(out + n, "READY", 5);
+	n += 5;
+	out[n++] = 11;
+	memcpy(out + n, "Socket-Type", 11);
+	n += 11;
+	out[n++] = 0;
+	out[n++] = 0;
+	out[n++] = 0;
+	out[n++] = tl;
+	memcpy(out + n, type, tl);
+	n += tl;
+	out[0] = ZMTP_COMMAND;
+	out[1] = n - 2;
+	return n;
+}
+
+/* frame header for a body of len bytes, returns its length */
+static size_t frame_header(uint8_t *h, uint8_t flags, uint64_t len)
+{
+	int k;
+
+	if (len <= 255) {
+		h[0] = flags;
+		h[1] = len;
+		return 2;
+	}
+	h[0] = flags | ZMTP_LONG;
+	for (k = 0; k < 8; k++)
+		h[1 + k] = len >> (56 - 8 * k);
+	return 9;
+}
+
+/*
+ * frame at the start of b: returns the bytes it takes, 0 when it is not all
+ * there yet or -1 when it is longer than max
+ */
+static ssize_t frame_parse(const uint8_t *b, size_t fill, size_t max, uint8_t *flags, size_t *body, size_t *len)
+{
+	uint64_t l = 0;
+	size_t h;
+	int k;
+
+	if (fill < 2)
+		return 0;
+	*flags = b[0];
+	if (b[0] & ZMTP_LONG) {
+		if (fill < 9)
+			return 0;
+		for (k = 0; k < 8; k++)
+			l = l << 8 | b[1 + k];
+		h = 9;
+	} else {
+		l = b[1];
+		h = 2;
+	}
+	if (l > max)
+		return -1;
+	if (fill < h + l)
+		return 0;
+	*body = h;
+	*len = l;
+	return h + l;
+}
+
+/* the Socket-Type property of a READY command body */
+static bool ready_type_ok(const uint8_t *b, size_t len)
+{
+	size_t pos;
+
+	if (len < 6 || b[0] != 5 || memcmp(b + 1, "READY", 5))
+		return false;
+	for (pos = 6; pos < len; ) {
+		size_t nl = b[pos], vl;
+		const uint8_t *name = b + pos + 1, *val;
+
+		if (pos + 1 + nl + 4 > len)
+			return false;
+		vl = (size_t)b[pos + 1 + nl] << 24 | b[pos + 2 + nl] << 16 | b[pos + 3 + nl] << 8 | b[pos + 4 + nl];
+		val = name + nl + 4;
+		if (pos + 5 + nl + vl > len)
+			return false;
+		if (nl == 11 && !strncasecmp((const char *)name, "Socket-Type", 11))
+			return (vl == 3 && !memcmp(val, "SUB", 3)) || (vl == 4 && !memcmp(val, "XSUB", 4));
+		pos += 5 + nl + vl;
+	}
+	return false;
+}
+
+static void subscribe(struct zpeer *z, bool on, const uint8_t *t, size_t tl)
+{
+	unsigned k;
+
+	if (tl > ZMTP_TOPIC_MAX)
+		return;
+	for (k = 0; k < z->ntopics; k++)
+		if (z->tlen[k] == tl && !memcmp(z->topic[k], t, tl))
+			break;
+	if (on && k == z->ntopics && z->ntopics < ZPUB_MAX_TOPICS) {
+		memcpy(z->topic[k], t, tl);
+		z->tlen[k] = tl;
+		z->ntopics++;
+	} else if (!on && k < z->ntopics) {
+		// the last one takes the place of the cancelled one
+		z->ntopics--;
+		if (k < z->ntopics) {
+			memcpy(z->topic[k], z->topic[z->ntopics], z->tlen[z->ntopics]);
+			z->tlen[k] = z->tlen[z->ntopics];
+		}
+	}
+}
+
+static bool matches(const struct zpeer *z, const void *msg, size_t len)
+{
+	unsigned k;
+
+	for (k = 0; k < z->ntopics; k++)
+		if (z->tlen[k] <= len && !memcmp(z->topic[k], msg, z->tlen[k]))
+			return true;
+	return false;
+}
+
+static void msg_put(struct zmsg *m)
+{
+	if (!--m->refs)
+		free(m);
+}
+
+static void peer_close(struct zpub *p, struct zpeer *z)
+{
+	while (z->count) {
+		msg_put(z->q[z->head]);
+		z->head = (z->head + 1) % p->hwm;
+		z->count--;
+	}
+	close(z->fd);
+	z->fd = -1;
+}
+
+/* the greeting, READY and subscriptions in what was read, 0 or -1 to drop the peer */
+static int peer_parse(struct zpub *p, struct zpeer *z)
+{
+	for (;;) {
+		size_t body, len, used;
+		uint8_t flags;
+		ssize_t n;
+
+		if (z->state == PEER_GREETING) {
+			if (z->fill < ZMTP_GREETING)
+				return 0;
+			if (!greeting_ok(z->in))
+				return -1;
+			used = ZMTP_GREETING;
+			z->state = PEER_READY;
+		} else {
+			n = frame_parse(z->in, z->fill, ZMTP_IN_MAX, &flags, &body, &len);
+			if (n <= 0)
+				return n;
+			used = n;
+			if (z->state == PEER_READY) {
+				if (!(flags & ZMTP_COMMAND) || !ready_type_ok(z->in + body, len))
+					return -1;
+				z->state = PEER_ACTIVE;
+				p->st.peers++;
+			} else if (flags & ZMTP_COMMAND) {
+				// 3.1 subscriptions, anything else (PING) is of no interest
+				const uint8_t *c = z->in + body;
+				if (len >= 10 && c[0] == 9 && !memcmp(c + 1, "SUBSCRIBE", 9))
+					subscribe(z, true, c + 10, len - 10);
+				else if (len >= 7 && c[0] == 6 && !memcmp(c + 1, "CANCEL", 6))
+					subscribe(z, false, c + 7, len - 7);
+			} else if (len >= 1 && z->in[body] <= 1) {
+				subscribe(z, z->in[body], z->in + body + 1, len - 1);
+			}
+		}
+		z->fill -= used;
+		memmove(z->in, z->in + used, z->fill);
+	}
+}
+
+static int peer_read(struct zpub *p, struct zpeer *z)
+{
+	for (;;) {
+		ssize_t n = recv(z->fd, z->in + z->fill, sizeof(z->in) - z->fill, 0);
+
+		if (n == 0)
+			return -1;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		z->fill += n;
+		if (peer_parse(p, z) < 0)
+			return -1;
+	}
+}
+
+static int peer_flush(struct zpub *p, struct zpeer *z)
+{
+	while (z->count) {
+		struct zmsg *m = z->q[z->head];
+		ssize_t n = send(z->fd, m->data + z->off, m->len - z->off, MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		z->off += n;
+		p->st.bytes += n;
+		if (z->off < m->len)
+			continue;
+		msg_put(m);
+		z->head = (z->head + 1) % p->hwm;
+		z->count--;
+		z->off = 0;
+		p->st.sent++;
+	}
+	return 0;
+}
+
+static void zpub_accept(struct zpub *p)
+{
+	uint8_t hello[ZMTP_GREETING + 32];
+	size_t len;
+	int fd, k, one = 1;
+
+	while ((fd = accept(p->lfd, NULL, NULL)) >= 0) {
+		for (k = 0; k < ZPUB_MAX_PEERS && p->peer[k].fd >= 0; k++)
+			;
+		// our greeting and READY fit in any socket buffer, a fresh one takes them whole
+		greeting(hello, true);
+		len = ZMTP_GREETING + ready(hello + ZMTP_GREETING, "PUB");
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (k == ZPUB_MAX_PEERS || send(fd, hello, len, MSG_NOSIGNAL) != (ssize_t)len) {
+			close(fd);
+			continue;
+		}
+		struct zmsg **q = p->peer[k].q;
+		memset(&p->peer[k], 0, sizeof(p->peer[k]));
+		p->peer[k].fd = fd;
+		p->peer[k].state = PEER_GREETING;
+		p->peer[k].q = q;
+	}
+}
+
+struct zpub *zpub_open(const char *port, size_t hwm)
+{
+	struct zpub *p = calloc(1, sizeof(*p));
+	int k;
+
+	if (!p)
+		return NULL;
+	p->hwm = hwm ? hwm : 1;
+	p->lfd = -1;
+	for (k = 0; k < ZPUB_MAX_PEERS; k++) {
+		p->peer[k].fd = -1;
+		if (!(p->peer[k].q = calloc(p->hwm, sizeof(*p->peer[k].q)))) {
+			zpub_close(p, 0, NULL);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+	p->lfd = net_listen(port, ZPUB_MAX_PEERS);
+	if (p->lfd < 0) {
+		int err = -p->lfd;
+		p->lfd = -1;
+		zpub_close(p, 0, NULL);
+		errno = err;
+		return NULL;
+	}
+	fcntl(p->lfd, F_SETFL, fcntl(p->lfd, F_GETFL) | O_NONBLOCK);
+	return p;
+}
+
+void zpub_poll(struct zpub *p)
+{
+	int k;
+
+	zpub_accept(p);
+	for (k = 0; k < ZPUB_MAX_PEERS; k++) {
+		struct zpeer *z = &p->peer[k];
+		if (z->fd >= 0 && (peer_read(p, z) < 0 || peer_flush(p, z) < 0))
+			peer_close(p, z);
+	}
+}
+
+int zpub_send(struct zpub *p, const void *msg, size_t len)
+{
+	struct zmsg *m = malloc(sizeof(*m) + 9 + len);
+	size_t h;
+	int k;
+
+	if (!m)
+		return -ENOMEM;
+	h = frame_header(m->data, 0, len);
+	memcpy(m->data + h, msg, len);
+	m->len = h + len;
+	m->refs = 1;
+	p->st.published++;
+
+	zpub_accept(p);
+	for (k = 0; k < ZPUB_MAX_PEERS; k++) {
+		struct zpeer *z = &p->peer[k];
+
+		if (z->fd < 0)
+			continue;
+		if (peer_read(p, z) < 0) {
+			peer_close(p, z);
+			continue;
+		}
+		if (z->state != PEER_ACTIVE || !matches(z, msg, len))
+			continue;
+		if (z->count == p->hwm) {
+			p->st.dropped++;
+		} else {
+			z->q[(z->head + z->count++) % p->hwm] = m;
+			m->refs++;
+		}
+		if (peer_flush(p, z) < 0)
+			peer_close(p, z);
+	}
+	msg_put(m);
+	return 0;
+}
+
+void zpub_close(struct zpub *p, int linger_ms, struct zpub_stats *s)
+{
+	struct timespec t0, t1;
+	int k;
+
+	if (!p)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (;;) {
+		struct pollfd pfd[ZPUB_MAX_PEERS];
+		nfds_t n = 0;
+		long ms;
+
+		for (k = 0; k < ZPUB_MAX_PEERS; k++)
+			if (p->peer[k].fd >= 0 && p->peer[k].count)
+				pfd[n++] = (struct pollfd){ .fd = p->peer[k].fd, .events = POLLOUT };
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+		if (!n || ms >= linger_ms)
+			break;
+		poll(pfd, n, linger_ms - ms);
+		for (k = 0; k < ZPUB_MAX_PEERS; k++)
+			if (p->peer[k].fd >= 0 && peer_flush(p, &p->peer[k]) < 0)
+				peer_close(p, &p->peer[k]);
+	}
+	for (k = 0; k < ZPUB_MAX_PEERS; k++) {
+		if (p->peer[k].fd >= 0)
+			peer_close(p, &p->peer[k]);
+		free(p->peer[k].q);
+	}
+	if (p->lfd >= 0)
+		close(p->lfd);
+	if (s)
+		*s = p->st;
+	free(p);
+}
+
+void zpub_get_stats(const struct zpub *p, struct zpub_stats *s)
+{
+	*s = p->st;
+}
+
+int zsub_connect(const char *hostport, const char *topic, int retry_ms)
+{
+	uint8_t hello[ZMTP_GREETING + 32], sub[2 + 1 + ZMTP_TOPIC_MAX], in[ZMTP_GREETING];
+	size_t tl = topic ? strlen(topic) : 0, len;
+	int fd, waited = 0, ret;
+
+	if (tl > ZMTP_TOPIC_MAX)
+		return -EINVAL;
+	// like a ZeroMQ SUB socket, keep trying until the publisher is up
+	while ((fd = net_connect(hostport)) == -ECONNREFUSED && waited < retry_ms) {
+		usleep(50000);
+		waited += 50;
+	}
+	if (fd < 0)
+		return fd;
+
+	greeting(hello, false);
+	len = ZMTP_GREETING + ready(hello + ZMTP_GREETING, "SUB");
+	sub[0] = 0;
+	sub[1] = 1 + tl;
+	sub[2] = 1;
+	memcpy(sub + 3, topic, tl);
+	if ((ret = net_send(fd, hello, len)) < 0 || (ret = net_send(fd, sub, 3 + tl)) < 0 ||
+	    (ret = net_recv(fd, in, sizeof(in))) < 0) {
+		net_close(fd);
+		return ret;
+	}
+	if (!greeting_ok(in)) {
+		net_close(fd);
+		return -EPROTO;
+	}
+	// the publisher's READY is the first frame, zsub_recv skips commands
+	return fd;
+}
+
+ssize_t zsub_recv(int fd, void **buf, size_t *cap)
+{
+	size_t total = 0;
+	uint8_t h[9];
+
+	for (;;) {
+		uint64_t len = 0;
+		int ret, k;
+
+		if ((ret = net_recv(fd, h, 2)) < 0)
+			return ret;
+		if (h[0] & ZMTP_LONG) {
+			if ((ret = net_recv(fd, h + 2, 7)) < 0)
+				return ret;
+			for (k = 0; k < 8; k++)
+				len = len << 8 | h[1 + k];
+		} else {
+			len = h[1];
+		}
+		if (len > ZSUB_FRAME_MAX)
+			return -EMSGSIZE;
+		if (total + len > *cap) {
+			void *b = realloc(*buf, total + len);
+			if (!b)
+				return -ENOMEM;
+			*buf = b;
+			*cap = total + len;
+		}
+		if ((ret = net_recv(fd, (char *)*buf + total, len)) < 0)
+			return ret;
+		if (h[0] & ZMTP_COMMAND)
+			continue;
+		total += len;
+		if (!(h[0] & ZMTP_MORE))
+			return total;
+	}
+}
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * zmtp.h - ZeroMQ PUB socket and SUB client speaking ZMTP 3.0 natively
+ *
+ * Enough of the ZeroMQ wire protocol (ZMTP 3.0, NULL security) to publish
+ * messages to ZeroMQ SUB sockets, the GNU Radio ZMQ SUB Source among
+ * them, without linking libzmq: a 64 byte greeting each way, a READY
+ * command with the socket type, then frames of a flags byte, the length
+ * (one byte, or eight big endian with the LONG flag) and the body.
+ * Subscriptions arrive as messages starting with 1 (subscribe) or 0
+ * (cancel) followed by the prefix, or as ZMTP 3.1 SUBSCRIBE and CANCEL
+ * commands; a message goes to the subscribers with a prefix of it.
+ *
+ * The publisher never blocks.  Its sockets are non-blocking and every
+ * zpub_send also accepts new subscribers, reads their subscriptions and
+ * sends what they have queued.  At most hwm messages wait for one
+ * subscriber, further ones are dropped for it, as a ZeroMQ PUB socket
+ * does at its high-water mark.  A message is kept once however many
+ * subscribers it is queued for.
+ **/
+
+#ifndef ZMTP_H
+#define ZMTP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define ZPUB_MAX_PEERS  8
+#define ZPUB_MAX_TOPICS 8    // subscriptions per subscriber
+
+struct zpub;
+
+struct zpub_stats {
+	unsigned long peers;         // subscribers that completed the handshake
+	unsigned long published;     // zpub_send calls
+	unsigned long sent;          // messages written out, per subscriber
+	unsigned long dropped;       // not queued because a subscriber was at hwm
+	unsigned long long bytes;
+};
+
+/* listen on port, all addresses.  NULL with errno set on errors */
+struct zpub *zpub_open(const char *port, size_t hwm);
+/* publish len bytes as one message, 0 or -ENOMEM */
+int zpub_send(struct zpub *p, const void *msg, size_t len);
+/* accept, read subscriptions and send what is queued, without waiting */
+void zpub_poll(struct zpub *p);
+/* give the queues up to linger_ms to drain, then close everything; s gets the final counts */
+void zpub_close(struct zpub *p, int linger_ms, struct zpub_stats *s);
+void zpub_get_stats(const struct zpub *p, struct zpub_stats *s);
+
+/*
+ * SUB client: connect to "host:port", trying again every 50 ms for up to
+ * retry_ms while nobody listens, do the handshake and subscribe to the
+ * prefix (NULL or "" for everything).  Returns the socket or -errno.
+ */
+int zsub_connect(const char *hostport, const char *topic, int retry_ms);
+/*
+ * next message into *buf, grown as needed, the frames of a multipart one
+ * one after the other.  Returns its length or -errno, -EPIPE when the
+ * publisher closed.
+ */
+ssize_t zsub_recv(int fd, void **buf, size_t *cap);
+
+#endif